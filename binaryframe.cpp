@@ -0,0 +1,75 @@
+/*
+ Binary frames for the roof controller link
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "binaryframe.h"
+
+#include <string.h>
+
+static_assert(sizeof(BinaryFrame) == BINARY_FRAME_SIZE, "BinaryFrame must have no padding");
+
+// CRC-16/CCITT-FALSE, bitwise to keep it small enough for the controller
+uint16_t binaryCrc(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void binaryEncode(BinaryFrame *frame, uint8_t type, uint8_t seq, uint8_t arg0, uint8_t arg1)
+{
+    frame->sync = BINARY_SYNC;
+    frame->type = type;
+    frame->seq = seq;
+    frame->arg[0] = arg0;
+    frame->arg[1] = arg1;
+    uint16_t crc = binaryCrc(&frame->type, 4);
+    frame->crc[0] = crc & 0xFF;
+    frame->crc[1] = crc >> 8;
+}
+
+int binaryDecode(const uint8_t *buf, size_t len, size_t *used, const BinaryFrame **frame)
+{
+    const uint8_t *start = static_cast<const uint8_t *>(memchr(buf, BINARY_SYNC, len));
+
+    *frame = nullptr;
+    if (start == nullptr)
+    {
+        *used = len;
+        return BINARY_NEED_MORE;
+    }
+    *used = start - buf;
+    if (len - *used < BINARY_FRAME_SIZE)
+        return BINARY_NEED_MORE;
+
+    const BinaryFrame *candidate = reinterpret_cast<const BinaryFrame *>(start);
+    uint16_t crc = binaryCrc(&candidate->type, 4);
+    if (candidate->crc[0] != (crc & 0xFF) || candidate->crc[1] != (crc >> 8))
+    {
+        *used += 1;
+        return BINARY_CORRUPT;
+    }
+    *used += BINARY_FRAME_SIZE;
+    *frame = candidate;
+    return BINARY_FRAME;
+}
@@ -0,0 +1,68 @@
+/*
+ Binary frames for the roof controller link
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+// Plain C headers and no allocation, so the same code builds into the controller sketch
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every frame is seven bytes: a sync byte, the frame type, a sequence number, two argument bytes and a
+ * CRC-16/CCITT over type, sequence and arguments, low byte first. Only single bytes are used so the layout
+ * is the same on any compiler and a frame is read in place from the receive buffer.
+ *
+ * The driver sends a request and the controller answers with the same type and sequence number, with
+ * FRAME_REPLY set, or with FRAME_NAK also set and a reason in arg[0]. HELLO is answered with the major and
+ * minor version, STATUS with one bit per switch in arg[0], COMMAND (arg[0] the command, arg[1] on or off)
+ * with the command repeated.
+ */
+struct BinaryFrame
+{
+    uint8_t sync;
+    uint8_t type;
+    uint8_t seq;
+    uint8_t arg[2];
+    uint8_t crc[2];
+};
+
+#define BINARY_SYNC         0xA5
+#define BINARY_FRAME_SIZE   7
+
+enum { FRAME_HELLO = 0x01, FRAME_STATUS = 0x02, FRAME_COMMAND = 0x03 };
+#define FRAME_TYPE_MASK     0x3F
+#define FRAME_NAK           0x40
+#define FRAME_REPLY         0x80
+
+// Commands, and the switch bits of a status reply
+enum { CMD_OPEN, CMD_CLOSE, CMD_ABORT, CMD_LOCK, CMD_AUX };
+enum { STATUS_OPENED = 0x01, STATUS_CLOSED = 0x02, STATUS_LOCKED = 0x04, STATUS_AUX = 0x08 };
+// NAK reasons
+enum { NAK_REFUSED = 1, NAK_UNKNOWN = 2, NAK_BUSY = 3 };
+
+enum { BINARY_NEED_MORE, BINARY_FRAME, BINARY_CORRUPT };
+
+uint16_t binaryCrc(const uint8_t *data, size_t len);
+void binaryEncode(BinaryFrame *frame, uint8_t type, uint8_t seq, uint8_t arg0, uint8_t arg1);
+
+/*
+ * Looks for the next frame in buf. *used is set to the bytes the caller may discard: noise before a sync byte,
+ * plus the frame when one is found. BINARY_FRAME points *frame into buf, BINARY_CORRUPT discards only the
+ * sync byte of a frame that failed its CRC so a real frame inside it is still found.
+ */
+int binaryDecode(const uint8_t *buf, size_t len, size_t *used, const BinaryFrame **frame);
@@ -0,0 +1,70 @@
+/*
+ Roof requests waiting for the hardware
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "commandqueue.h"
+
+bool CommandQueue::post(Kind kind, int value)
+{
+    if (queued[kind] && (values[kind] == value || (kind == MOTION && values[kind] == MOVE_CLOSE)))
+        return false;
+    queued[kind] = true;
+    values[kind] = value;
+    return true;
+}
+
+CommandQueue::Disposition CommandQueue::motion(int value, int moving, bool canReverse)
+{
+    if (moving == value)
+        return MERGE;
+    if (moving == MOVE_NONE)
+    {
+        // Behind a request already waiting unless it is a close, which takes that one's place
+        if (!queued[MOTION] || value == MOVE_CLOSE)
+        {
+            cancel(MOTION);
+            return RUN;
+        }
+    }
+    else if (canReverse)
+    {
+        cancel(MOTION);
+        return RUN;
+    }
+    return post(MOTION, value) ? HOLD : MERGE;
+}
+
+bool CommandQueue::take(Kind *kind, int *value)
+{
+    for (int i = 0; i < KINDS; i++)
+    {
+        if (queued[i])
+        {
+            queued[i] = false;
+            *kind = static_cast<Kind>(i);
+            *value = values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandQueue::clear()
+{
+    for (int i = 0; i < KINDS; i++)
+        queued[i] = false;
+}
@@ -0,0 +1,55 @@
+/*
+ Roof requests waiting for the hardware
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Roof requests waiting for the hardware to be free. Each kind of request has one slot, so a repeated request
+ * merges with the one waiting instead of queueing behind it, and a burst of requests costs no more than one.
+ * Slots are taken in priority order: roof motion, then the lock, then the auxiliary output. A waiting close
+ * is never replaced by an open. Abort is never queued, it clears the queue.
+ *
+ * motion() decides what becomes of a roof motion request before anything acts on it. A close while the roof
+ * opens and cannot be reversed waits for the open to end, however it ends, so that the open stays supervised.
+ */
+class CommandQueue
+{
+  public:
+    enum Kind { MOTION, LOCK, AUX, KINDS };
+    // MOTION values, LOCK and AUX take on or off
+    enum { MOVE_NONE = -1, MOVE_OPEN, MOVE_CLOSE };
+    // What becomes of a motion request: carried out now, merged with the movement or request already there,
+    // or held until the roof has stopped
+    enum Disposition { RUN, MERGE, HOLD };
+
+    // False if the request merged with an identical one or was dropped in favour of a waiting close
+    bool post(Kind kind, int value);
+    bool pending(Kind kind) const { return queued[kind]; }
+    // A motion request given the movement under way, MOVE_NONE when at rest. Posts it when it is held.
+    Disposition motion(int value, int moving, bool canReverse);
+    // Take the highest priority request, false if none is waiting
+    bool take(Kind *kind, int *value);
+    void cancel(Kind kind) { queued[kind] = false; }
+    void clear();
+
+  private:
+    bool queued[KINDS] {};
+    int values[KINDS] {};
+};
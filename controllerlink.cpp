@@ -0,0 +1,618 @@
+/*
+ Link to a roof controller running the Arduino roll-off protocol
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "controllerlink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define REPLY_TIMEOUT_MS    2000        // Longest wait for a reply before the pipeline is abandoned
+#define STATE_MAX_AGE_MS    5000        // Oldest cached switch state that is still reported
+#define CONNECT_TIMEOUT_MS  5000        // Longest wait for a TCP connection to be accepted
+#define BACKOFF_MIN_MS      1000        // First wait before reopening a dropped link, doubled on each failure
+#define BACKOFF_MAX_MS      30000
+#define KEEPALIVE_IDLE_S    10          // TCP keepalive probes after this idle time,
+#define KEEPALIVE_INTVL_S   5           // repeated at this interval,
+#define KEEPALIVE_COUNT     3           // until this many have gone unanswered
+
+static const char *switchTargets[ControllerLink::SW_COUNT] = { "OPENED", "CLOSED", "LOCKED", "AUXSTATE" };
+// In CMD_ order
+#define CMD_COUNT 5
+static const char *commandTargets[CMD_COUNT] = { "OPEN", "CLOSE", "ABORT", "LOCK", "AUXSET" };
+
+static long elapsedMs(const struct timespec &since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000;
+}
+
+static speed_t baudConstant(int baud)
+{
+    switch (baud)
+    {
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        default:
+            return B38400;
+    }
+}
+
+int SerialTransport::open()
+{
+    struct termios tty;
+
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (tcgetattr(fd, &tty) != 0)
+    {
+        close();
+        return -1;
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, baudConstant(speed));
+    cfsetospeed(&tty, baudConstant(speed));
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    // With the port non-blocking this makes an empty read fail with EAGAIN, a zero length read is a hangup
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tty) != 0)
+    {
+        close();
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+void SerialTransport::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+ssize_t SerialTransport::read(char *buf, size_t count)
+{
+    return fd < 0 ? -1 : ::read(fd, buf, count);
+}
+
+ssize_t SerialTransport::write(const char *buf, size_t count)
+{
+    return fd < 0 ? -1 : ::write(fd, buf, count);
+}
+
+bool TcpTransport::resolve(const std::string &host, int port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result = nullptr;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr)
+        return false;
+    memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    addrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+int TcpTransport::open()
+{
+    int one = 1;
+    int idle = KEEPALIVE_IDLE_S;
+    int interval = KEEPALIVE_INTVL_S;
+    int count = KEEPALIVE_COUNT;
+
+    close();
+    if (addrLen == 0)
+        return -1;
+    fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    // Small requests go out at once rather than waiting to be coalesced
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    if (connect(fd, (struct sockaddr *)&addr, addrLen) != 0 && errno != EINPROGRESS)
+    {
+        close();
+        return -1;
+    }
+    return fd;
+}
+
+void TcpTransport::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    connected = false;
+}
+
+ssize_t TcpTransport::read(char *buf, size_t count)
+{
+    return fd < 0 ? -1 : recv(fd, buf, count, 0);
+}
+
+ssize_t TcpTransport::write(const char *buf, size_t count)
+{
+    return fd < 0 ? -1 : send(fd, buf, count, MSG_NOSIGNAL);
+}
+
+int TcpTransport::established()
+{
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    if (fd < 0)
+        return -1;
+    if (connected)
+        return 1;
+    if (::poll(&pfd, 1, 0) <= 0)
+        return 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+        return -1;
+    connected = true;
+    return 1;
+}
+
+ControllerLink::ControllerLink(std::unique_ptr<LinkTransport> transport, Report reporter, Protocol linkProtocol)
+    : io(std::move(transport)), report(std::move(reporter)), protocol(linkProtocol)
+{
+}
+
+ControllerLink::~ControllerLink()
+{
+    close();
+}
+
+bool ControllerLink::open()
+{
+    close();
+    reconnectCount = 0;
+    backoffMs = BACKOFF_MIN_MS;
+    lost = false;
+    return reopen();
+}
+
+bool ControllerLink::reopen()
+{
+    clock_gettime(CLOCK_MONOTONIC, &attempt);
+    linkFd = io->open();
+    if (linkFd < 0)
+        return false;
+    if (fdChange)
+        fdChange(linkFd);
+    linkState = LINK_CONNECTING;
+    return true;
+}
+
+void ControllerLink::close()
+{
+    if (linkFd >= 0 && fdChange)
+        fdChange(-1);
+    io->close();
+    linkFd = -1;
+    linkState = LINK_DOWN;
+    connected = false;
+    timeouts = 0;
+    pendingCount = 0;
+    inLen = 0;
+    outLen = 0;
+}
+
+// Close the link for poll() to reopen after the backoff. Only the first loss is reported, each retry after
+// that waits twice as long as the one before.
+void ControllerLink::drop(const char *why)
+{
+    if (lost)
+        backoffMs = std::min(BACKOFF_MAX_MS, backoffMs * 2);
+    else
+    {
+        char message[LINE_SIZE];
+        snprintf(message, sizeof(message), "Controller link down, %s. Retrying in the background", why);
+        report(true, message);
+    }
+    lost = true;
+    close();
+    clock_gettime(CLOCK_MONOTONIC, &attempt);
+}
+
+bool ControllerLink::writeLine(const char *line)
+{
+    return writeBytes(line, strlen(line));
+}
+
+bool ControllerLink::writeBytes(const char *data, size_t len)
+{
+    if (linkState != LINK_UP || outLen + len > sizeof(out))
+        return false;
+    memcpy(out + outLen, data, len);
+    outLen += len;
+    flush();
+    return linkState == LINK_UP;    // False if the write found the link gone
+}
+
+void ControllerLink::flush()
+{
+    while (outLen > 0)
+    {
+        ssize_t n = io->write(out, outLen);
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            drop(strerror(errno));
+            return;
+        }
+        if (n <= 0)
+            return;         // Full, what is left goes on the next flush
+        memmove(out, out + n, outLen - n);
+        outLen -= n;
+    }
+}
+
+bool ControllerLink::readLine(char *line, size_t size)
+{
+    for (;;)
+    {
+        // Drop anything before the start of a frame, then look for its end
+        char *start = static_cast<char *>(memchr(in, '(', inLen));
+        if (start == nullptr)
+            inLen = 0;
+        else if (start != in)
+        {
+            inLen -= start - in;
+            memmove(in, start, inLen);
+        }
+        char *end = static_cast<char *>(memchr(in, ')', inLen));
+        if (end != nullptr)
+        {
+            size_t len = end - in + 1;
+            if (len < size)
+            {
+                memcpy(line, in, len);
+                line[len] = '\0';
+            }
+            inLen -= len;
+            memmove(in, in + len, inLen);
+            if (len < size)
+                return true;
+            continue;
+        }
+        if (inLen == sizeof(in))
+        {
+            inLen = 0;      // A frame too long for the buffer is garbage
+            errors++;
+        }
+        if (!fill())
+            return false;
+    }
+}
+
+// Append what has arrived to the input buffer, false when nothing is waiting or the link has dropped
+bool ControllerLink::fill()
+{
+    if (linkState != LINK_UP || inLen == sizeof(in))
+        return false;
+    ssize_t n = io->read(in + inLen, sizeof(in) - inLen);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        drop(n == 0 ? "closed by the controller" : strerror(errno));
+        return false;
+    }
+    if (n < 0)
+        return false;
+    inLen += n;
+    return true;
+}
+
+void ControllerLink::receive()
+{
+    if (protocol == PROTO_TEXT)
+    {
+        char line[LINE_SIZE];
+        while (readLine(line, sizeof(line)))
+            response(line);
+        return;
+    }
+    for (;;)
+    {
+        const BinaryFrame *frame;
+        size_t used;
+        int result = binaryDecode(reinterpret_cast<const uint8_t *>(in), inLen, &used, &frame);
+        // The frame is read where it lies, before the buffer is moved up
+        if (result == BINARY_FRAME)
+            frameResponse(*frame);
+        else if (result == BINARY_CORRUPT)
+            errors++;
+        inLen -= used;
+        memmove(in, in + used, inLen);
+        if (result == BINARY_NEED_MORE && !fill())
+            return;
+    }
+}
+
+bool ControllerLink::request(const char *cmd, const char *target, const char *value)
+{
+    char line[LINE_SIZE];
+
+    if (linkState != LINK_UP || pendingCount == MAX_PENDING)
+        return false;
+    if (protocol == PROTO_BINARY)
+        return requestFrame(cmd, target, value);
+    snprintf(line, sizeof(line), "(%s:%s:%s)", cmd, target, value);
+    if (!writeLine(line))
+        return false;
+    Pending &p = pending[(pendingHead + pendingCount) % MAX_PENDING];
+    snprintf(p.target, sizeof(p.target), "%s", target);
+    p.seq = -1;
+    clock_gettime(CLOCK_MONOTONIC, &p.sent);
+    pendingCount++;
+    return true;
+}
+
+// The text request as a binary frame. Any GET becomes a STATUS request, which answers for every switch.
+bool ControllerLink::requestFrame(const char *cmd, const char *target, const char *value)
+{
+    BinaryFrame frame;
+    uint8_t type = FRAME_COMMAND;
+    int command = 0;
+
+    if (strcmp(cmd, "CON") == 0)
+        type = FRAME_HELLO;
+    else if (strcmp(cmd, "GET") == 0)
+    {
+        type = FRAME_STATUS;
+        target = "STATUS";
+    }
+    else
+    {
+        while (command < CMD_COUNT && strcmp(target, commandTargets[command]) != 0)
+            command++;
+        if (command == CMD_COUNT)
+            return false;
+    }
+    binaryEncode(&frame, type, nextSeq, command, strcmp(value, "ON") == 0);
+    if (!writeBytes(reinterpret_cast<const char *>(&frame), sizeof(frame)))
+        return false;
+    Pending &p = pending[(pendingHead + pendingCount) % MAX_PENDING];
+    snprintf(p.target, sizeof(p.target), "%s", target);
+    p.seq = nextSeq++;
+    clock_gettime(CLOCK_MONOTONIC, &p.sent);
+    pendingCount++;
+    return true;
+}
+
+bool ControllerLink::queued(const char *target) const
+{
+    for (int i = 0; i < pendingCount; i++)
+        if (strcmp(pending[(pendingHead + i) % MAX_PENDING].target, target) == 0)
+            return true;
+    return false;
+}
+
+/*
+ * Retire the oldest outstanding request for this target, or with this sequence number when seq is not -1.
+ * Replies come in request order, one for a later request means the ones before it were lost.
+ */
+bool ControllerLink::takePending(const char *target, int seq)
+{
+    if (pendingCount == 0)
+        return false;       // A late reply to a request already given up on
+
+    int skipped = 0;
+    while (pendingCount > 0 &&
+            (seq < 0 ? strcmp(pending[pendingHead].target, target) != 0 : pending[pendingHead].seq != seq))
+    {
+        pendingHead = (pendingHead + 1) % MAX_PENDING;
+        pendingCount--;
+        skipped++;
+    }
+    if (pendingCount == 0)
+    {
+        errors++;
+        return false;
+    }
+    pendingHead = (pendingHead + 1) % MAX_PENDING;
+    pendingCount--;
+    timeouts = 0;
+    if (skipped)
+        errors++;
+    return true;
+}
+
+void ControllerLink::response(const char *line)
+{
+    char type[8] = "";
+    char target[16] = "";
+    char value[LINE_SIZE] = "";
+
+    if (sscanf(line, "(%7[^:]:%15[^:]:%255[^)])", type, target, value) < 2)
+    {
+        errors++;
+        return;
+    }
+    if (!takePending(target, -1))
+        return;
+
+    if (strcmp(type, "NAK") == 0)
+    {
+        char message[2 * LINE_SIZE];
+        snprintf(message, sizeof(message), "Controller refused %s: %s", target, value);
+        report(true, message);
+        return;
+    }
+    if (strcmp(target, "0") == 0 && !connected)
+    {
+        answered(value);
+        return;
+    }
+    for (int i = 0; i < SW_COUNT; i++)
+    {
+        if (strcmp(target, switchTargets[i]) == 0)
+        {
+            state[i] = (strcmp(value, "ON") == 0);
+            clock_gettime(CLOCK_MONOTONIC, &stateTime[i]);
+        }
+    }
+}
+
+void ControllerLink::frameResponse(const BinaryFrame &frame)
+{
+    if (!(frame.type & FRAME_REPLY))
+    {
+        errors++;
+        return;
+    }
+    if (!takePending(nullptr, frame.seq))
+        return;
+
+    if (frame.type & FRAME_NAK)
+    {
+        static const char *reasons[] = { "unknown", "refused", "unknown command", "busy" };
+        char message[LINE_SIZE];
+        // takePending() moved past any lost requests, the one answered was just before the new head
+        const char *target = pending[(pendingHead + MAX_PENDING - 1) % MAX_PENDING].target;
+        snprintf(message, sizeof(message), "Controller refused %s: %s", target,
+                 frame.arg[0] <= NAK_BUSY ? reasons[frame.arg[0]] : reasons[0]);
+        report(true, message);
+        return;
+    }
+    switch (frame.type & FRAME_TYPE_MASK)
+    {
+        case FRAME_HELLO:
+            if (!connected)
+            {
+                char version[16];
+                snprintf(version, sizeof(version), "%u.%u", frame.arg[0], frame.arg[1]);
+                answered(version);
+            }
+            break;
+        case FRAME_STATUS:
+            // Status bits are in SW_ order
+            for (int i = 0; i < SW_COUNT; i++)
+            {
+                state[i] = (frame.arg[0] >> i) & 1;
+                clock_gettime(CLOCK_MONOTONIC, &stateTime[i]);
+            }
+            break;
+    }
+}
+
+// The controller has answered the connect request
+void ControllerLink::answered(const char *version)
+{
+    char message[2 * LINE_SIZE];
+
+    connected = true;
+    backoffMs = BACKOFF_MIN_MS;
+    if (lost)
+        reconnectCount++;
+    snprintf(message, sizeof(message), "Controller %s, version %s", lost ? "link restored" : "connected", version);
+    lost = false;
+    report(false, message);
+}
+
+void ControllerLink::resync()
+{
+    pendingCount = 0;
+    inLen = 0;
+    if (!connected)         // Connect requests are expected to go unanswered while the controller boots
+        return;
+    errors++;
+    if (++timeouts >= MAX_TIMEOUTS)
+        drop("no replies");
+}
+
+void ControllerLink::poll()
+{
+    if (linkState == LINK_DOWN)
+    {
+        if (linkFd < 0 && elapsedMs(attempt) >= backoffMs && !reopen())
+            backoffMs = std::min(BACKOFF_MAX_MS, backoffMs * 2);
+        return;
+    }
+    if (linkState == LINK_CONNECTING)
+    {
+        int established = io->established();
+        if (established < 0 || (established == 0 && elapsedMs(attempt) > CONNECT_TIMEOUT_MS))
+            drop(established < 0 ? "connection refused" : "connection timed out");
+        if (established <= 0)
+            return;
+        // An Arduino resets when its port opens and misses anything sent while it boots, the connect
+        // request below is repeated until it is answered
+        linkState = LINK_UP;
+    }
+    flush();
+    if (pendingCount > 0 && elapsedMs(pending[pendingHead].sent) > REPLY_TIMEOUT_MS)
+        resync();
+    if (linkState == LINK_UP && !connected && pendingCount == 0)
+        request("CON", "0", "0");
+}
+
+void ControllerLink::requestStatus()
+{
+    if (!connected)
+        return;
+    if (protocol == PROTO_BINARY)
+    {
+        if (!queued("STATUS"))
+            request("GET", "STATUS", "0");
+        return;
+    }
+    for (int i = 0; i < SW_COUNT; i++)
+        if (!queued(switchTargets[i]))
+            request("GET", switchTargets[i], "0");
+}
+
+bool ControllerLink::switchState(int sw, bool *on) const
+{
+    if (sw < 0 || sw >= SW_COUNT || stateTime[sw].tv_sec == 0 || elapsedMs(stateTime[sw]) > STATE_MAX_AGE_MS)
+        return false;
+    *on = state[sw];
+    return true;
+}
+
+int ControllerLink::takeErrors()
+{
+    int n = errors;
+    errors = 0;
+    return n;
+}
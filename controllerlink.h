@@ -0,0 +1,196 @@
+/*
+ Link to a roof controller running the Arduino roll-off protocol
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "binaryframe.h"
+
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*
+ * Byte stream to the controller. Implementations open non-blocking so reads and writes never wait.
+ */
+class LinkTransport
+{
+  public:
+    virtual ~LinkTransport() = default;
+    // Returns the descriptor to watch for input, or -1
+    virtual int open() = 0;
+    virtual void close() = 0;
+    virtual ssize_t read(char *buf, size_t count) = 0;
+    virtual ssize_t write(const char *buf, size_t count) = 0;
+    // 1 once usable, 0 while still connecting, -1 if the connection attempt failed
+    virtual int established() { return 1; }
+};
+
+class SerialTransport : public LinkTransport
+{
+  public:
+    SerialTransport(const std::string &device, int baud) : path(device), speed(baud) {}
+    ~SerialTransport() override { close(); }
+    int open() override;
+    void close() override;
+    ssize_t read(char *buf, size_t count) override;
+    ssize_t write(const char *buf, size_t count) override;
+
+  private:
+    std::string path;
+    int speed;
+    int fd = -1;
+};
+
+/*
+ * TCP connection to a network controller. The connect does not wait, established() reports when it has
+ * completed. Keepalive probes find a peer that has gone away while the link is idle.
+ */
+class TcpTransport : public LinkTransport
+{
+  public:
+    // Resolves the address, the only step that may wait
+    bool resolve(const std::string &host, int port);
+    ~TcpTransport() override { close(); }
+    int open() override;
+    void close() override;
+    ssize_t read(char *buf, size_t count) override;
+    ssize_t write(const char *buf, size_t count) override;
+    int established() override;
+
+  private:
+    struct sockaddr_storage addr {};
+    socklen_t addrLen = 0;
+    int fd = -1;
+    bool connected = false;
+};
+
+/*
+ * The Arduino roll-off protocol over a LinkTransport. Requests are "(CMD:TARGET:VALUE)" and each is answered
+ * in order by "(ACK:TARGET:VALUE)" or "(NAK:TARGET:MESSAGE)". Several requests may be outstanding, replies are
+ * matched to them first in first out and checked by target. Switch states from GET replies are cached so the
+ * driver reads them without waiting, a status refresh queues a GET for every switch at once.
+ *
+ * Input is framed from '(' to ')' in a fixed buffer, output is queued in another. Nothing here blocks, the
+ * driver calls receive() when the descriptor is readable, which hands each frame to response(), and calls
+ * poll() from its timer.
+ *
+ * A link that closes, errors, or leaves MAX_TIMEOUTS status rounds unanswered is dropped and reopened by
+ * poll() after a backoff, without the driver doing anything. The descriptor changes when it reopens, the
+ * FdChange callback is told before the old one is closed and after the new one is opened.
+ *
+ * PROTO_BINARY speaks the same requests in BinaryFrame packets instead. Replies are matched by sequence
+ * number, and one STATUS request returns every switch.
+ */
+class ControllerLink
+{
+  public:
+    enum { SW_OPENED, SW_CLOSED, SW_LOCKED, SW_AUX, SW_COUNT };
+    static constexpr int MAX_PENDING = 8;
+    static constexpr int LINE_SIZE = 256;
+    static constexpr int MAX_TIMEOUTS = 3;
+
+    // Messages for the driver log: NAK replies, the controller version, protocol errors
+    using Report = std::function<void(bool error, const char *message)>;
+    using FdChange = std::function<void(int fd)>;
+    enum Protocol { PROTO_TEXT, PROTO_BINARY };
+
+    ControllerLink(std::unique_ptr<LinkTransport> transport, Report report, Protocol protocol = PROTO_TEXT);
+    ~ControllerLink();
+
+    // False if the first attempt failed, later attempts are made by poll()
+    bool open();
+    void close();
+    void onFdChange(FdChange change) { fdChange = std::move(change); }
+    int fd() const { return linkFd; }
+    // True once the controller has answered the connect request
+    bool ready() const { return connected; }
+
+    // Handle every reply that has arrived, for the input callback
+    void receive();
+
+    bool request(const char *cmd, const char *target, const char *value);
+    // Match one reply to the oldest outstanding request
+    void response(const char *line);
+    // Expire unanswered requests, retry the connect request and flush queued output
+    void poll();
+    // Queue a GET for each switch not already being read
+    void requestStatus();
+    // The cached switch state, false if there is no recent reply for it
+    bool switchState(int sw, bool *on) const;
+    // Errors since the last call
+    int takeErrors();
+    // Times the controller has answered again after the link dropped
+    int reconnects() const { return reconnectCount; }
+    bool up() const { return linkState == LINK_UP; }
+
+  private:
+    // Raw framed I/O for the text protocol, each call handles one complete "(...)" frame
+    bool writeLine(const char *line);
+    bool readLine(char *line, size_t size);
+
+    struct Pending
+    {
+        char target[16];
+        int seq;                    // -1 for the text protocol
+        struct timespec sent;
+    };
+
+    enum { LINK_DOWN, LINK_CONNECTING, LINK_UP };
+
+    bool writeBytes(const char *data, size_t len);
+    bool fill();
+    void flush();
+    bool requestFrame(const char *cmd, const char *target, const char *value);
+    bool queued(const char *target) const;
+    bool takePending(const char *target, int seq);
+    void frameResponse(const BinaryFrame &frame);
+    void answered(const char *version);
+    void resync();
+    bool reopen();
+    void drop(const char *why);
+
+    std::unique_ptr<LinkTransport> io;
+    Report report;
+    Protocol protocol;
+    uint8_t nextSeq = 0;
+    FdChange fdChange;
+    int linkFd = -1;
+    int linkState = LINK_DOWN;
+    bool connected = false;
+    int errors = 0;
+    int timeouts = 0;               // Consecutive abandoned pipelines
+    int reconnectCount = 0;
+    int backoffMs = 0;
+    bool lost = false;              // Dropped and not yet answering again
+    struct timespec attempt {};
+
+    Pending pending[MAX_PENDING] {};
+    int pendingHead = 0;
+    int pendingCount = 0;
+
+    char in[LINE_SIZE];
+    size_t inLen = 0;
+    char out[LINE_SIZE * MAX_PENDING];
+    size_t outLen = 0;
+
+    bool state[SW_COUNT] {};
+    struct timespec stateTime[SW_COUNT] {};
+};
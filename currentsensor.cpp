@@ -0,0 +1,242 @@
+/*
+ Roof motor current from an SPI ADC
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "currentsensor.h"
+
+#include <pigpiod_if2.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define OVERCURRENT_SAMPLES 3           // Consecutive samples over the limit, rejects single spikes
+
+bool PigpiodSpiBus::open(unsigned channel, unsigned baud)
+{
+    close();
+    handle = spi_open(pi_id, channel, baud, 0);
+    return handle >= 0;
+}
+
+void PigpiodSpiBus::close()
+{
+    if (handle >= 0)
+        spi_close(pi_id, handle);
+    handle = -1;
+}
+
+bool PigpiodSpiBus::transfer(uint8_t *tx, uint8_t *rx, unsigned count)
+{
+    if (handle < 0)
+        return false;
+    return spi_xfer(pi_id, handle, reinterpret_cast<char *>(tx), reinterpret_cast<char *>(rx), count) == (int)count;
+}
+
+bool LinuxSpiBus::open(unsigned channel, unsigned baud)
+{
+    char device[32];
+
+    close();
+    snprintf(device, sizeof(device), "/dev/spidev0.%u", channel);
+    fd = ::open(device, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    speed = baud;
+    return true;
+}
+
+void LinuxSpiBus::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+bool LinuxSpiBus::transfer(uint8_t *tx, uint8_t *rx, unsigned count)
+{
+    struct spi_ioc_transfer xfer;
+
+    if (fd < 0)
+        return false;
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)tx;
+    xfer.rx_buf = (unsigned long)rx;
+    xfer.len = count;
+    xfer.speed_hz = speed;
+    xfer.bits_per_word = 8;
+    return ioctl(fd, SPI_IOC_MESSAGE(1), &xfer) == (int)count;
+}
+
+CurrentSensor::CurrentSensor(std::unique_ptr<SpiBus> bus) : spi(std::move(bus))
+{
+    tripFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+CurrentSensor::~CurrentSensor()
+{
+    stop();
+    if (tripFd >= 0)
+        close(tripFd);
+}
+
+bool CurrentSensor::start(const Options &options)
+{
+    stop();
+    opts = options;
+    if (tripFd < 0 || opts.rateHz <= 0 || !spi->open(opts.spiChannel, opts.baud))
+        return false;
+    wakeLatency.reset();
+    stopping.store(false);
+    thread = std::thread(&CurrentSensor::run, this);
+    return true;
+}
+
+void CurrentSensor::stop()
+{
+    if (!thread.joinable())
+        return;
+    stopping.store(true);
+    thread.join();
+    spi->close();
+}
+
+void CurrentSensor::arm(bool armed)
+{
+    // Sequentially consistent with the sampler: either it sees the flag down, or this sees it in a sample
+    armedFlag.store(false);
+    while (inSample.load())
+        std::this_thread::yield();
+    if (armed)
+    {
+        tripReason.store(TRIP_NONE, std::memory_order_relaxed);
+        peakAmps.store(0, std::memory_order_relaxed);
+        sumAmps.store(0, std::memory_order_relaxed);
+        armedSamples.store(0, std::memory_order_relaxed);
+        armings.fetch_add(1, std::memory_order_relaxed);
+        armedFlag.store(true);
+    }
+}
+
+double CurrentSensor::mean() const
+{
+    uint32_t n = armedSamples.load(std::memory_order_relaxed);
+    return n ? sumAmps.load(std::memory_order_relaxed) / n : 0;
+}
+
+bool CurrentSensor::writeTrace(const char *path) const
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr)
+        return false;
+    uint32_t next = traceNext.load(std::memory_order_acquire);
+    uint32_t count = next < TRACE_SIZE ? next : TRACE_SIZE;
+    fprintf(fp, "seconds,amps\n");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t at = next - count + i;
+        fprintf(fp, "%.4f,%.3f\n", (double)(int32_t)(at - next) / opts.rateHz,
+                trace[at % TRACE_SIZE].load(std::memory_order_relaxed));
+    }
+    return fclose(fp) == 0;
+}
+
+void CurrentSensor::sample(double amps)
+{
+    uint32_t next = traceNext.load(std::memory_order_relaxed);
+    trace[next % TRACE_SIZE].store(amps, std::memory_order_relaxed);
+    traceNext.store(next + 1, std::memory_order_release);
+    lastAmps.store(amps, std::memory_order_relaxed);
+
+    inSample.store(true);
+    if (!armedFlag.load() || tripReason.load(std::memory_order_relaxed) != TRIP_NONE)
+    {
+        inSample.store(false);
+        return;
+    }
+    // A new arming starts the sample runs again, it may have come without a disarmed sample in between
+    uint32_t arming = armings.load(std::memory_order_relaxed);
+    if (arming != countedArming)
+    {
+        countedArming = arming;
+        overCount = 0;
+        stallCount = 0;
+    }
+
+    uint32_t n = armedSamples.fetch_add(1, std::memory_order_relaxed) + 1;
+    sumAmps.store(sumAmps.load(std::memory_order_relaxed) + amps, std::memory_order_relaxed);
+    if (amps > peakAmps.load(std::memory_order_relaxed))
+        peakAmps.store(amps, std::memory_order_relaxed);
+
+    int trip = TRIP_NONE;
+    overCount = (amps > opts.overcurrentAmps) ? overCount + 1 : 0;
+    if (overCount >= OVERCURRENT_SAMPLES)
+        trip = TRIP_OVERCURRENT;
+
+    // Starting current is expected to be high, only look for a stall after the inrush period
+    if (n > opts.inrushMs * opts.rateHz / 1000)
+    {
+        stallCount = (amps > opts.stallAmps) ? stallCount + 1 : 0;
+        if (stallCount >= opts.stallMs * opts.rateHz / 1000)
+            trip = TRIP_STALL;
+    }
+
+    if (trip != TRIP_NONE)
+    {
+        uint64_t one = 1;
+        tripReason.store(trip, std::memory_order_release);
+        // Only fails if the counter would overflow, the driver is then already due to wake
+        ssize_t rc = write(tripFd, &one, sizeof(one));
+        (void)rc;
+    }
+    inSample.store(false, std::memory_order_release);
+}
+
+void CurrentSensor::run()
+{
+    uint8_t tx[3];
+    uint8_t rx[3];
+    long periodNs = (long)(1e9 / opts.rateHz);
+    struct timespec next, woke;
+
+    // MCP3008 single ended conversion: start bit, then channel in the high nibble of the second byte
+    tx[0] = 0x01;
+    tx[1] = (0x08 | (opts.adcChannel & 0x07)) << 4;
+    tx[2] = 0;
+
+    applyRealtime(opts.realtime);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        if (spi->transfer(tx, rx, 3))
+        {
+            int counts = ((rx[1] & 0x03) << 8) | rx[2];
+            sample(std::fabs((counts - opts.zeroCounts) * opts.ampsPerCount));
+        }
+
+        addNanoseconds(&next, periodNs);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        wakeLatency.add(elapsedMicros(next, woke));
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ Roof motor current from an SPI ADC
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "realtime.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/*
+ * Full duplex transfer on one SPI device. Implemented over pigpiod and Linux spidev.
+ */
+class SpiBus
+{
+  public:
+    virtual ~SpiBus() = default;
+    virtual bool open(unsigned channel, unsigned baud) = 0;
+    virtual void close() = 0;
+    virtual bool transfer(uint8_t *tx, uint8_t *rx, unsigned count) = 0;
+};
+
+class PigpiodSpiBus : public SpiBus
+{
+  public:
+    explicit PigpiodSpiBus(int pi) : pi_id(pi) {}
+    ~PigpiodSpiBus() override { close(); }
+    bool open(unsigned channel, unsigned baud) override;
+    void close() override;
+    bool transfer(uint8_t *tx, uint8_t *rx, unsigned count) override;
+
+  private:
+    int pi_id;
+    int handle = -1;
+};
+
+class LinuxSpiBus : public SpiBus
+{
+  public:
+    ~LinuxSpiBus() override { close(); }
+    bool open(unsigned channel, unsigned baud) override;
+    void close() override;
+    bool transfer(uint8_t *tx, uint8_t *rx, unsigned count) override;
+
+  private:
+    int fd = -1;
+    unsigned speed = 0;
+};
+
+/*
+ * Samples motor current from one channel of an MCP3008 on a background thread. While armed it looks for an
+ * overcurrent (a short run of samples above the limit) or a stall (current held above the stall level after
+ * the inrush period). A trip is signalled by writing to an eventfd the driver watches in its event loop, so
+ * the roof can be stopped within a few samples. The last TRACE_SIZE samples are kept for diagnostics.
+ */
+class CurrentSensor
+{
+  public:
+    struct Options
+    {
+        unsigned spiChannel { 0 };
+        unsigned adcChannel { 0 };
+        unsigned baud { 1000000 };
+        double rateHz { 500 };
+        double ampsPerCount { 0.0264 };         // ACS712-20A on 3.3V
+        double zeroCounts { 512 };
+        double overcurrentAmps { 15 };
+        double stallAmps { 8 };
+        double stallMs { 300 };
+        double inrushMs { 500 };
+        RealtimeOptions realtime;
+    };
+
+    enum { TRIP_NONE, TRIP_OVERCURRENT, TRIP_STALL };
+    static constexpr int TRACE_SIZE = 2048;
+
+    explicit CurrentSensor(std::unique_ptr<SpiBus> bus);
+    ~CurrentSensor();
+
+    bool start(const Options &options);
+    void stop();
+    bool running() const { return thread.joinable(); }
+    int eventFd() const { return tripFd; }
+
+    // Arm when the motor starts, disarm when it stops. Statistics cover the armed period and are stable once
+    // arm(false) returns.
+    void arm(bool armed);
+    int trip() const { return tripReason.load(std::memory_order_acquire); }
+    double current() const { return lastAmps.load(std::memory_order_relaxed); }
+    double peak() const { return peakAmps.load(std::memory_order_relaxed); }
+    double mean() const;
+
+    // Write the trace, oldest first, as time and amps. Samples taken while it is written may be included.
+    bool writeTrace(const char *path) const;
+
+    // Lateness of each sampling wakeup against its deadline
+    JitterStats wakeLatency;
+
+  private:
+    void run();
+    void sample(double amps);
+
+    std::unique_ptr<SpiBus> spi;
+    Options opts;
+    std::thread thread;
+    std::atomic<bool> stopping { false };
+    int tripFd = -1;
+
+    // The sampler holds inSample while it may update the statistics, arm() waits it out before resetting them
+    std::atomic<bool> armedFlag { false };
+    std::atomic<bool> inSample { false };
+    std::atomic<uint32_t> armings { 0 };
+    uint32_t countedArming = 0;                 // Sampler side, the arming overCount and stallCount belong to
+    std::atomic<int> tripReason { TRIP_NONE };
+    std::atomic<double> lastAmps { 0 };
+    std::atomic<double> peakAmps { 0 };
+    std::atomic<double> sumAmps { 0 };
+    std::atomic<uint32_t> armedSamples { 0 };
+    int overCount = 0;
+    int stallCount = 0;
+
+    std::atomic<float> trace[TRACE_SIZE] {};
+    std::atomic<uint32_t> traceNext { 0 };
+};
@@ -0,0 +1,114 @@
+/*
+ Dead-man release for held relays
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "deadman.h"
+
+#include <pigpiod_if2.h>
+
+#include <algorithm>
+
+#define DEADMAN_TICK_MS 100         // Deadline counting interval of the release script
+
+/*
+ * Release script parameters: p0 ticks left before the deadline, p1 tick ms, p2 bank 1 bits to clear, p3 bank 1
+ * bits to set. renew() rewrites p0 while the script runs.
+ */
+static const char *releaseScript = "tag 1 mils p1 dcr p0 lda p0 jp 1 bc1 p2 bs1 p3";
+
+DeadmanRelays::~DeadmanRelays()
+{
+    if (scriptId < 0)
+        return;
+    stop_script(pi_id, scriptId);
+    delete_script(pi_id, scriptId);
+    if (clearMask)
+        clear_bank_1(pi_id, clearMask);
+    if (setMask)
+        set_bank_1(pi_id, setMask);
+}
+
+uint32_t DeadmanRelays::ticks() const
+{
+    return std::max(1, deadline / DEADMAN_TICK_MS);
+}
+
+// Restart the script with the current pins and a full deadline
+bool DeadmanRelays::run()
+{
+    TraceSpan span(trace, "run_script", "dead-man");
+    if (scriptId < 0)
+        scriptId = store_script(pi_id, const_cast<char *>(releaseScript));
+    if (scriptId < 0)
+        return false;
+    stop_script(pi_id, scriptId);
+    if (!holding())
+        return true;
+    uint32_t params[4];
+    params[0] = ticks();
+    params[1] = DEADMAN_TICK_MS;
+    params[2] = clearMask;
+    params[3] = setMask;
+    return run_script(pi_id, scriptId, 4, params) == 0;
+}
+
+bool DeadmanRelays::hold(unsigned gpio, bool activeHigh)
+{
+    if (gpio > 31)
+        return false;
+    clearMask &= ~(1u << gpio);
+    setMask &= ~(1u << gpio);
+    if (activeHigh)
+        clearMask |= 1u << gpio;
+    else
+        setMask |= 1u << gpio;
+    return run();
+}
+
+bool DeadmanRelays::release(unsigned gpio)
+{
+    if (gpio > 31 || !((clearMask | setMask) & (1u << gpio)))
+        return true;
+    clearMask &= ~(1u << gpio);
+    setMask &= ~(1u << gpio);
+    return run();
+}
+
+/*
+ * The script only ends by releasing the pins, so a held pin found at its released level in the driver's own bank
+ * read means the deadline passed. That leaves one update_script per renewal, it succeeds whether or not the
+ * script is still running and only fails if pigpiod no longer has the script, which is then stored again.
+ */
+bool DeadmanRelays::renew(uint32_t bank)
+{
+    if (!holding())
+        return true;
+    if (scriptId < 0 || (bank & clearMask) != clearMask || (bank & setMask) != 0)
+    {
+        clearMask = 0;
+        setMask = 0;
+        return false;
+    }
+    uint32_t param = ticks();
+    {
+        TraceSpan span(trace, "update_script", "dead-man");
+        if (update_script(pi_id, scriptId, 1, &param) == 0)
+            return true;
+    }
+    scriptId = -1;
+    return run();
+}
@@ -0,0 +1,54 @@
+/*
+ Dead-man release for held relays
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "tracerecorder.h"
+
+#include <cstdint>
+
+/*
+ * Releases relays held on with No Limit when the driver stops renewing them. A script in pigpiod counts down
+ * the deadline and then clears or sets the held pins in one bank write, so the relays drop out even when the
+ * driver has crashed or hung. The driver writes the pins itself and only tells this class which are held.
+ */
+class DeadmanRelays
+{
+  public:
+    DeadmanRelays(int pi, int deadlineMs, TraceRecorder &recorder) : pi_id(pi), deadline(deadlineMs), trace(recorder) {}
+    // Releases the held pins, the driver is no longer supervising them
+    ~DeadmanRelays();
+
+    bool hold(unsigned gpio, bool activeHigh);
+    bool release(unsigned gpio);
+    // Push the deadline out again. bank is a recent read_bank_1, returns false if it shows the deadline had
+    // passed and the pins were released.
+    bool renew(uint32_t bank);
+    bool holding() const { return (clearMask | setMask) != 0; }
+
+  private:
+    bool run();
+    uint32_t ticks() const;
+
+    int pi_id;
+    int deadline;
+    TraceRecorder &trace;
+    int scriptId = -1;
+    uint32_t clearMask = 0;         // Held active high, released by clearing
+    uint32_t setMask = 0;           // Held active low, released by setting
+};
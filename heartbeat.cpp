@@ -0,0 +1,107 @@
+/*
+ Heartbeat output for an external watchdog
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "heartbeat.h"
+
+#include <pigpiod_if2.h>
+
+#include <algorithm>
+
+#define HARDWARE_TICK_MS    100         // Deadline counting interval while hardware PWM runs the heartbeat
+#define MIN_HALF_PERIOD_MS  2           // Fastest the script can toggle and still keep time
+
+/*
+ * Heartbeat script parameters: p0 gpio, p1 tick ms, p2 ticks left before the deadline, p3 idle level,
+ * p4 hardware PWM frequency. renew() rewrites p2 while the script runs.
+ */
+static const char *hardwareBeat =
+    "hp p0 p4 500000 tag 1 mils p1 dcr p2 lda p2 jp 1 hp p0 0 0 w p0 p3";
+static const char *toggleBeat =
+    "tag 1 w p0 1 mils p1 w p0 0 mils p1 dcr p2 lda p2 jp 1 w p0 p3";
+
+Heartbeat::~Heartbeat()
+{
+    if (scriptId < 0)
+        return;
+    stop_script(pi_id, scriptId);
+    delete_script(pi_id, scriptId);
+    if (hardwarePwm)
+        hardware_PWM(pi_id, opts.gpio, 0, 0);
+    gpio_write(pi_id, opts.gpio, opts.idleHigh ? 1 : 0);
+}
+
+bool Heartbeat::start(const Options &options)
+{
+    opts = options;
+    hardwarePwm = (opts.gpio == 12 || opts.gpio == 13 || opts.gpio == 18 || opts.gpio == 19);
+    TraceSpan span(trace, "store_script", "heartbeat");
+    if (set_mode(pi_id, opts.gpio, PI_OUTPUT) != 0)
+        return false;
+    if (scriptId >= 0)
+    {
+        stop_script(pi_id, scriptId);
+        delete_script(pi_id, scriptId);
+    }
+    scriptId = store_script(pi_id, const_cast<char *>(hardwarePwm ? hardwareBeat : toggleBeat));
+    if (scriptId < 0)
+        return false;
+    return run();
+}
+
+// The script's sleep, half the period when it toggles the pin
+uint32_t Heartbeat::sleepMs() const
+{
+    return hardwarePwm ? HARDWARE_TICK_MS : std::max(MIN_HALF_PERIOD_MS, (int)(500 / opts.freqHz));
+}
+
+// Ticks until the deadline. A toggling script counts one per full period.
+uint32_t Heartbeat::ticks() const
+{
+    return std::max(1, opts.deadlineMs / (int)(hardwarePwm ? sleepMs() : 2 * sleepMs()));
+}
+
+bool Heartbeat::run()
+{
+    uint32_t params[5];
+    params[0] = opts.gpio;
+    params[1] = sleepMs();
+    params[2] = ticks();
+    params[3] = opts.idleHigh ? 1 : 0;
+    params[4] = opts.freqHz;
+    TraceSpan span(trace, "run_script", "heartbeat");
+    return run_script(pi_id, scriptId, 5, params) == 0;
+}
+
+bool Heartbeat::renew()
+{
+    uint32_t status[PI_MAX_SCRIPT_PARAMS];
+
+    if (scriptId < 0)
+        return false;
+    TraceSpan span(trace, "update_script", "heartbeat");
+    if (script_status(pi_id, scriptId, status) != PI_SCRIPT_RUNNING)
+    {
+        run();
+        return false;
+    }
+    uint32_t params[3];
+    params[0] = opts.gpio;
+    params[1] = sleepMs();
+    params[2] = ticks();
+    return update_script(pi_id, scriptId, 3, params) == 0;
+}
@@ -0,0 +1,61 @@
+/*
+ Heartbeat output for an external watchdog
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "tracerecorder.h"
+
+#include <cstdint>
+
+/*
+ * A heartbeat for an external watchdog, generated inside pigpiod so each toggle costs the driver nothing.
+ * On GPIO 12, 13, 18 and 19 it is a hardware PWM square wave, on other pins a script toggles the pin. In
+ * both cases the script counts down a deadline that the driver renews from its supervision loop. When the
+ * renewals stop, because the driver or its event loop has hung, the script stops the heartbeat and leaves
+ * the pin at its idle level.
+ */
+class Heartbeat
+{
+  public:
+    struct Options
+    {
+        unsigned gpio { 0 };
+        bool idleHigh { false };        // Level left on the pin when the heartbeat stops
+        double freqHz { 10 };
+        int deadlineMs { 10000 };
+    };
+
+    Heartbeat(int pi, TraceRecorder &recorder) : pi_id(pi), trace(recorder) {}
+    ~Heartbeat();
+
+    bool start(const Options &options);
+    // Push the deadline out again. Returns false when the heartbeat had already lapsed, it is then restarted.
+    bool renew();
+    bool hardware() const { return hardwarePwm; }
+
+  private:
+    uint32_t sleepMs() const;
+    uint32_t ticks() const;
+    bool run();
+
+    int pi_id;
+    TraceRecorder &trace;
+    Options opts;
+    bool hardwarePwm = false;
+    int scriptId = -1;
+};
@@ -0,0 +1,208 @@
+/*
+ Relay pulse width benchmark through a loopback input
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "loopbackbench.h"
+
+#include <pigpiod_if2.h>
+
+#include <cstdio>
+
+#define SETTLE_MS   20          // Gap between pulses, and the time allowed for the falling edge to be reported
+
+static void sleepMs(int ms)
+{
+    struct timespec req = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&req, nullptr);
+}
+
+LoopbackBenchmark::~LoopbackBenchmark()
+{
+    cancel();
+}
+
+bool LoopbackBenchmark::start(const Options &options)
+{
+    cancel();
+    opts = options;
+    if (opts.loadThreads > 16)
+        opts.loadThreads = 16;
+    for (int m = 0; m < MECH_COUNT; m++)
+    {
+        error[m].reset();
+        missed[m].store(0);
+        unavailable[m].store(false);
+    }
+    outMode = get_mode(pi_id, opts.outGpio);
+    inMode = get_mode(pi_id, opts.inGpio);
+    if (outMode < 0 || inMode < 0)
+        return false;
+    if (set_mode(pi_id, opts.outGpio, PI_OUTPUT) != 0 || set_mode(pi_id, opts.inGpio, PI_INPUT) != 0)
+    {
+        restoreModes();
+        return false;
+    }
+    gpio_write(pi_id, opts.outGpio, 0);
+    stopping.store(false);
+    done.store(false);
+    thread = std::thread(&LoopbackBenchmark::run, this);
+    return true;
+}
+
+void LoopbackBenchmark::cancel()
+{
+    if (!thread.joinable())
+        return;
+    stopping.store(true);
+    thread.join();
+}
+
+void LoopbackBenchmark::restoreModes()
+{
+    set_mode(pi_id, opts.outGpio, outMode);
+    set_mode(pi_id, opts.inGpio, inMode);
+}
+
+void LoopbackBenchmark::edgeHelper(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata)
+{
+    LoopbackBenchmark *bench = static_cast<LoopbackBenchmark *>(userdata);
+    if (level == 1)
+        bench->riseTick.store(tick, std::memory_order_relaxed);
+    else if (level == 0)
+    {
+        // Ticks are microseconds and wrap every 72 minutes, unsigned subtraction handles the wrap
+        bench->widthTicks.store(tick - bench->riseTick.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bench->gotWidth.store(true, std::memory_order_release);
+    }
+}
+
+void LoopbackBenchmark::load()
+{
+    volatile uint64_t spin = 0;
+    while (loading.load(std::memory_order_relaxed))
+        spin = spin * 6364136223846793005ULL + 1;
+}
+
+void LoopbackBenchmark::run()
+{
+    char text[64];
+    int waveId = -1;
+    int scriptId = -1;
+
+    int callbackId = callback_ex(pi_id, opts.inGpio, EITHER_EDGE, edgeHelper, this);
+
+    // The daemon side mechanisms are prepared once, a failure only skips that mechanism
+    gpioPulse_t pulses[2] = { { 1u << opts.outGpio, 0, (uint32_t)opts.pulseMs * 1000 }, { 0, 1u << opts.outGpio, 0 } };
+    if (wave_add_generic(pi_id, 2, pulses) >= 0)
+        waveId = wave_create(pi_id);
+    snprintf(text, sizeof(text), "w %u 1 mils %d w %u 0", opts.outGpio, opts.pulseMs, opts.outGpio);
+    scriptId = store_script(pi_id, text);
+    if (scriptId >= 0)
+    {
+        for (int i = 0; i < 100 && script_status(pi_id, scriptId, nullptr) == PI_SCRIPT_INITING; i++)
+            sleepMs(1);
+    }
+    unavailable[MECH_WAVE].store(waveId < 0);
+    unavailable[MECH_SCRIPT].store(scriptId < 0);
+
+    loading.store(true);
+    for (int i = 0; i < opts.loadThreads; i++)
+        loaders[i] = std::thread(&LoopbackBenchmark::load, this);
+
+    for (int m = 0; m < MECH_COUNT && !stopping.load(); m++)
+    {
+        if (callbackId < 0 || unavailable[m].load())
+            continue;
+        applyRealtime(m == MECH_TIMER ? opts.realtime : RealtimeOptions());
+        for (int i = 0; i < opts.count && !stopping.load(); i++)
+        {
+            int64_t micros = 0;
+            gotWidth.store(false);
+            if (pulse(m, waveId, scriptId) && measure(&micros))
+                error[m].add(micros - opts.pulseMs * 1000);
+            else
+                missed[m].fetch_add(1);
+            sleepMs(SETTLE_MS);
+        }
+    }
+    applyRealtime(RealtimeOptions());
+
+    loading.store(false);
+    for (int i = 0; i < opts.loadThreads; i++)
+        loaders[i].join();
+    if (waveId >= 0)
+        wave_delete(pi_id, waveId);
+    if (scriptId >= 0)
+        delete_script(pi_id, scriptId);
+    if (callbackId >= 0)
+        callback_cancel(callbackId);
+    gpio_write(pi_id, opts.outGpio, 0);
+    restoreModes();
+    done.store(true, std::memory_order_release);
+}
+
+bool LoopbackBenchmark::pulse(int mechanism, int waveId, int scriptId)
+{
+    struct timespec deadline;
+
+    switch (mechanism)
+    {
+        case MECH_SLEEP:
+            if (gpio_write(pi_id, opts.outGpio, 1) != 0)
+                return false;
+            sleepMs(opts.pulseMs);
+            return gpio_write(pi_id, opts.outGpio, 0) == 0;
+
+        case MECH_TIMER:
+            if (gpio_write(pi_id, opts.outGpio, 1) != 0)
+                return false;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            addNanoseconds(&deadline, opts.pulseMs * 1000000L);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+            return gpio_write(pi_id, opts.outGpio, 0) == 0;
+
+        case MECH_WAVE:
+            if (wave_send_once(pi_id, waveId) < 0)
+                return false;
+            while (wave_tx_busy(pi_id) == 1)
+                sleepMs(1);
+            return true;
+
+        case MECH_SCRIPT:
+            if (run_script(pi_id, scriptId, 0, nullptr) != 0)
+                return false;
+            while (script_status(pi_id, scriptId, nullptr) == PI_SCRIPT_RUNNING)
+                sleepMs(1);
+            return true;
+    }
+    return false;
+}
+
+// Wait for the falling edge to be reported and return the pulse width the input saw
+bool LoopbackBenchmark::measure(int64_t *micros)
+{
+    for (int i = 0; i < SETTLE_MS; i++)
+    {
+        if (gotWidth.load(std::memory_order_acquire))
+        {
+            *micros = widthTicks.load(std::memory_order_relaxed);
+            return true;
+        }
+        sleepMs(1);
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+/*
+ Relay pulse width benchmark through a loopback input
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "realtime.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/*
+ * Drives pulses on an output GPIO that is jumpered to an input GPIO and measures each pulse as the input sees
+ * it, from the edge ticks pigpiod reports to a callback_ex callback. Each output mechanism is run in turn:
+ *   SLEEP   write, relative nanosleep, write. The way pulses were timed inline.
+ *   TIMER   write, absolute CLOCK_MONOTONIC deadline, write, with the real-time settings applied.
+ *   WAVE    a two pulse pigpiod waveform, timed by the daemon DMA.
+ *   SCRIPT  a pigpiod script "w g 1 mils ms w g 0", timed by the daemon.
+ * Optional load threads spin on every CPU while it runs. Runs on its own thread, the results are read once
+ * finished() is true. Both pins are returned to the modes they had before the run.
+ */
+class LoopbackBenchmark
+{
+  public:
+    enum { MECH_SLEEP, MECH_TIMER, MECH_WAVE, MECH_SCRIPT, MECH_COUNT };
+
+    struct Options
+    {
+        unsigned outGpio { 0 };
+        unsigned inGpio { 0 };
+        int pulseMs { 20 };
+        int count { 100 };
+        int loadThreads { 0 };
+        RealtimeOptions realtime;
+    };
+
+    explicit LoopbackBenchmark(int pi) : pi_id(pi) {}
+    ~LoopbackBenchmark();
+
+    bool start(const Options &options);
+    void cancel();
+    bool finished() const { return done.load(std::memory_order_acquire); }
+
+    // Absolute error of each measured pulse against the requested width, and pulses the input never saw
+    JitterStats error[MECH_COUNT];
+    std::atomic<uint32_t> missed[MECH_COUNT] {};
+    std::atomic<bool> unavailable[MECH_COUNT] {};   // The daemon refused to set the mechanism up
+
+  private:
+    void run();
+    void load();
+    void restoreModes();
+    bool pulse(int mechanism, int waveId, int scriptId);
+    bool measure(int64_t *micros);
+    static void edgeHelper(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata);
+
+    int pi_id;
+    Options opts;
+    std::thread thread;
+    std::thread loaders[16];
+    int outMode = -1;
+    int inMode = -1;
+    std::atomic<bool> stopping { false };
+    std::atomic<bool> loading { false };
+    std::atomic<bool> done { false };
+
+    std::atomic<uint32_t> riseTick { 0 };
+    std::atomic<uint32_t> widthTicks { 0 };
+    std::atomic<bool> gotWidth { false };
+};
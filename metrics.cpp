@@ -0,0 +1,104 @@
+/*
+ Prometheus metrics for the roof driver
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "metrics.h"
+
+#include <cstring>
+#include <string>
+
+// Upper bounds in microseconds, from a quick pigpiod request to a slow TimerHit
+static const int64_t bucketBounds[MetricHistogram::BUCKETS] =
+{
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+
+struct CounterInfo
+{
+    const char *name;
+    const char *labels;
+    const char *help;
+};
+
+// In Counter order, entries sharing a name differ only in their labels
+static const CounterInfo counterInfo[DriverMetrics::COUNTERS] =
+{
+    { "rolloffrpi_moves_total", "direction=\"open\"", "Roof movements started" },
+    { "rolloffrpi_moves_total", "direction=\"close\"", "Roof movements started" },
+    { "rolloffrpi_move_failures_total", "", "Roof movements the controller could not be made to start" },
+    { "rolloffrpi_move_timeouts_total", "", "Roof movements that did not reach a limit switch in time" },
+    { "rolloffrpi_aborts_total", "", "Abort requests made while the roof was moving" },
+    { "rolloffrpi_current_trips_total", "", "Movements stopped for motor overcurrent or stall" },
+    { "rolloffrpi_edge_events_total", "", "GPIO input edges reported by pigpiod" },
+    { "rolloffrpi_link_errors_total", "", "Controller link protocol errors and timeouts" },
+    { "rolloffrpi_suppressed_updates_total", "kind=\"status\"", "Status updates and repeated warnings that were not sent" },
+    { "rolloffrpi_suppressed_updates_total", "kind=\"log\"", "Status updates and repeated warnings that were not sent" },
+    { "rolloffrpi_queued_requests_total", "", "Requests held until the roof had stopped" },
+    { "rolloffrpi_merged_requests_total", "", "Requests merged with one already running or waiting" },
+};
+
+void MetricHistogram::observe(int64_t micros)
+{
+    int i = 0;
+    while (i < BUCKETS && micros > bucketBounds[i])
+        i++;
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+    sumMicros.fetch_add(micros > 0 ? micros : 0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::write(FILE *fp, const char *name, const char *help, const char *device) const
+{
+    uint64_t cumulative = 0;
+
+    fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        cumulative += counts[i].load(std::memory_order_relaxed);
+        fprintf(fp, "%s_bucket{device=\"%s\",le=\"%g\"} %llu\n", name, device, bucketBounds[i] / 1e6,
+                (unsigned long long)cumulative);
+    }
+    cumulative += counts[BUCKETS].load(std::memory_order_relaxed);
+    fprintf(fp, "%s_bucket{device=\"%s\",le=\"+Inf\"} %llu\n", name, device, (unsigned long long)cumulative);
+    fprintf(fp, "%s_sum{device=\"%s\"} %.6f\n", name, device, sumMicros.load(std::memory_order_relaxed) / 1e6);
+    fprintf(fp, "%s_count{device=\"%s\"} %llu\n", name, device, (unsigned long long)cumulative);
+}
+
+bool DriverMetrics::writeTextfile(const char *path, const char *device) const
+{
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *fp = fopen(temporary.c_str(), "w");
+    if (fp == nullptr)
+        return false;
+
+    for (int i = 0; i < COUNTERS; i++)
+    {
+        const CounterInfo &info = counterInfo[i];
+        if (i == 0 || strcmp(info.name, counterInfo[i - 1].name) != 0)
+            fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", info.name, info.help, info.name);
+        fprintf(fp, "%s{device=\"%s\"%s%s} %llu\n", info.name, device, info.labels[0] ? "," : "", info.labels,
+                (unsigned long long)counters[i].load(std::memory_order_relaxed));
+    }
+    pigpiodCall.write(fp, "rolloffrpi_pigpiod_call_seconds", "Time taken by pigpiod requests", device);
+    tick.write(fp, "rolloffrpi_tick_seconds", "Time taken by each pass of the driver timer", device);
+
+    if (fclose(fp) != 0 || rename(temporary.c_str(), path) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
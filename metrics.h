@@ -0,0 +1,68 @@
+/*
+ Prometheus metrics for the roof driver
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * Cumulative histogram of durations with fixed bounds. Adding is a few relaxed atomic increments, so timing
+ * threads and pigpiod callbacks can add without a lock. A reader may see the count and sum from slightly
+ * different moments, which Prometheus tolerates.
+ */
+class MetricHistogram
+{
+  public:
+    static constexpr int BUCKETS = 12;
+
+    void observe(int64_t micros);
+    void write(FILE *fp, const char *name, const char *help, const char *device) const;
+
+  private:
+    std::atomic<uint64_t> counts[BUCKETS + 1] {};   // The last is +Inf
+    std::atomic<uint64_t> sumMicros { 0 };
+};
+
+/*
+ * Counters and histograms for roof operations and GPIO performance, written as a node_exporter textfile.
+ * All adds are relaxed atomics, only writeTextfile() reads them.
+ */
+class DriverMetrics
+{
+  public:
+    enum Counter
+    {
+        MOVES_OPEN, MOVES_CLOSE, MOVE_FAILURES, MOVE_TIMEOUTS, ABORTS, CURRENT_TRIPS, EDGE_EVENTS, LINK_ERRORS,
+        SUPPRESSED_STATUS, SUPPRESSED_LOG, QUEUED_REQUESTS, MERGED_REQUESTS, COUNTERS
+    };
+
+    void add(Counter counter, uint64_t n = 1) { counters[counter].fetch_add(n, std::memory_order_relaxed); }
+    // A pigpiod request, or one TimerHit pass
+    void observeCall(int64_t micros) { pigpiodCall.observe(micros); }
+    void observeTick(int64_t micros) { tick.observe(micros); }
+
+    // Written beside the path and renamed over it, the collector never reads a partial file
+    bool writeTextfile(const char *path, const char *device) const;
+
+  private:
+    std::atomic<uint64_t> counters[COUNTERS] {};
+    MetricHistogram pigpiodCall;
+    MetricHistogram tick;
+};
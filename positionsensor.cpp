@@ -0,0 +1,169 @@
+/*
+ Roof position from an I2C distance sensor
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "positionsensor.h"
+
+#include <pigpiod_if2.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+bool PigpiodI2cBus::open(unsigned bus, unsigned address)
+{
+    close();
+    handle = i2c_open(pi_id, bus, address, 0);
+    return handle >= 0;
+}
+
+void PigpiodI2cBus::close()
+{
+    if (handle >= 0)
+        i2c_close(pi_id, handle);
+    handle = -1;
+}
+
+int PigpiodI2cBus::readRegister(uint8_t reg, uint8_t *buf, unsigned count)
+{
+    if (handle < 0)
+        return -1;
+    return i2c_read_i2c_block_data(pi_id, handle, reg, reinterpret_cast<char *>(buf), count);
+}
+
+bool LinuxI2cBus::open(unsigned bus, unsigned address)
+{
+    char device[32];
+
+    close();
+    snprintf(device, sizeof(device), "/dev/i2c-%u", bus);
+    fd = ::open(device, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (ioctl(fd, I2C_SLAVE, address) < 0)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void LinuxI2cBus::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+int LinuxI2cBus::readRegister(uint8_t reg, uint8_t *buf, unsigned count)
+{
+    if (fd < 0 || write(fd, &reg, 1) != 1)
+        return -1;
+    return read(fd, buf, count);
+}
+
+PositionSensor::PositionSensor(std::unique_ptr<I2cBus> bus) : i2c(std::move(bus))
+{
+}
+
+PositionSensor::~PositionSensor()
+{
+    stop();
+}
+
+bool PositionSensor::start(const Options &options)
+{
+    stop();
+    opts = options;
+    if (opts.rateHz <= 0 || !i2c->open(opts.bus, opts.address))
+        return false;
+    windowCount = 0;
+    windowNext = 0;
+    sampleCount.store(0, std::memory_order_relaxed);
+    errorCount.store(0, std::memory_order_relaxed);
+    wakeLatency.reset();
+    stopping.store(false);
+    thread = std::thread(&PositionSensor::run, this);
+    return true;
+}
+
+void PositionSensor::stop()
+{
+    if (!thread.joinable())
+        return;
+    stopping.store(true);
+    thread.join();
+    i2c->close();
+}
+
+double PositionSensor::filter(double mm, double dt)
+{
+    double sorted[MEDIAN_WINDOW];
+
+    window[windowNext] = mm;
+    windowNext = (windowNext + 1) % MEDIAN_WINDOW;
+    if (windowCount < MEDIAN_WINDOW)
+        windowCount++;
+    std::copy(window, window + windowCount, sorted);
+    std::nth_element(sorted, sorted + windowCount / 2, sorted + windowCount);
+    double median = sorted[windowCount / 2];
+
+    // First reading initialises the estimate, after that predict and correct
+    if (windowCount == 1)
+    {
+        estimate = median;
+        variance = MEASURE_NOISE;
+        return estimate;
+    }
+    variance += PROCESS_NOISE * dt;
+    double gain = variance / (variance + MEASURE_NOISE);
+    estimate += gain * (median - estimate);
+    variance *= 1 - gain;
+    return estimate;
+}
+
+void PositionSensor::run()
+{
+    uint8_t raw[2];
+    long periodNs = (long)(1e9 / opts.rateHz);
+    double dt = 1.0 / opts.rateHz;
+    struct timespec next, woke;
+
+    applyRealtime(opts.realtime);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        if (i2c->readRegister(opts.reg, raw, 2) == 2)
+        {
+            unsigned counts = opts.lsbFirst ? (raw[1] << 8 | raw[0]) : (raw[0] << 8 | raw[1]);
+            filteredMm.store(filter(counts * opts.mmPerCount, dt), std::memory_order_release);
+            sampleCount.fetch_add(1, std::memory_order_release);
+        }
+        else
+            errorCount.fetch_add(1, std::memory_order_relaxed);
+
+        // Absolute deadlines keep the rate steady whatever the bus latency
+        addNanoseconds(&next, periodNs);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        wakeLatency.add(elapsedMicros(next, woke));
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ Roof position from an I2C distance sensor
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "realtime.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/*
+ * Register level access to one I2C device. Implemented over pigpiod and Linux i2c-dev, a test double can be
+ * substituted to run the sampler without hardware.
+ */
+class I2cBus
+{
+  public:
+    virtual ~I2cBus() = default;
+    virtual bool open(unsigned bus, unsigned address) = 0;
+    virtual void close() = 0;
+    // Read count bytes starting at register reg, returns the number of bytes read or a negative error
+    virtual int readRegister(uint8_t reg, uint8_t *buf, unsigned count) = 0;
+};
+
+class PigpiodI2cBus : public I2cBus
+{
+  public:
+    explicit PigpiodI2cBus(int pi) : pi_id(pi) {}
+    ~PigpiodI2cBus() override { close(); }
+    bool open(unsigned bus, unsigned address) override;
+    void close() override;
+    int readRegister(uint8_t reg, uint8_t *buf, unsigned count) override;
+
+  private:
+    int pi_id;
+    int handle = -1;
+};
+
+class LinuxI2cBus : public I2cBus
+{
+  public:
+    ~LinuxI2cBus() override { close(); }
+    bool open(unsigned bus, unsigned address) override;
+    void close() override;
+    int readRegister(uint8_t reg, uint8_t *buf, unsigned count) override;
+
+  private:
+    int fd = -1;
+};
+
+/*
+ * Samples a 16 bit distance register on a background thread at a fixed rate. Each reading passes through a
+ * 5 point median to drop outliers and a scalar Kalman filter. The filtered distance is published through
+ * atomics so the driver can read it at any time without locking.
+ */
+class PositionSensor
+{
+  public:
+    struct Options
+    {
+        unsigned bus { 1 };
+        unsigned address { 0x10 };
+        uint8_t reg { 0 };
+        double rateHz { 20 };
+        double mmPerCount { 1 };        // Scale of the register value, 10 for sensors reporting centimetres
+        bool lsbFirst { false };        // Byte order of the register value
+        RealtimeOptions realtime;
+    };
+
+    explicit PositionSensor(std::unique_ptr<I2cBus> bus);
+    ~PositionSensor();
+
+    bool start(const Options &options);
+    void stop();
+    bool running() const { return thread.joinable(); }
+
+    double distance() const { return filteredMm.load(std::memory_order_acquire); }
+    uint32_t samples() const { return sampleCount.load(std::memory_order_acquire); }
+    uint32_t errors() const { return errorCount.load(std::memory_order_relaxed); }
+
+    // Exposed for use without the thread, each call filters one raw reading in millimetres
+    double filter(double mm, double dt);
+
+    // Lateness of each sampling wakeup against its deadline
+    JitterStats wakeLatency;
+
+  private:
+    void run();
+
+    static constexpr int MEDIAN_WINDOW = 5;
+    static constexpr double PROCESS_NOISE = 40000;      // mm^2 per second, allows roof speeds of about 200 mm/s
+    static constexpr double MEASURE_NOISE = 100;        // mm^2, about 10 mm sensor noise
+
+    std::unique_ptr<I2cBus> i2c;
+    Options opts;
+    std::thread thread;
+    std::atomic<bool> stopping { false };
+
+    double window[MEDIAN_WINDOW] {};
+    int windowCount = 0;
+    int windowNext = 0;
+    double estimate = 0;
+    double variance = 0;
+
+    std::atomic<double> filteredMm { 0 };
+    std::atomic<uint32_t> sampleCount { 0 };
+    std::atomic<uint32_t> errorCount { 0 };
+};
@@ -0,0 +1,288 @@
+/*
+ Relay pulse timing thread
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "pulseworker.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <pigpiod_if2.h>
+
+#define VERIFY_MS   20          // Longest wait for the edge report of a verified pulse
+
+bool bankReadFailed(uint32_t bits)
+{
+    int rc = (int)bits;
+    return rc == pigif_unconnected_pi || rc == pigif_bad_send || rc == pigif_bad_recv;
+}
+
+PulseWorker::~PulseWorker()
+{
+    stop();
+}
+
+bool PulseWorker::start(const RealtimeOptions &options)
+{
+    stop();
+    rt = options;
+    stopping = false;
+    pending = false;
+    started = false;
+    thread = std::thread(&PulseWorker::run, this);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return started; });
+    return rtApplied || !rt.enabled;
+}
+
+void PulseWorker::stop()
+{
+    if (!thread.joinable())
+        return;
+    benchCancel.store(true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+PulseWorker::Result PulseWorker::pulse(unsigned gpio, unsigned onLevel, int ms, bool verify)
+{
+    // A relay pulse must not wait for a benchmark to run to its end
+    benchCancel.store(true);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return !pending; });
+    reqGpio = gpio;
+    reqLevel = onLevel;
+    reqMs = ms;
+    reqVerify = verify;
+    if (!thread.joinable())
+        return doPulse();           // Not started, time the pulse on the calling thread
+    reqBenchmark = 0;
+    pending = true;
+    wake.notify_one();
+    done.wait(lock, [this] { return !pending; });
+    return result;
+}
+
+bool PulseWorker::benchmark(unsigned gpio, int count, int ms)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!thread.joinable() || pending || count <= 0)
+        return false;
+    widthError.reset();
+    benchWidth.reset();
+    benchLatency.reset();
+    benchMissed.store(0);
+    benchUnavailable.store(false);
+    benchCancel.store(false);
+    benchDone.store(false);
+    reqGpio = gpio;
+    reqMs = ms;
+    reqBenchmark = count;
+    pending = true;
+    wake.notify_one();
+    return true;
+}
+
+void PulseWorker::run()
+{
+    bool applied = applyRealtime(rt);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    rtApplied = applied;
+    started = true;
+    done.notify_one();
+    while (true)
+    {
+        wake.wait(lock, [this] { return pending || stopping; });
+        if (stopping)
+            break;
+        if (reqBenchmark > 0)
+        {
+            runBenchmark();
+            reqBenchmark = 0;
+        }
+        else
+            result = doPulse();
+        pending = false;
+        done.notify_one();
+    }
+}
+
+void PulseWorker::edge(unsigned gpio, unsigned level)
+{
+    std::lock_guard<std::mutex> lock(edgeMutex);
+    if ((int)gpio != watchGpio || level != watchLevel)
+        return;
+    edgeSeen = true;
+    edgeWake.notify_one();
+}
+
+void PulseWorker::benchEdge(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata)
+{
+    PulseWorker *worker = static_cast<PulseWorker *>(userdata);
+    struct timespec now;
+
+    if (level > 1)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    std::lock_guard<std::mutex> lock(worker->edgeMutex);
+    worker->benchSeen[level] = true;
+    worker->benchTick[level] = tick;
+    if (level == 1)
+        worker->benchAt = now;
+    worker->edgeWake.notify_one();
+}
+
+// Wait until an edge report sets seen or the deadline passes, true if it was set
+bool PulseWorker::waitEdge(const struct timespec &deadline, const bool &seen)
+{
+    struct timespec now;
+    std::unique_lock<std::mutex> lock(edgeMutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // steady_clock is CLOCK_MONOTONIC, the deadline is carried over as a time remaining
+    auto until = std::chrono::steady_clock::now() +
+                 std::chrono::microseconds(std::max<int64_t>(0, elapsedMicros(now, deadline)));
+    edgeWake.wait_until(lock, until, [&seen] { return seen; });
+    watchGpio = -1;
+    return seen;
+}
+
+/*
+ * Pulse the benchmark pin as doPulse() does, with its own edge callback in place of the driver's. The latency
+ * is taken from before the on write so that it includes the request to pigpiod, the pigpiod sampling and the
+ * notification to the callback thread. The width comes from the pigpiod edge ticks. The pin is left low for
+ * the pulse length between pulses, then returned to the mode it had.
+ */
+void PulseWorker::runBenchmark()
+{
+    int mode = get_mode(pi_id, reqGpio);
+    int callbackId = -1;
+
+    if (mode >= 0 && set_mode(pi_id, reqGpio, PI_OUTPUT) == 0 && gpio_write(pi_id, reqGpio, 0) == 0)
+        callbackId = callback_ex(pi_id, reqGpio, EITHER_EDGE, benchEdge, this);
+    if (callbackId < 0)
+        benchUnavailable.store(true);
+
+    for (int i = 0; callbackId >= 0 && i < reqBenchmark && !benchCancel.load(); i++)
+    {
+        struct timespec sent, start, end, deadline, verifyBy;
+        {
+            std::lock_guard<std::mutex> lock(edgeMutex);
+            benchSeen[0] = benchSeen[1] = false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        if (gpio_write(pi_id, reqGpio, 1) != 0)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        deadline = start;
+        addNanoseconds(&deadline, reqMs * 1000000L);
+        verifyBy = start;
+        addNanoseconds(&verifyBy, std::min(reqMs, VERIFY_MS) * 1000000L);
+        bool rose = waitEdge(verifyBy, benchSeen[1]);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+        if (gpio_write(pi_id, reqGpio, 0) != 0)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        widthError.add(elapsedMicros(start, end) - reqMs * 1000);
+        verifyBy = end;
+        addNanoseconds(&verifyBy, VERIFY_MS * 1000000L);
+        bool fell = waitEdge(verifyBy, benchSeen[0]);
+
+        if (rose && fell)
+        {
+            std::lock_guard<std::mutex> lock(edgeMutex);
+            benchLatency.add(elapsedMicros(sent, benchAt));
+            benchWidth.add((int64_t)(benchTick[0] - benchTick[1]) - reqMs * 1000);
+        }
+        else
+            benchMissed.fetch_add(1);
+        deadline = end;
+        addNanoseconds(&deadline, reqMs * 1000000L);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+    }
+    if (callbackId >= 0)
+        callback_cancel(callbackId);
+    if (mode >= 0)
+        set_mode(pi_id, reqGpio, mode);
+    benchDone.store(true, std::memory_order_release);
+}
+
+PulseWorker::Result PulseWorker::doPulse()
+{
+    Result r;
+    struct timespec start, end, deadline;
+
+    bool byEdge = reqVerify && reqGpio < 32 && (edgeMask.load() & (1u << reqGpio));
+
+    if (byEdge)
+    {
+        std::lock_guard<std::mutex> lock(edgeMutex);
+        watchGpio = reqGpio;
+        watchLevel = reqLevel;
+        edgeSeen = false;
+    }
+    {
+        TraceSpan span(trace, "gpio_write", "pulse on");
+        r.status = gpio_write(pi_id, reqGpio, reqLevel);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    r.start = start;
+    if (r.status != 0)
+    {
+        std::lock_guard<std::mutex> lock(edgeMutex);
+        watchGpio = -1;
+        return r;
+    }
+    r.written = true;
+    deadline = start;
+    addNanoseconds(&deadline, reqMs * 1000000L);
+
+    if (byEdge)
+    {
+        struct timespec verifyBy = start;
+        addNanoseconds(&verifyBy, std::min(reqMs, VERIFY_MS) * 1000000L);
+        r.asserted = waitEdge(verifyBy, edgeSeen);
+    }
+    else if (reqVerify)
+    {
+        TraceSpan span(trace, "read_bank_1", "pulse verify");
+        uint32_t bits = read_bank_1(pi_id);
+        if (!bankReadFailed(bits))
+        {
+            r.bankRead = true;
+            r.bank = bits;
+            r.asserted = (((bits >> reqGpio) & 1) == reqLevel);
+        }
+    }
+    if (r.asserted)
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+    {
+        TraceSpan span(trace, "gpio_write", "pulse off");
+        r.status = gpio_write(pi_id, reqGpio, reqLevel ? 0 : 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (r.asserted)
+        widthError.add(elapsedMicros(start, end) - reqMs * 1000);
+    return r;
+}
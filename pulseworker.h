@@ -0,0 +1,124 @@
+/*
+ Relay pulse timing thread
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "realtime.h"
+#include "tracerecorder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/*
+ * Times relay pulses on a dedicated thread, optionally under SCHED_FIFO, so the pulse width does not depend
+ * on how busy the INDI event loop thread is. The caller still waits for the pulse to finish, as it did when
+ * pulses were timed inline. The end of each pulse is an absolute CLOCK_MONOTONIC deadline, and the achieved
+ * width is recorded in widthError.
+ *
+ * Verification watches for the pigpiod edge report of the on level, passed in through edge() from the
+ * pigpiod_if2 callback thread, so it costs no request. A pin without edge reporting is read back instead.
+ */
+class PulseWorker
+{
+  public:
+    struct Result
+    {
+        int status { 0 };           // pigpiod error from a write, 0 when both writes succeeded
+        bool written { false };     // The on level was written, status then refers to the off write
+        bool asserted { true };     // False if verification found the pin not at the on level
+        bool bankRead { false };    // bank holds a read_bank_1 taken inside the pulse, only without edge reports
+        uint32_t bank { 0 };
+        struct timespec start {};   // CLOCK_MONOTONIC when the on level had been written
+    };
+
+    PulseWorker(int pi, TraceRecorder &recorder) : pi_id(pi), trace(recorder) {}
+    ~PulseWorker();
+
+    // Returns false if real-time scheduling was requested and refused, the thread then runs normally
+    bool start(const RealtimeOptions &options);
+    void stop();
+    bool running() const { return thread.joinable(); }
+
+    // Drive gpio to onLevel for ms milliseconds then back. With verify the pulse is cut short if the pin does
+    // not follow within VERIFY_MS. Blocks until the pulse is over.
+    Result pulse(unsigned gpio, unsigned onLevel, int ms, bool verify);
+
+    // The pins pigpiod reports edges for, and one of those edges
+    void setEdgeMask(uint32_t mask) { edgeMask.store(mask); }
+    void edge(unsigned gpio, unsigned level);
+
+    // Start count pulses of ms milliseconds on a spare gpio and return. Each is timed as a relay pulse is, and
+    // measured by a callback on the pin against the pigpiod edge reports. A pulse() request cancels it.
+    bool benchmark(unsigned gpio, int count, int ms);
+    bool benchmarkFinished() const { return benchDone.load(std::memory_order_acquire); }
+    // Real-time scheduling was requested and applied to the thread
+    bool realtime() const { return rtApplied; }
+
+    JitterStats widthError;
+    JitterStats benchWidth;                     // Width of benchmark pulses from the edge ticks, against ms
+    JitterStats benchLatency;                   // From the on write being sent to its edge report arriving
+    std::atomic<uint32_t> benchMissed { 0 };    // Pulses with an edge never reported
+    std::atomic<bool> benchUnavailable { false };   // The pin could not be set up
+
+  private:
+    void run();
+    Result doPulse();
+    void runBenchmark();
+    bool waitEdge(const struct timespec &deadline, const bool &seen);
+    static void benchEdge(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata);
+
+    int pi_id;
+    TraceRecorder &trace;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    bool pending = false;
+    bool started = false;
+    bool rtApplied = false;
+    RealtimeOptions rt;
+
+    // The one outstanding request, the INDI thread is the only caller
+    unsigned reqGpio = 0;
+    unsigned reqLevel = 0;
+    int reqMs = 0;
+    bool reqVerify = false;
+    int reqBenchmark = 0;
+    Result result;
+    std::atomic<bool> benchCancel { false };
+    std::atomic<bool> benchDone { true };
+
+    // The edge a verified pulse is waiting for, separate from mutex which the worker holds through a pulse
+    std::atomic<uint32_t> edgeMask { 0 };
+    std::mutex edgeMutex;
+    std::condition_variable edgeWake;
+    int watchGpio = -1;
+    unsigned watchLevel = 0;
+    bool edgeSeen = false;
+    // Benchmark edges by level, off then on
+    bool benchSeen[2] {};
+    uint32_t benchTick[2] {};
+    struct timespec benchAt {};
+};
+
+// read_bank_1 returns the levels, or a pigpiod_if2 error in their place when the request did not reach pigpiod
+bool bankReadFailed(uint32_t bits);
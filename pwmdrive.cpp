@@ -0,0 +1,216 @@
+/*
+ PWM soft start roof drive for DC motors
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "pwmdrive.h"
+
+#include <pigpiod_if2.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+#define RAMP_STEP_MS    20          // Interval between duty cycle steps of a ramp
+#define SOFT_PWM_RANGE  1000        // Range of the DMA timed PWM, matches the duty units
+#define RUN_DOWN_MS     250         // Allowed after the duty reaches zero for the motor to stop turning
+
+/*
+ * Ramp script parameters: p0 start duty, p1 final duty, p2 step, p3 gpio, p4 frequency, p5 step interval ms,
+ * p6 steps less one. Duties are already scaled to the PWM command's range.
+ */
+static const char *hardwareRamp =
+    "ld v0 p0 ld v1 p6 tag 1 hp p3 p4 v0 mils p5 lda v0 add p2 sta v0 dcr v1 lda v1 jp 1 hp p3 p4 p1";
+static const char *softwareRamp =
+    "ld v0 p0 ld v1 p6 tag 1 pwm p3 v0 mils p5 lda v0 add p2 sta v0 dcr v1 lda v1 jp 1 pwm p3 p1";
+
+PwmDrive::~PwmDrive()
+{
+    stop(true);
+    if (scriptId >= 0)
+        delete_script(pi_id, scriptId);
+}
+
+bool PwmDrive::configure(const Options &options)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    opts = options;
+    opts.maxDuty = std::min(std::max(opts.maxDuty, 0), 1000);
+    opts.creepDuty = std::min(std::max(opts.creepDuty, 0), opts.maxDuty);
+    hardwarePwm = (opts.pwmGpio == 12 || opts.pwmGpio == 13 || opts.pwmGpio == 18 || opts.pwmGpio == 19);
+    {
+        TraceSpan span(trace, "set_mode", "pwm");
+        if (set_mode(pi_id, opts.dirGpio, PI_OUTPUT) != 0 || set_mode(pi_id, opts.pwmGpio, PI_OUTPUT) != 0)
+            return false;
+        if (!hardwarePwm)
+        {
+            set_PWM_range(pi_id, opts.pwmGpio, SOFT_PWM_RANGE);
+            set_PWM_frequency(pi_id, opts.pwmGpio, opts.freqHz);
+        }
+    }
+    {
+        TraceSpan span(trace, "store_script", "pwm");
+        if (scriptId >= 0)
+            delete_script(pi_id, scriptId);
+        scriptId = store_script(pi_id, const_cast<char *>(hardwarePwm ? hardwareRamp : softwareRamp));
+    }
+    fromDuty = targetDuty = 0;
+    rampMs = 0;
+    direction = -1;
+    return setDuty(0);
+}
+
+bool PwmDrive::setDuty(int duty)
+{
+    TraceSpan span(trace, hardwarePwm ? "hardware_PWM" : "set_PWM_dutycycle", "pwm");
+    if (hardwarePwm)
+        return hardware_PWM(pi_id, opts.pwmGpio, opts.freqHz, duty * 1000) == 0;
+    return set_PWM_dutycycle(pi_id, opts.pwmGpio, duty) == 0;
+}
+
+int PwmDrive::duty() const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - rampStart.tv_sec) * 1000 + (now.tv_nsec - rampStart.tv_nsec) / 1000000;
+    if (rampMs <= 0 || elapsed >= rampMs)
+        return targetDuty;
+    return fromDuty + (targetDuty - fromDuty) * elapsed / rampMs;
+}
+
+int PwmDrive::target() const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return targetDuty;
+}
+
+bool PwmDrive::slowing() const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return targetDuty > 0 && targetDuty < opts.maxDuty;
+}
+
+long PwmDrive::runDownMs() const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    struct timespec now;
+    if (targetDuty > 0)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - rampStart.tv_sec) * 1000 + (now.tv_nsec - rampStart.tv_nsec) / 1000000;
+    return std::max(0L, rampMs + RUN_DOWN_MS - elapsed);
+}
+
+/*
+ * Replace any ramp in progress with one from the present duty to the target. Without the script, for
+ * example when pigpiod refused to store it, the duty is set at once.
+ */
+bool PwmDrive::ramp(int to, int ms)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    int from = duty();
+    if (scriptId >= 0)
+    {
+        TraceSpan span(trace, "stop_script", "pwm");
+        stop_script(pi_id, scriptId);
+    }
+    fromDuty = from;
+    targetDuty = to;
+    rampMs = ms;
+    clock_gettime(CLOCK_MONOTONIC, &rampStart);
+
+    int steps = std::max(1, ms / RAMP_STEP_MS);
+    if (scriptId < 0 || ms <= 0 || from == to)
+    {
+        rampMs = 0;
+        return setDuty(to);
+    }
+    int scale = hardwarePwm ? 1000 : 1;
+    uint32_t params[7];
+    params[0] = from * scale;
+    params[1] = to * scale;
+    params[2] = (uint32_t)(int32_t)((to - from) * scale / steps);
+    params[3] = opts.pwmGpio;
+    params[4] = opts.freqHz;
+    params[5] = RAMP_STEP_MS;
+    params[6] = steps - 1;
+    bool running;
+    {
+        TraceSpan span(trace, "run_script", "pwm");
+        running = (run_script(pi_id, scriptId, 7, params) == 0);
+    }
+    if (!running)
+    {
+        rampMs = 0;
+        return setDuty(to);
+    }
+    return true;
+}
+
+bool PwmDrive::start(bool opening)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    int level = (opening == opts.dirOpenHigh) ? 1 : 0;
+
+    if (halted)
+        return false;
+    // Never reverse the bridge under power or while the motor is still turning. In the same direction a
+    // slowing motor ramps back up from its present duty.
+    if (level != direction)
+    {
+        if (direction >= 0 && runDownMs() != 0)
+            return false;
+        TraceSpan span(trace, "gpio_write", "pwm direction");
+        if (gpio_write(pi_id, opts.dirGpio, level) != 0)
+            return false;
+        direction = level;
+    }
+    int from = duty();
+    return ramp(opts.maxDuty, opts.accelMs * (opts.maxDuty - from) / 1000);
+}
+
+bool PwmDrive::slow()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    int from = duty();
+    if (from <= opts.creepDuty)
+        return true;
+    return ramp(opts.creepDuty, opts.decelMs * (from - opts.creepDuty) / std::max(opts.maxDuty, 1));
+}
+
+bool PwmDrive::stop(bool immediate)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    int from = duty();
+    if (immediate || from == 0)
+        return ramp(0, 0);
+    return ramp(0, opts.decelMs * from / std::max(opts.maxDuty, 1));
+}
+
+void PwmDrive::halt()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    halted = true;
+    stop(true);
+}
+
+void PwmDrive::clearHalt()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    halted = false;
+}
@@ -0,0 +1,86 @@
+/*
+ PWM soft start roof drive for DC motors
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "tracerecorder.h"
+
+#include <ctime>
+#include <mutex>
+
+/*
+ * Drives an H-bridge through a PWM pin and a direction pin. Speed changes are ramped by a script stored in
+ * pigpiod, which steps the duty cycle on its own timing, so the driver only starts each ramp. GPIO 12, 13, 18
+ * and 19 use hardware PWM, other pins the daemon's DMA timed PWM. Duty cycles are in tenths of a percent.
+ * The direction is only changed once the motor has run down. halt() may be called from another thread, such
+ * as the pigpiod_if2 callback thread when a limit switch is reached, and blocks starts until clearHalt().
+ */
+class PwmDrive
+{
+  public:
+    struct Options
+    {
+        unsigned pwmGpio { 18 };
+        unsigned dirGpio { 0 };
+        bool dirOpenHigh { true };
+        unsigned freqHz { 20000 };
+        int maxDuty { 1000 };
+        int creepDuty { 300 };          // Duty to approach a limit switch at
+        int accelMs { 2000 };
+        int decelMs { 1000 };
+    };
+
+    PwmDrive(int pi, TraceRecorder &recorder) : pi_id(pi), trace(recorder) {}
+    ~PwmDrive();
+
+    bool configure(const Options &options);
+    // Set the direction and ramp up to the maximum duty. Refused if that reverses a motor not yet run down.
+    bool start(bool opening);
+    // Ramp down to the creep duty ahead of a limit
+    bool slow();
+    // Ramp down to stopped, or stop at once
+    bool stop(bool immediate);
+    // Stop at once and refuse starts until clearHalt()
+    void halt();
+    void clearHalt();
+    int duty() const;
+    int target() const;
+    bool slowing() const;
+    bool hardware() const { return hardwarePwm; }
+    // Milliseconds until the motor has stopped and settled, -1 while it is driven
+    long runDownMs() const;
+
+  private:
+    bool ramp(int to, int ms);
+    bool setDuty(int duty);
+
+    int pi_id;
+    TraceRecorder &trace;
+    Options opts;
+    bool hardwarePwm = false;
+    int scriptId = -1;
+    mutable std::recursive_mutex mutex;
+    bool halted = false;
+    int direction = -1;                 // Level of the direction output, -1 until first set
+
+    // The ramp in progress, the duty at any time is interpolated from it
+    int fromDuty = 0;
+    int targetDuty = 0;
+    int rampMs = 0;
+    struct timespec rampStart { 0, 0 };
+};
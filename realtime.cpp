@@ -0,0 +1,117 @@
+/*
+ Real-time scheduling and timing statistics for the driver threads
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "realtime.h"
+
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define PREFAULT_STACK 65536        // Bytes of stack touched so the first deep call does not fault
+
+static void prefaultStack()
+{
+    volatile char stack[PREFAULT_STACK];
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+bool applyRealtime(const RealtimeOptions &options)
+{
+    struct sched_param param;
+    bool ok = true;
+
+    memset(&param, 0, sizeof(param));
+    if (options.enabled)
+    {
+        param.sched_priority = options.priority;
+        ok = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+        if (options.cpu >= 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(options.cpu, &cpus);
+            ok = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0 && ok;
+        }
+        prefaultStack();
+    }
+    else
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    return ok;
+}
+
+bool lockMemory(bool lock)
+{
+    if (lock)
+        return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    return munlockall() == 0;
+}
+
+void addNanoseconds(struct timespec *ts, long ns)
+{
+    ts->tv_sec += ns / 1000000000L;
+    ts->tv_nsec += ns % 1000000000L;
+    while (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+}
+
+int64_t elapsedMicros(const struct timespec &a, const struct timespec &b)
+{
+    return (int64_t)(b.tv_sec - a.tv_sec) * 1000000 + (b.tv_nsec - a.tv_nsec) / 1000;
+}
+
+void JitterStats::add(int64_t micros)
+{
+    if (micros < 0)
+        micros = -micros;
+    int64_t bucket = micros / BUCKET_US;
+    if (bucket >= BUCKETS)
+        bucket = BUCKETS - 1;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    if (micros > worst.load(std::memory_order_relaxed))
+        worst.store(micros, std::memory_order_relaxed);
+}
+
+void JitterStats::reset()
+{
+    for (auto &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    worst.store(0, std::memory_order_relaxed);
+}
+
+double JitterStats::percentile(double p) const
+{
+    uint32_t n = count();
+    if (n == 0)
+        return 0;
+    uint32_t want = (uint32_t)(p * n);
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > want)
+            return std::min((i + 1) * BUCKET_US / 1000.0, maxMs());
+    }
+    return maxMs();
+}
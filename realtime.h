@@ -0,0 +1,65 @@
+/*
+ Real-time scheduling and timing statistics for the driver threads
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+struct RealtimeOptions
+{
+    bool enabled { false };
+    int priority { 50 };        // SCHED_FIFO priority, 1 to 99
+    int cpu { -1 };             // CPU to run on, -1 for any
+};
+
+// Apply the options to the calling thread and prefault its stack. Returns false if the scheduler refused.
+bool applyRealtime(const RealtimeOptions &options);
+
+// Lock the process memory so timing threads do not page fault, or unlock it again
+bool lockMemory(bool lock);
+
+// Add nanoseconds to a CLOCK_MONOTONIC deadline
+void addNanoseconds(struct timespec *ts, long ns);
+
+// Signed microseconds from a to b
+int64_t elapsedMicros(const struct timespec &a, const struct timespec &b);
+
+/*
+ * Distribution of a timing error in microseconds, as a fixed histogram so it can be added to from a timing
+ * thread without allocating. One thread adds, any thread reads.
+ */
+class JitterStats
+{
+  public:
+    static constexpr int BUCKET_US = 50;
+    static constexpr int BUCKETS = 400;             // 20 ms, larger values go in the last bucket
+
+    void add(int64_t micros);
+    void reset();
+    uint32_t count() const { return total.load(std::memory_order_relaxed); }
+    // Value in milliseconds below which the fraction p of the samples fall, to bucket resolution
+    double percentile(double p) const;
+    double maxMs() const { return worst.load(std::memory_order_relaxed) / 1000.0; }
+
+  private:
+    std::atomic<uint32_t> buckets[BUCKETS] {};
+    std::atomic<uint32_t> total { 0 };
+    std::atomic<int64_t> worst { 0 };
+};
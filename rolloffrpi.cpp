@@ -35,10 +35,15 @@
 #include "indicom.h"
 #include "termios.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <memory>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #define ROLLOFF_DURATION 30               // Seconds until Roof is fully opened or closed
 #define INITIAL_TIMING   500             // Init period at startup
@@ -46,15 +51,22 @@
 #define ACTIVE_POLL_MS   500              // Polling period in milliseconds when roof is in motion
 #define ROR_D_PRESS      1000             // Milliseconds after issuing command allowed for a response
 #define MAX_CNTRL_COM_ERR 10              // Maximum consecutive errors communicating with Arduino
+#define RELAY_COUNT_SAVE_S 900            // Seconds between writes of changed relay counters to their file
+#define METRICS_WRITE_S 15                // Seconds between writes of the metrics textfile
+#define TRAVEL_LEARN_RATE 0.3           // Weight given to the latest complete move when updating the travel model
+#define FAST_POLL_MS     100              // Polling period when the roof is expected to reach its limit switch
+#define SNAPSHOT_MAX_AGE_MS 100           // Reuse a GPIO bank snapshot younger than this instead of reading again
+#define HOLD_DEADLINE_MIN_S 3.0           // Shortest held relay dead-man deadline, well over the inactive polling
+#define PWM_APPROACH_S   2.0              // Seconds the PWM drive plans to spend at the approach duty before a limit
+#define TIMING_STATS_S   10               // Seconds between updates of the timing statistics
+#define TIMING_BENCH_COUNT 200            // Pulses timed by the pulse thread benchmark
+#define TIMING_BENCH_MS  10               // Length of each benchmark pulse
+#define ESTIMATE_STOPPED_VAR 1e-6         // Velocity variance of a stopped roof, fraction/s squared
+#define ESTIMATE_SWITCH_VAR  1e-4         // Position variance at a limit switch, about 1% of travel
+#define ESTIMATE_SENSOR_MM2  100          // Distance sensor variance in mm squared
 
 // Arduino controller interface limits
-#define MAXINOCMD        15          // Command buffer
 #define MAXINOTARGET     15          // Target buffer
-#define MAXINOVAL        127         // Value bufffer, sized to contain NAK error strings
-#define MAXINOLINE       63          // Sized to contain outgoing command requests
-#define MAXINOBUF        255         // Sized for maximum overall input / output
-#define MAXINOERR        255         // System call error message buffer
-#define MAXINOWAIT       2           // seconds
 
 // Driver version id
 #define VERSION_ID      "20221105"
@@ -66,6 +78,15 @@ RollOffIno::RollOffIno()
 {
     SetDomeCapability(DOME_CAN_ABORT | DOME_CAN_PARK);           // Need the DOME_CAN_PARK capability for the scheduler
     setDomeConnection(CONNECTION_NONE);
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+        outExpectedLevel[i] = -1;
+    for (int i = 0; i < 32; i++)
+        edgeCallbackId[i] = -1;
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+    {
+        inpDefGpio[i] = -1;
+        inpDefFunction[i] = -1;
+    }
 }
 
 bool RollOffIno::ISSnoopDevice(XMLEle *root)
@@ -84,7 +105,10 @@ const char *RollOffIno::getDefaultName()
 
 RollOffIno::~RollOffIno()
 {
-    pigpio_stop(pi_id);
+    // The drives, samplers and pigpiod scripts release their pins through the session, so they are stopped
+    // the way Disconnect does before the session is closed
+    if (pi_id >= 0)
+        Disconnect();
 }
 
 /*
@@ -95,6 +119,64 @@ void RollOffIno::ISGetProperties(const char *dev)
     INDI::Dome::ISGetProperties(dev);
     defineProperty(&RoofTimeoutNP);
     loadConfig(true, "ROOF_TIMEOUT");
+    defineProperty(&MotorDutyNP);
+    loadConfig(true, MotorDutyNP.name);
+    defineProperty(&RoofTravelNP);
+    loadConfig(true, RoofTravelNP.name);
+    defineProperty(&ReverseDelayNP);
+    loadConfig(true, ReverseDelayNP.name);
+    defineProperty(&OutVerifySP);
+    loadConfig(true, OutVerifySP.name);
+    defineProperty(&ControllerSP);
+    loadConfig(true, ControllerSP.name);
+    defineProperty(&SensorVoteSP);
+    loadConfig(true, SensorVoteSP.name);
+    defineProperty(&PosSensorSP);
+    loadConfig(true, PosSensorSP.name);
+    defineProperty(&PosSensorNP);
+    loadConfig(true, PosSensorNP.name);
+    defineProperty(&PosByteOrderSP);
+    loadConfig(true, PosByteOrderSP.name);
+    defineProperty(&DriveSP);
+    loadConfig(true, DriveSP.name);
+    defineProperty(&LinkSP);
+    loadConfig(true, LinkSP.name);
+    defineProperty(&LinkTP);
+    loadConfig(true, LinkTP.name);
+    defineProperty(&LinkBaudNP);
+    loadConfig(true, LinkBaudNP.name);
+    defineProperty(&LinkProtocolSP);
+    loadConfig(true, LinkProtocolSP.name);
+    defineProperty(&StepperNP);
+    loadConfig(true, StepperNP.name);
+    defineProperty(&StepDirSP);
+    loadConfig(true, StepDirSP.name);
+    defineProperty(&PwmNP);
+    loadConfig(true, PwmNP.name);
+    defineProperty(&HeartbeatNP);
+    loadConfig(true, HeartbeatNP.name);
+    defineProperty(&HoldDeadlineNP);
+    loadConfig(true, HoldDeadlineNP.name);
+    defineProperty(&RealtimeSP);
+    loadConfig(true, RealtimeSP.name);
+    defineProperty(&ShmSP);
+    loadConfig(true, ShmSP.name);
+    defineProperty(&JsonSocketSP);
+    loadConfig(true, JsonSocketSP.name);
+    defineProperty(&JsonPortNP);
+    loadConfig(true, JsonPortNP.name);
+    defineProperty(&MetricsTP);
+    loadConfig(true, MetricsTP.name);
+    defineProperty(&RealtimeNP);
+    loadConfig(true, RealtimeNP.name);
+    defineProperty(&CurSensorSP);
+    loadConfig(true, CurSensorSP.name);
+    defineProperty(&CurSensorNP);
+    loadConfig(true, CurSensorNP.name);
+    defineProperty(&CurTraceSP);
+    loadConfig(true, CurTraceSP.name);
+    defineProperty(&ButtonGapNP);
+    loadConfig(true, ButtonGapNP.name);
 
     for (int i = 0; i < MAX_OUT_DEFS; i++)
     {
@@ -144,6 +226,291 @@ bool RollOffIno::initProperties()
     IUFillNumberVector(&RoofTimeoutNP, RoofTimeoutN, 1, getDeviceName(), "ROOF_MOVEMENT", "Roof Movement", OPTIONS_TAB, IP_RW,
                        60, IPS_IDLE);
 
+    for (int j = 0; j < MAX_RELAY_OPS; j++)
+    {
+        IUFillNumber(&RelayCyclesN[j], outOps[j], outOps[j], "%8.0f", 0, 1e9, 1, 0);
+        IUFillNumber(&RelayOnTimeN[j], outOps[j], outOps[j], "%10.1f", 0, 1e12, 1, 0);
+    }
+    IUFillNumberVector(&RelayCyclesNP, RelayCyclesN, MAX_RELAY_OPS, getDeviceName(), "RELAY_CYCLES", "Relay Activations",
+                       DIAG_TAB, IP_RO, 60, IPS_IDLE);
+    IUFillNumberVector(&RelayOnTimeNP, RelayOnTimeN, MAX_RELAY_OPS, getDeviceName(), "RELAY_ON_TIME", "Relay On Seconds",
+                       DIAG_TAB, IP_RO, 60, IPS_IDLE);
+    loadRelayCounts();
+
+    IUFillNumber(&MotorDutyN[DUTY_BUDGET], "DUTY_BUDGET", "Run budget seconds, 0 off", "%4.0f", 0, 3600, 10, 0);
+    IUFillNumber(&MotorDutyN[DUTY_COOLING], "DUTY_COOLING", "Cooling minutes", "%3.0f", 1, 240, 1, 15);
+    IUFillNumberVector(&MotorDutyNP, MotorDutyN, 2, getDeviceName(), "MOTOR_DUTY", "Motor Duty", OPTIONS_TAB, IP_RW,
+                       60, IPS_IDLE);
+
+    IUFillNumber(&DutyStatusN[DUTY_REMAINING], "DUTY_REMAINING", "Budget remaining s", "%4.0f", 0, 3600, 1, 0);
+    IUFillNumber(&DutyStatusN[DUTY_HEAT], "DUTY_HEAT", "Motor heat s", "%4.0f", 0, 3600, 1, 0);
+    IUFillNumber(&DutyStatusN[DUTY_WAIT], "DUTY_WAIT", "Open allowed in s", "%4.0f", 0, 86400, 1, 0);
+    IUFillNumberVector(&DutyStatusNP, DutyStatusN, 3, getDeviceName(), "MOTOR_DUTY_STATUS", "Motor Duty", MAIN_CONTROL_TAB,
+                       IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&RoofTravelN[TRAVEL_OPEN], "TRAVEL_OPEN", "Open travel seconds", "%5.2f", 0, 300, 0.1, 0);
+    IUFillNumber(&RoofTravelN[TRAVEL_CLOSE], "TRAVEL_CLOSE", "Close travel seconds", "%5.2f", 0, 300, 0.1, 0);
+    IUFillNumber(&RoofTravelN[TRAVEL_START], "TRAVEL_START", "Start delay seconds", "%5.2f", 0, 30, 0.05, 0);
+    IUFillNumberVector(&RoofTravelNP, RoofTravelN, 3, getDeviceName(), "ROOF_TRAVEL", "Roof Travel", OPTIONS_TAB, IP_RW,
+                       60, IPS_IDLE);
+
+    IUFillNumber(&ReverseDelayN[0], "REVERSE_DELAY", "Milliseconds", "%4.0f", 0, 10000, 100, 1000);
+    IUFillNumberVector(&ReverseDelayNP, ReverseDelayN, 1, getDeviceName(), "REVERSE_DELAY", "Reverse Delay", OPTIONS_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&VentN[0], "VENT_PERCENT", "Open percent", "%3.0f", 5, 95, 5, 30);
+    IUFillNumberVector(&VentNP, VentN, 1, getDeviceName(), "ROOF_VENT", "Vent", MAIN_CONTROL_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&ControllerS[CONTROLLER_SEPARATE], "CONTROLLER_SEPARATE", "Open/Close buttons", ISS_ON);
+    IUFillSwitch(&ControllerS[CONTROLLER_SINGLE], "CONTROLLER_SINGLE", "Single button", ISS_OFF);
+    IUFillSwitchVector(&ControllerSP, ControllerS, 2, getDeviceName(), "ROOF_CONTROLLER", "Controller", GPIO_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+    IUFillNumber(&ButtonGapN[0], "BUTTON_GAP", "Milliseconds", "%4.0f", 100, 5000, 100, 1000);
+    IUFillNumberVector(&ButtonGapNP, ButtonGapN, 1, getDeviceName(), "BUTTON_GAP", "Button Interval", GPIO_TAB, IP_RW, 60,
+                       IPS_IDLE);
+
+    IUFillSwitch(&CalibrateS[CALIBRATE_START], "CALIBRATE_START", "Start", ISS_OFF);
+    IUFillSwitch(&CalibrateS[CALIBRATE_CANCEL], "CALIBRATE_CANCEL", "Cancel", ISS_OFF);
+    IUFillSwitchVector(&CalibrateSP, CalibrateS, 2, getDeviceName(), "ROOF_CALIBRATE", "Calibrate", OPTIONS_TAB, IP_RW,
+                       ISR_ATMOST1, 60, IPS_IDLE);
+    IUFillNumber(&CalibrateN[0], "CALIBRATE_CYCLES", "Open/close cycles", "%2.0f", 1, 10, 1, 2);
+    IUFillNumberVector(&CalibrateNP, CalibrateN, 1, getDeviceName(), "ROOF_CALIBRATE_CYCLES", "Calibrate", OPTIONS_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&SensorVoteS[VOTE_ANY], "VOTE_ANY", "Any", ISS_OFF);
+    IUFillSwitch(&SensorVoteS[VOTE_ALL], "VOTE_ALL", "All", ISS_OFF);
+    IUFillSwitch(&SensorVoteS[VOTE_MAJORITY], "VOTE_MAJORITY", "Majority", ISS_ON);
+    IUFillSwitchVector(&SensorVoteSP, SensorVoteS, 3, getDeviceName(), "SENSOR_VOTE", "Redundant Switches", GPIO_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+        IUFillNumber(&InpDisagreeN[i], (response + std::to_string(i+1)).c_str(), (responseL + std::to_string(i+1)).c_str(),
+                     "%8.0f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&InpDisagreeNP, InpDisagreeN, MAX_INP_DEFS, getDeviceName(), "INP_DISAGREE", "Switch Disagreements",
+                       DIAG_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&PosSensorS[POS_SENSOR_OFF], "POS_SENSOR_OFF", "Off", ISS_ON);
+    IUFillSwitch(&PosSensorS[POS_SENSOR_PIGPIOD], "POS_SENSOR_PIGPIOD", "pigpiod I2C", ISS_OFF);
+    IUFillSwitch(&PosSensorS[POS_SENSOR_I2CDEV], "POS_SENSOR_I2CDEV", "Linux i2c-dev", ISS_OFF);
+    IUFillSwitchVector(&PosSensorSP, PosSensorS, 3, getDeviceName(), "POS_SENSOR", "Distance Sensor", SENSOR_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&PosSensorN[POS_BUS], "POS_BUS", "I2C bus", "%1.0f", 0, 10, 1, 1);
+    IUFillNumber(&PosSensorN[POS_ADDRESS], "POS_ADDRESS", "Address", "%3.0f", 3, 119, 1, 16);
+    IUFillNumber(&PosSensorN[POS_REGISTER], "POS_REGISTER", "Distance register", "%3.0f", 0, 255, 1, 0);
+    IUFillNumber(&PosSensorN[POS_RATE], "POS_RATE", "Samples per second", "%3.0f", 1, 100, 1, 20);
+    IUFillNumber(&PosSensorN[POS_SCALE], "POS_SCALE", "mm per count", "%5.2f", 0.01, 100, 0.1, 1);
+    IUFillNumber(&PosSensorN[POS_CLOSED_MM], "POS_CLOSED_MM", "Distance when closed mm", "%5.0f", 0, 20000, 10, 0);
+    IUFillNumber(&PosSensorN[POS_OPENED_MM], "POS_OPENED_MM", "Distance when opened mm", "%5.0f", 0, 20000, 10, 3000);
+    IUFillNumberVector(&PosSensorNP, PosSensorN, 7, getDeviceName(), "POS_SENSOR_SETTINGS", "Distance Sensor", SENSOR_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&PosByteOrderS[POS_MSB_FIRST], "POS_MSB_FIRST", "High byte first", ISS_ON);
+    IUFillSwitch(&PosByteOrderS[POS_LSB_FIRST], "POS_LSB_FIRST", "Low byte first", ISS_OFF);
+    IUFillSwitchVector(&PosByteOrderSP, PosByteOrderS, 2, getDeviceName(), "POS_BYTE_ORDER", "Register Byte Order",
+                       SENSOR_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&CurSensorS[CUR_SENSOR_OFF], "CUR_SENSOR_OFF", "Off", ISS_ON);
+    IUFillSwitch(&CurSensorS[CUR_SENSOR_PIGPIOD], "CUR_SENSOR_PIGPIOD", "pigpiod SPI", ISS_OFF);
+    IUFillSwitch(&CurSensorS[CUR_SENSOR_SPIDEV], "CUR_SENSOR_SPIDEV", "Linux spidev", ISS_OFF);
+    IUFillSwitchVector(&CurSensorSP, CurSensorS, 3, getDeviceName(), "CUR_SENSOR", "Motor Current", SENSOR_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&CurSensorN[CUR_SPI_CHANNEL], "CUR_SPI_CHANNEL", "SPI chip select", "%1.0f", 0, 1, 1, 0);
+    IUFillNumber(&CurSensorN[CUR_ADC_CHANNEL], "CUR_ADC_CHANNEL", "MCP3008 channel", "%1.0f", 0, 7, 1, 0);
+    IUFillNumber(&CurSensorN[CUR_RATE], "CUR_RATE", "Samples per second", "%4.0f", 50, 2000, 50, 500);
+    IUFillNumber(&CurSensorN[CUR_SCALE], "CUR_SCALE", "Amps per count", "%6.4f", 0.0001, 1, 0.001, 0.0264);
+    IUFillNumber(&CurSensorN[CUR_ZERO], "CUR_ZERO", "Counts at zero current", "%4.0f", 0, 1023, 1, 512);
+    IUFillNumber(&CurSensorN[CUR_OVERCURRENT], "CUR_OVERCURRENT", "Overcurrent amps", "%5.1f", 0.1, 100, 0.5, 15);
+    IUFillNumber(&CurSensorN[CUR_STALL], "CUR_STALL", "Stall amps", "%5.1f", 0.1, 100, 0.5, 8);
+    IUFillNumber(&CurSensorN[CUR_STALL_MS], "CUR_STALL_MS", "Stall time ms", "%5.0f", 10, 5000, 10, 300);
+    IUFillNumber(&CurSensorN[CUR_INRUSH_MS], "CUR_INRUSH_MS", "Inrush time ms", "%5.0f", 0, 5000, 50, 500);
+    IUFillNumberVector(&CurSensorNP, CurSensorN, 9, getDeviceName(), "CUR_SENSOR_SETTINGS", "Motor Current", SENSOR_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&CurTraceS[CUR_TRACE_OFF], "CUR_TRACE_OFF", "Off", ISS_ON);
+    IUFillSwitch(&CurTraceS[CUR_TRACE_SAVE], "CUR_TRACE_SAVE", "Save each move", ISS_OFF);
+    IUFillSwitchVector(&CurTraceSP, CurTraceS, 2, getDeviceName(), "CUR_TRACE_FILE", "Current Trace File", SENSOR_TAB,
+                       IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&MotorCurrentN[CURRENT_NOW], "CURRENT_NOW", "Current A", "%5.2f", 0, 100, 0, 0);
+    IUFillNumber(&MotorCurrentN[CURRENT_PEAK], "CURRENT_PEAK", "Last move peak A", "%5.2f", 0, 100, 0, 0);
+    IUFillNumber(&MotorCurrentN[CURRENT_MEAN], "CURRENT_MEAN", "Last move mean A", "%5.2f", 0, 100, 0, 0);
+    IUFillNumber(&MotorCurrentN[CURRENT_TRIPS], "CURRENT_TRIPS", "Trips", "%6.0f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&MotorCurrentNP, MotorCurrentN, 4, getDeviceName(), "MOTOR_CURRENT", "Motor Current", DIAG_TAB,
+                       IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&RoofPositionN[POSITION_PERCENT], "POSITION_PERCENT", "Open percent", "%5.1f", 0, 100, 1, 0);
+    IUFillNumber(&RoofPositionN[POSITION_MM], "POSITION_MM", "Distance mm", "%6.0f", 0, 65535, 1, 0);
+    IUFillNumberVector(&RoofPositionNP, RoofPositionN, 2, getDeviceName(), "ROOF_POSITION", "Roof Position",
+                       MAIN_CONTROL_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&DriveS[DRIVE_RELAYS], "DRIVE_RELAYS", "Relays to controller", ISS_ON);
+    IUFillSwitch(&DriveS[DRIVE_STEPPER], "DRIVE_STEPPER", "Step and direction", ISS_OFF);
+    IUFillSwitch(&DriveS[DRIVE_PWM], "DRIVE_PWM", "PWM H-bridge", ISS_OFF);
+    IUFillSwitchVector(&DriveSP, DriveS, 3, getDeviceName(), "MOTOR_DRIVE", "Motor Drive", GPIO_TAB, IP_RW, ISR_1OFMANY,
+                       60, IPS_IDLE);
+
+    IUFillSwitch(&LinkS[LINK_GPIO], "LINK_GPIO", "GPIO pins", ISS_ON);
+    IUFillSwitch(&LinkS[LINK_SERIAL], "LINK_SERIAL", "Arduino serial", ISS_OFF);
+    IUFillSwitch(&LinkS[LINK_TCP], "LINK_TCP", "TCP controller", ISS_OFF);
+    IUFillSwitchVector(&LinkSP, LinkS, 3, getDeviceName(), "CONTROLLER_LINK", "Controller Link", GPIO_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+    IUFillText(&LinkT[0], "LINK_ADDRESS", "Serial port or host:port", "/dev/ttyACM0");
+    IUFillTextVector(&LinkTP, LinkT, 1, getDeviceName(), "CONTROLLER_ADDRESS", "Controller Address", GPIO_TAB, IP_RW, 60,
+                     IPS_IDLE);
+    IUFillNumber(&LinkBaudN[0], "LINK_BAUD", "Baud rate", "%6.0f", 9600, 115200, 9600, 38400);
+    IUFillNumberVector(&LinkBaudNP, LinkBaudN, 1, getDeviceName(), "CONTROLLER_BAUD", "Controller Baud", GPIO_TAB, IP_RW,
+                       60, IPS_IDLE);
+    IUFillSwitch(&LinkProtocolS[ControllerLink::PROTO_TEXT], "PROTOCOL_TEXT", "Text", ISS_ON);
+    IUFillSwitch(&LinkProtocolS[ControllerLink::PROTO_BINARY], "PROTOCOL_BINARY", "Binary", ISS_OFF);
+    IUFillSwitchVector(&LinkProtocolSP, LinkProtocolS, 2, getDeviceName(), "CONTROLLER_PROTOCOL", "Controller Protocol",
+                       GPIO_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+    IUFillNumber(&LinkStatusN[LINK_STAT_UP], "LINK_UP", "Answering", "%1.0f", 0, 1, 1, 0);
+    IUFillNumber(&LinkStatusN[LINK_STAT_RECONNECTS], "LINK_RECONNECTS", "Reconnects", "%6.0f", 0, 1e9, 1, 0);
+    IUFillNumber(&LinkStatusN[LINK_STAT_ERRORS], "LINK_ERRORS", "Errors", "%6.0f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&LinkStatusNP, LinkStatusN, 3, getDeviceName(), "CONTROLLER_LINK_STATUS", "Controller Link",
+                       DIAG_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&StepperN[STEP_GPIO], "STEP_GPIO", "Step GPIO", "%2.0f", 0, 27, 1, 0);
+    IUFillNumber(&StepperN[STEP_DIR_GPIO], "STEP_DIR_GPIO", "Direction GPIO", "%2.0f", 0, 27, 1, 0);
+    IUFillNumber(&StepperN[STEP_TRAVEL], "STEP_TRAVEL", "Steps closed to opened", "%8.0f", 1, 1e8, 100, 10000);
+    IUFillNumber(&StepperN[STEP_START_HZ], "STEP_START_HZ", "Start rate steps/s", "%6.0f", 1, 100000, 10, 200);
+    IUFillNumber(&StepperN[STEP_MAX_HZ], "STEP_MAX_HZ", "Maximum rate steps/s", "%6.0f", 1, 100000, 100, 10000);
+    IUFillNumber(&StepperN[STEP_ACCEL], "STEP_ACCEL", "Acceleration steps/s^2", "%7.0f", 1, 1e6, 100, 10000);
+    IUFillNumber(&StepperN[STEP_PULSE_US], "STEP_PULSE_US", "Step pulse us", "%3.0f", 1, 500, 1, 5);
+    IUFillNumberVector(&StepperNP, StepperN, 7, getDeviceName(), "STEPPER", "Stepper", GPIO_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&StepDirS[STEP_DIR_OPEN_HIGH], "STEP_DIR_OPEN_HIGH", "High opens", ISS_ON);
+    IUFillSwitch(&StepDirS[STEP_DIR_OPEN_LOW], "STEP_DIR_OPEN_LOW", "Low opens", ISS_OFF);
+    IUFillSwitchVector(&StepDirSP, StepDirS, 2, getDeviceName(), "STEPPER_DIR", "Drive Direction", GPIO_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&PwmN[PWM_GPIO], "PWM_GPIO", "PWM GPIO", "%2.0f", 0, 27, 1, 18);
+    IUFillNumber(&PwmN[PWM_DIR_GPIO], "PWM_DIR_GPIO", "Direction GPIO", "%2.0f", 0, 27, 1, 0);
+    IUFillNumber(&PwmN[PWM_FREQ], "PWM_FREQ", "Frequency Hz", "%6.0f", 10, 100000, 100, 20000);
+    IUFillNumber(&PwmN[PWM_MAX_DUTY], "PWM_MAX_DUTY", "Running duty %", "%5.1f", 1, 100, 1, 100);
+    IUFillNumber(&PwmN[PWM_CREEP_DUTY], "PWM_CREEP_DUTY", "Approach duty %", "%5.1f", 0, 100, 1, 30);
+    IUFillNumber(&PwmN[PWM_ACCEL_MS], "PWM_ACCEL_MS", "Acceleration ms", "%5.0f", 0, 30000, 100, 2000);
+    IUFillNumber(&PwmN[PWM_DECEL_MS], "PWM_DECEL_MS", "Deceleration ms", "%5.0f", 0, 30000, 100, 1000);
+    IUFillNumberVector(&PwmNP, PwmN, 7, getDeviceName(), "PWM_DRIVE", "PWM Drive", GPIO_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&HeartbeatN[HEARTBEAT_FREQ], "HEARTBEAT_FREQ", "Frequency Hz", "%6.1f", 0.5, 10000, 1, 10);
+    IUFillNumber(&HeartbeatN[HEARTBEAT_DEADLINE], "HEARTBEAT_DEADLINE", "Deadline seconds", "%3.0f", 3, 300, 1, 10);
+    IUFillNumberVector(&HeartbeatNP, HeartbeatN, 2, getDeviceName(), "HEARTBEAT", "Heartbeat", GPIO_TAB, IP_RW, 60,
+                       IPS_IDLE);
+
+    IUFillNumber(&HoldDeadlineN[0], "HOLD_DEADLINE", "Release after seconds, 0 off", "%4.0f", 0, 3600, 10, 0);
+    IUFillNumberVector(&HoldDeadlineNP, HoldDeadlineN, 1, getDeviceName(), "HOLD_DEADMAN", "Held Relay Dead-man", GPIO_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&StepPositionN[0], "STEP_POSITION", "Steps from closed", "%8.0f", -1, 1e8, 1, -1);
+    IUFillNumberVector(&StepPositionNP, StepPositionN, 1, getDeviceName(), "STEP_POSITION", "Stepper Position", DIAG_TAB,
+                       IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&RealtimeS[REALTIME_OFF], "REALTIME_OFF", "Off", ISS_ON);
+    IUFillSwitch(&RealtimeS[REALTIME_ON], "REALTIME_ON", "On", ISS_OFF);
+    IUFillSwitchVector(&RealtimeSP, RealtimeS, 2, getDeviceName(), "REALTIME", "Real-time Timing", OPTIONS_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&ShmS[SHM_OFF], "SHM_OFF", "Off", ISS_ON);
+    IUFillSwitch(&ShmS[SHM_ON], "SHM_ON", "On", ISS_OFF);
+    IUFillSwitchVector(&ShmSP, ShmS, 2, getDeviceName(), "STATUS_SHM", "Shared Memory Status", OPTIONS_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&JsonSocketS[JSON_SOCKET_OFF], "JSON_SOCKET_OFF", "Off", ISS_ON);
+    IUFillSwitch(&JsonSocketS[JSON_SOCKET_ON], "JSON_SOCKET_ON", "On", ISS_OFF);
+    IUFillSwitchVector(&JsonSocketSP, JsonSocketS, 2, getDeviceName(), "JSON_SOCKET", "JSON Socket", OPTIONS_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+    IUFillNumber(&JsonPortN[0], "JSON_TCP_PORT", "Localhost TCP port, 0 off", "%5.0f", 0, 65535, 1, 0);
+    IUFillText(&MetricsT[0], "METRICS_PATH", "Textfile path", "");
+    IUFillTextVector(&MetricsTP, MetricsT, 1, getDeviceName(), "METRICS_FILE", "Prometheus Metrics", OPTIONS_TAB, IP_RW, 60,
+                     IPS_IDLE);
+    IUFillNumberVector(&JsonPortNP, JsonPortN, 1, getDeviceName(), "JSON_TCP", "JSON TCP", OPTIONS_TAB, IP_RW, 60,
+                       IPS_IDLE);
+
+    IUFillNumber(&RealtimeN[REALTIME_PRIORITY], "REALTIME_PRIORITY", "SCHED_FIFO priority", "%2.0f", 1, 99, 1, 50);
+    IUFillNumber(&RealtimeN[REALTIME_CPU], "REALTIME_CPU", "CPU, -1 for any", "%2.0f", -1, 63, 1, -1);
+    IUFillNumberVector(&RealtimeNP, RealtimeN, 2, getDeviceName(), "REALTIME_SETTINGS", "Real-time Timing", OPTIONS_TAB,
+                       IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&TimingStatsN[TIMING_PULSES], "TIMING_PULSES", "Pulses timed", "%8.0f", 0, 1e9, 1, 0);
+    IUFillNumber(&TimingStatsN[TIMING_PULSE_P50], "TIMING_PULSE_P50", "Pulse error median ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingStatsN[TIMING_PULSE_P99], "TIMING_PULSE_P99", "Pulse error 99% ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingStatsN[TIMING_PULSE_MAX], "TIMING_PULSE_MAX", "Pulse error max ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingStatsN[TIMING_WAKE_P50], "TIMING_WAKE_P50", "Sensor latency median ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingStatsN[TIMING_WAKE_P99], "TIMING_WAKE_P99", "Sensor latency 99% ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingStatsN[TIMING_WAKE_MAX], "TIMING_WAKE_MAX", "Sensor latency max ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&TimingStatsNP, TimingStatsN, 7, getDeviceName(), "TIMING_STATS", "Timing", DIAG_TAB, IP_RO, 60,
+                       IPS_IDLE);
+
+    IUFillSwitch(&TimingBenchS[TIMING_BENCHMARK], "TIMING_BENCHMARK", "Benchmark", ISS_OFF);
+    IUFillSwitch(&TimingBenchS[TIMING_RESET], "TIMING_RESET", "Reset", ISS_OFF);
+    IUFillSwitchVector(&TimingBenchSP, TimingBenchS, 2, getDeviceName(), "TIMING_BENCH", "Timing", DIAG_TAB, IP_RW,
+                       ISR_ATMOST1, 60, IPS_IDLE);
+    IUFillNumber(&TimingBenchN[BENCH_WIDTH_P50], "BENCH_WIDTH_P50", "Width error median ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_WIDTH_P99], "BENCH_WIDTH_P99", "Width error 99% ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_WIDTH_MAX], "BENCH_WIDTH_MAX", "Width error max ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_LATENCY_P50], "BENCH_LATENCY_P50", "Edge latency median ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_LATENCY_P99], "BENCH_LATENCY_P99", "Edge latency 99% ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_LATENCY_MAX], "BENCH_LATENCY_MAX", "Edge latency max ms", "%6.2f", 0, 1e6, 0, 0);
+    IUFillNumber(&TimingBenchN[BENCH_MISSED], "BENCH_MISSED", "Missed pulses", "%4.0f", 0, 1e6, 0, 0);
+    IUFillNumberVector(&TimingBenchNP, TimingBenchN, 7, getDeviceName(), "TIMING_BENCH_RESULT", "Timing Benchmark",
+                       DIAG_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&TraceS[TRACE_OFF], "TRACE_OFF", "Off", ISS_ON);
+    IUFillSwitch(&TraceS[TRACE_ON], "TRACE_ON", "On", ISS_OFF);
+    IUFillSwitchVector(&TraceSP, TraceS, 2, getDeviceName(), "TRACE", "Activity Trace", DIAG_TAB, IP_RW, ISR_1OFMANY, 60,
+                       IPS_IDLE);
+    IUFillSwitch(&TraceExportS[0], "TRACE_EXPORT", "Export", ISS_OFF);
+    IUFillSwitchVector(&TraceExportSP, TraceExportS, 1, getDeviceName(), "TRACE_FILE", "Activity Trace", DIAG_TAB, IP_RW,
+                       ISR_ATMOST1, 60, IPS_IDLE);
+
+    IUFillNumber(&LoopbackN[LOOP_OUT_GPIO], "LOOP_OUT_GPIO", "Output GPIO", "%2.0f", 0, 27, 1, 0);
+    IUFillNumber(&LoopbackN[LOOP_IN_GPIO], "LOOP_IN_GPIO", "Loopback input GPIO", "%2.0f", 0, 27, 1, 0);
+    IUFillNumber(&LoopbackN[LOOP_PULSE_MS], "LOOP_PULSE_MS", "Pulse ms", "%4.0f", 1, 2000, 10, 100);
+    IUFillNumber(&LoopbackN[LOOP_COUNT], "LOOP_COUNT", "Pulses per mechanism", "%4.0f", 1, 1000, 10, 50);
+    IUFillNumber(&LoopbackN[LOOP_LOAD], "LOOP_LOAD", "CPU load threads", "%2.0f", 0, 16, 1, 0);
+    IUFillNumberVector(&LoopbackNP, LoopbackN, 5, getDeviceName(), "LOOPBACK", "Loopback Benchmark", DIAG_TAB, IP_RW, 60,
+                       IPS_IDLE);
+
+    IUFillSwitch(&LoopbackS[LOOP_START], "LOOP_START", "Start", ISS_OFF);
+    IUFillSwitch(&LoopbackS[LOOP_CANCEL], "LOOP_CANCEL", "Cancel", ISS_OFF);
+    IUFillSwitchVector(&LoopbackSP, LoopbackS, 2, getDeviceName(), "LOOPBACK_RUN", "Loopback Benchmark", DIAG_TAB, IP_RW,
+                       ISR_ATMOST1, 60, IPS_IDLE);
+
+    const char *mechanisms[LoopbackBenchmark::MECH_COUNT] = { "SLEEP", "TIMER", "WAVE", "SCRIPT" };
+    const char *measures[4] = { "P50", "P99", "MAX", "MISSED" };
+    const char *measureLabels[4] = { "error median ms", "error 99% ms", "error max ms", "missed" };
+    for (int m = 0; m < LoopbackBenchmark::MECH_COUNT; m++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            std::string resultName = std::string("LOOP_") + mechanisms[m] + "_" + measures[k];
+            std::string resultLabel = std::string(mechanisms[m]) + " " + measureLabels[k];
+            IUFillNumber(&LoopResultN[m * 4 + k], resultName.c_str(), resultLabel.c_str(), k == 3 ? "%4.0f" : "%6.2f", 0, 1e6, 0,
+                         0);
+        }
+    }
+    IUFillNumberVector(&LoopResultNP, LoopResultN, LoopbackBenchmark::MECH_COUNT * 4, getDeviceName(), "LOOPBACK_RESULT",
+                       "Loopback Results", DIAG_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&RoofEstimateN[ESTIMATE_POSITION], "ESTIMATE_POSITION", "Open percent", "%5.1f", 0, 100, 1, 50);
+    IUFillNumber(&RoofEstimateN[ESTIMATE_VELOCITY], "ESTIMATE_VELOCITY", "Speed percent/s", "%5.2f", -100, 100, 0, 0);
+    IUFillNumber(&RoofEstimateN[ESTIMATE_SIGMA], "ESTIMATE_SIGMA", "Uncertainty percent", "%5.1f", 0, 100, 0, 29);
+    IUFillNumberVector(&RoofEstimateNP, RoofEstimateN, 3, getDeviceName(), "ROOF_ESTIMATE", "Roof Estimate",
+                       MAIN_CONTROL_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&OutVerifyS[OUT_VERIFY_ENABLE], "OUT_VERIFY_ENABLE", "On", ISS_OFF);
+    IUFillSwitch(&OutVerifyS[OUT_VERIFY_DISABLE], "OUT_VERIFY_DISABLE", "Off", ISS_ON);
+    IUFillSwitchVector(&OutVerifySP, OutVerifyS, 2, getDeviceName(), "OUT_VERIFY", "Verify Outputs", GPIO_TAB, IP_RW,
+                       ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&OutVerifyN[OUT_VERIFY_CHECKS], "OUT_VERIFY_CHECKS", "Output checks", "%8.0f", 0, 1e9, 1, 0);
+    IUFillNumber(&OutVerifyN[OUT_VERIFY_MISMATCHES], "OUT_VERIFY_MISMATCHES", "Output mismatches", "%8.0f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&OutVerifyNP, OutVerifyN, 2, getDeviceName(), "OUT_VERIFY_COUNTS", "Output Readback", DIAG_TAB, IP_RO,
+                       60, IPS_IDLE);
+
     for (int i = 0; i < MAX_OUT_DEFS; i++)
     {
         for (int j = 0; j < MAX_OUT_OPS; j++) {
@@ -208,8 +575,27 @@ bool RollOffIno::Connect()
     }
 // Bypass the actual connection attempt, using GPIO pins instead
 //    status = INDI::Dome::Connect();
+    if (!startLink())
+    {
+        pigpio_stop(pi_id);
+        pi_id = -1;
+        return false;
+    }
     contactEstablished = true;
+    pulseWorker.reset(new PulseWorker(pi_id, trace));
     gpioPinSet();
+    startDrive();
+    startHeartbeat();
+    if (HoldDeadlineN[0].value > 0 && !isSimulation())
+        deadman.reset(new DeadmanRelays(pi_id, std::max(HOLD_DEADLINE_MIN_S, HoldDeadlineN[0].value) * 1000, trace));
+    stopTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (stopTimerFd < 0)
+        LOGF_WARN("Unable to create the stop timer, vent positioning not available: %s", strerror(errno));
+    else
+        stopTimerId = IEAddCallback(stopTimerFd, stopTimerHelper, this);
+    startTimingThreads();
+    openStatusShm();
+    startStatusSocket();
     SetTimer(INITIAL_TIMING);
     return status;
 }
@@ -229,7 +615,46 @@ bool RollOffIno::Handshake()
 ***************************************************************************************/
 bool RollOffIno::Disconnect()
 {
-    pigpio_stop(pi_id);
+    for (int j = 0; j < MAX_RELAY_OPS; j++)
+    {
+        if (relayHeld[j])
+            countRelay(j, false, 0);        // Close out on time, the relay state is unknown once disconnected
+    }
+    if (relayCountsDirty)
+        saveRelayCounts();
+    if (stopTimerId >= 0)
+        IERmCallback(stopTimerId);
+    if (stopTimerFd >= 0)
+        close(stopTimerFd);
+    stopTimerId = -1;
+    stopTimerFd = -1;
+    commands.clear();
+    cancelEdgeCallbacks();
+    positionSensor.reset();
+    if (currentTripId >= 0)
+        IERmCallback(currentTripId);
+    currentTripId = -1;
+    currentSensor.reset();
+    loopbackBench.reset();
+    if (TimingBenchSP.s == IPS_BUSY)
+        TimingBenchSP.s = IPS_IDLE;
+    {
+        std::lock_guard<std::mutex> lock(driveMutex);
+        stepperDrive.reset();
+        pwmDrive.reset();
+    }
+    heartbeat.reset();
+    deadman.reset();
+    statusShm.close();
+    statusSocket.reset();
+    stopLink();
+    pulseWorker.reset();
+    if (RealtimeS[REALTIME_ON].s == ISS_ON)
+        lockMemory(false);
+    if (pi_id >= 0)
+        pigpio_stop(pi_id);
+    pi_id = -1;
+    contactEstablished = false;
     return true;
 }
 
@@ -249,6 +674,60 @@ bool RollOffIno::updateProperties()
         defineProperty(&AuxSP);             // Aux Switch,
         defineProperty(&RoofStatusLP);      // All the roof status lights
         defineProperty(&RoofTimeoutNP);
+        defineProperty(&MotorDutyNP);
+        defineProperty(&DutyStatusNP);
+        defineProperty(&RoofTravelNP);
+        defineProperty(&ReverseDelayNP);
+        defineProperty(&VentNP);
+        defineProperty(&CalibrateSP);
+        defineProperty(&CalibrateNP);
+        defineProperty(&OutVerifySP);
+        defineProperty(&OutVerifyNP);
+        defineProperty(&ControllerSP);
+        defineProperty(&ButtonGapNP);
+        defineProperty(&SensorVoteSP);
+        defineProperty(&InpDisagreeNP);
+        defineProperty(&PosSensorSP);
+        defineProperty(&PosSensorNP);
+        defineProperty(&PosByteOrderSP);
+        if (PosSensorS[POS_SENSOR_OFF].s != ISS_ON)
+            defineProperty(&RoofPositionNP);
+        defineProperty(&RoofEstimateNP);
+        defineProperty(&DriveSP);
+        defineProperty(&LinkSP);
+        defineProperty(&LinkTP);
+        defineProperty(&LinkBaudNP);
+        defineProperty(&LinkProtocolSP);
+        defineProperty(&StepperNP);
+        defineProperty(&StepDirSP);
+        defineProperty(&PwmNP);
+        defineProperty(&HeartbeatNP);
+        defineProperty(&HoldDeadlineNP);
+        if (DriveS[DRIVE_STEPPER].s == ISS_ON)
+            defineProperty(&StepPositionNP);
+        defineProperty(&RealtimeSP);
+        defineProperty(&ShmSP);
+        defineProperty(&JsonSocketSP);
+        defineProperty(&JsonPortNP);
+        defineProperty(&MetricsTP);
+        defineProperty(&RealtimeNP);
+        defineProperty(&TimingStatsNP);
+        if (controllerLink)
+            defineProperty(&LinkStatusNP);
+        defineProperty(&TimingBenchSP);
+        defineProperty(&TimingBenchNP);
+        defineProperty(&TraceSP);
+        defineProperty(&TraceExportSP);
+        defineProperty(&LoopbackNP);
+        defineProperty(&LoopbackSP);
+        defineProperty(&LoopResultNP);
+        defineProperty(&CurSensorSP);
+        defineProperty(&CurSensorNP);
+        defineProperty(&CurTraceSP);
+        if (CurSensorS[CUR_SENSOR_OFF].s != ISS_ON)
+            defineProperty(&MotorCurrentNP);
+        defineProperty(&RelayCyclesNP);
+        defineProperty(&RelayOnTimeNP);
 
         for (int i = 0; i < MAX_OUT_DEFS; i++)
         {
@@ -273,6 +752,56 @@ bool RollOffIno::updateProperties()
         deleteProperty(LockSP.name);        // Delete the Lock Switch buttons
         deleteProperty(AuxSP.name);         // Delete the Auxiliary Switch buttons
         deleteProperty(RoofTimeoutNP.name);
+        deleteProperty(MotorDutyNP.name);
+        deleteProperty(DutyStatusNP.name);
+        deleteProperty(RoofTravelNP.name);
+        deleteProperty(ReverseDelayNP.name);
+        deleteProperty(VentNP.name);
+        deleteProperty(CalibrateSP.name);
+        deleteProperty(CalibrateNP.name);
+        deleteProperty(OutVerifySP.name);
+        deleteProperty(OutVerifyNP.name);
+        deleteProperty(ControllerSP.name);
+        deleteProperty(ButtonGapNP.name);
+        deleteProperty(SensorVoteSP.name);
+        deleteProperty(InpDisagreeNP.name);
+        deleteProperty(PosSensorSP.name);
+        deleteProperty(PosSensorNP.name);
+        deleteProperty(PosByteOrderSP.name);
+        deleteProperty(RoofPositionNP.name);
+        deleteProperty(RoofEstimateNP.name);
+        deleteProperty(DriveSP.name);
+        deleteProperty(LinkSP.name);
+        deleteProperty(LinkTP.name);
+        deleteProperty(LinkBaudNP.name);
+        deleteProperty(LinkProtocolSP.name);
+        deleteProperty(StepperNP.name);
+        deleteProperty(StepDirSP.name);
+        deleteProperty(PwmNP.name);
+        deleteProperty(HeartbeatNP.name);
+        deleteProperty(HoldDeadlineNP.name);
+        deleteProperty(StepPositionNP.name);
+        deleteProperty(RealtimeSP.name);
+        deleteProperty(ShmSP.name);
+        deleteProperty(JsonSocketSP.name);
+        deleteProperty(JsonPortNP.name);
+        deleteProperty(MetricsTP.name);
+        deleteProperty(RealtimeNP.name);
+        deleteProperty(TimingStatsNP.name);
+        deleteProperty(LinkStatusNP.name);
+        deleteProperty(TimingBenchSP.name);
+        deleteProperty(TimingBenchNP.name);
+        deleteProperty(TraceSP.name);
+        deleteProperty(TraceExportSP.name);
+        deleteProperty(LoopbackNP.name);
+        deleteProperty(LoopbackSP.name);
+        deleteProperty(LoopResultNP.name);
+        deleteProperty(CurSensorSP.name);
+        deleteProperty(CurSensorNP.name);
+        deleteProperty(CurTraceSP.name);
+        deleteProperty(MotorCurrentNP.name);
+        deleteProperty(RelayCyclesNP.name);
+        deleteProperty(RelayOnTimeNP.name);
 
         for (int i = 0; i < MAX_OUT_DEFS; i++)
         {
@@ -299,6 +828,35 @@ bool RollOffIno::saveConfigItems(FILE *fp)
 {
     bool status = INDI::Dome::saveConfigItems(fp);
     IUSaveConfigNumber(fp, &RoofTimeoutNP);
+    IUSaveConfigNumber(fp, &MotorDutyNP);
+    IUSaveConfigNumber(fp, &RoofTravelNP);
+    IUSaveConfigNumber(fp, &ReverseDelayNP);
+    IUSaveConfigSwitch(fp, &OutVerifySP);
+    IUSaveConfigSwitch(fp, &ControllerSP);
+    IUSaveConfigSwitch(fp, &SensorVoteSP);
+    IUSaveConfigSwitch(fp, &PosSensorSP);
+    IUSaveConfigNumber(fp, &PosSensorNP);
+    IUSaveConfigSwitch(fp, &PosByteOrderSP);
+    IUSaveConfigSwitch(fp, &DriveSP);
+    IUSaveConfigSwitch(fp, &LinkSP);
+    IUSaveConfigText(fp, &LinkTP);
+    IUSaveConfigNumber(fp, &LinkBaudNP);
+    IUSaveConfigSwitch(fp, &LinkProtocolSP);
+    IUSaveConfigNumber(fp, &StepperNP);
+    IUSaveConfigSwitch(fp, &StepDirSP);
+    IUSaveConfigNumber(fp, &PwmNP);
+    IUSaveConfigNumber(fp, &HeartbeatNP);
+    IUSaveConfigNumber(fp, &HoldDeadlineNP);
+    IUSaveConfigSwitch(fp, &RealtimeSP);
+    IUSaveConfigSwitch(fp, &ShmSP);
+    IUSaveConfigSwitch(fp, &JsonSocketSP);
+    IUSaveConfigNumber(fp, &JsonPortNP);
+    IUSaveConfigText(fp, &MetricsTP);
+    IUSaveConfigNumber(fp, &RealtimeNP);
+    IUSaveConfigSwitch(fp, &CurSensorSP);
+    IUSaveConfigNumber(fp, &CurSensorNP);
+    IUSaveConfigSwitch(fp, &CurTraceSP);
+    IUSaveConfigNumber(fp, &ButtonGapNP);
 
     for (int i = 0; i < MAX_OUT_DEFS; i++)
     {
@@ -333,6 +891,151 @@ bool RollOffIno::ISNewNumber(const char *dev,const char *name,double values[],ch
             return true;
         }
 
+        if (!strcmp(MotorDutyNP.name, name))
+        {
+            IUUpdateNumber(&MotorDutyNP, values, names, n);
+            MotorDutyNP.s = IPS_OK;
+            IDSetNumber(&MotorDutyNP, nullptr);
+            updateMotorDuty();
+            return true;
+        }
+
+        if (!strcmp(RoofTravelNP.name, name))
+        {
+            IUUpdateNumber(&RoofTravelNP, values, names, n);
+            RoofTravelNP.s = IPS_OK;
+            IDSetNumber(&RoofTravelNP, nullptr);
+            return true;
+        }
+
+        if (!strcmp(PosSensorNP.name, name))
+        {
+            IUUpdateNumber(&PosSensorNP, values, names, n);
+            PosSensorNP.s = IPS_OK;
+            IDSetNumber(&PosSensorNP, nullptr);
+            if (isConnected())
+                startPositionSensor();
+            return true;
+        }
+
+        if (!strcmp(StepperNP.name, name) || !strcmp(PwmNP.name, name))
+        {
+            INumberVectorProperty *nvp = !strcmp(StepperNP.name, name) ? &StepperNP : &PwmNP;
+            if (motorRunning)
+            {
+                LOG_WARN("Motor drive settings cannot be changed while the roof is moving");
+                nvp->s = IPS_ALERT;
+                IDSetNumber(nvp, nullptr);
+                return true;
+            }
+            IUUpdateNumber(nvp, values, names, n);
+            nvp->s = IPS_OK;
+            IDSetNumber(nvp, nullptr);
+            if (isConnected())
+                startDrive();
+            return true;
+        }
+
+        if (!strcmp(LinkBaudNP.name, name))
+        {
+            IUUpdateNumber(&LinkBaudNP, values, names, n);
+            LinkBaudNP.s = IPS_OK;
+            IDSetNumber(&LinkBaudNP, nullptr);
+            if (isConnected())
+                LOG_INFO("The controller baud rate will be used from the next connect");
+            return true;
+        }
+
+        if (!strcmp(JsonPortNP.name, name))
+        {
+            IUUpdateNumber(&JsonPortNP, values, names, n);
+            JsonPortNP.s = IPS_OK;
+            IDSetNumber(&JsonPortNP, nullptr);
+            if (isConnected())
+                startStatusSocket();
+            return true;
+        }
+
+        if (!strcmp(HoldDeadlineNP.name, name))
+        {
+            IUUpdateNumber(&HoldDeadlineNP, values, names, n);
+            HoldDeadlineNP.s = IPS_OK;
+            IDSetNumber(&HoldDeadlineNP, nullptr);
+            if (isConnected())
+                LOG_INFO("The held relay dead-man deadline will be used from the next connect");
+            return true;
+        }
+
+        if (!strcmp(HeartbeatNP.name, name))
+        {
+            IUUpdateNumber(&HeartbeatNP, values, names, n);
+            HeartbeatNP.s = IPS_OK;
+            IDSetNumber(&HeartbeatNP, nullptr);
+            if (isConnected())
+                startHeartbeat();
+            return true;
+        }
+
+        if (!strcmp(RealtimeNP.name, name))
+        {
+            IUUpdateNumber(&RealtimeNP, values, names, n);
+            RealtimeNP.s = IPS_OK;
+            IDSetNumber(&RealtimeNP, nullptr);
+            if (isConnected() && RealtimeS[REALTIME_ON].s == ISS_ON)
+                startTimingThreads();
+            return true;
+        }
+
+        if (!strcmp(LoopbackNP.name, name))
+        {
+            IUUpdateNumber(&LoopbackNP, values, names, n);
+            LoopbackNP.s = IPS_OK;
+            IDSetNumber(&LoopbackNP, nullptr);
+            return true;
+        }
+
+        if (!strcmp(CurSensorNP.name, name))
+        {
+            IUUpdateNumber(&CurSensorNP, values, names, n);
+            CurSensorNP.s = IPS_OK;
+            IDSetNumber(&CurSensorNP, nullptr);
+            if (isConnected())
+                startCurrentSensor();
+            return true;
+        }
+
+        if (!strcmp(ReverseDelayNP.name, name))
+        {
+            IUUpdateNumber(&ReverseDelayNP, values, names, n);
+            ReverseDelayNP.s = IPS_OK;
+            IDSetNumber(&ReverseDelayNP, nullptr);
+            return true;
+        }
+
+        if (!strcmp(ButtonGapNP.name, name))
+        {
+            IUUpdateNumber(&ButtonGapNP, values, names, n);
+            ButtonGapNP.s = IPS_OK;
+            IDSetNumber(&ButtonGapNP, nullptr);
+            return true;
+        }
+
+        if (!strcmp(CalibrateNP.name, name))
+        {
+            IUUpdateNumber(&CalibrateNP, values, names, n);
+            CalibrateNP.s = IPS_OK;
+            IDSetNumber(&CalibrateNP, nullptr);
+            return true;
+        }
+
+        if (!strcmp(VentNP.name, name))
+        {
+            IUUpdateNumber(&VentNP, values, names, n);
+            VentNP.s = ventOpen(VentN[0].value) ? IPS_BUSY : IPS_ALERT;
+            IDSetNumber(&VentNP, nullptr);
+            return true;
+        }
+
         // Look for GPIO definition numbers
         for (int i=0; i < MAX_OUT_DEFS; i++)
         {
@@ -343,21 +1046,49 @@ bool RollOffIno::ISNewNumber(const char *dev,const char *name,double values[],ch
                 IDSetNumber(&outPinNumberNP[i], nullptr);
                 return true;
             }
-            else
+        }
+        for (int i=0; i < MAX_INP_DEFS; i++)
+        {
+            if (!strcmp(name, inpPinNumberNP[i].name))
             {
-                if (!strcmp(name, inpPinNumberNP[i].name))
-                {
-                    IUUpdateNumber(&inpPinNumberNP[i], values, names, n);
-                    inpPinNumberNP[i].s = IPS_OK;
-                    IDSetNumber(&inpPinNumberNP[i], nullptr);
-                    return true;
-                }
+                IUUpdateNumber(&inpPinNumberNP[i], values, names, n);
+                inpPinNumberNP[i].s = IPS_OK;
+                IDSetNumber(&inpPinNumberNP[i], nullptr);
+                buildInputMasks();
+                return true;
             }
         }
     }
     return INDI::Dome::ISNewNumber(dev,name,values,names,n);
 }
 
+bool RollOffIno::ISNewText(const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0)
+    {
+        if (!strcmp(LinkTP.name, name))
+        {
+            IUUpdateText(&LinkTP, texts, names, n);
+            LinkTP.s = IPS_OK;
+            IDSetText(&LinkTP, nullptr);
+            if (isConnected())
+                LOG_INFO("The controller address will be used from the next connect");
+            return true;
+        }
+
+        if (!strcmp(MetricsTP.name, name))
+        {
+            IUUpdateText(&MetricsTP, texts, names, n);
+            MetricsTP.s = IPS_OK;
+            IDSetText(&MetricsTP, nullptr);
+            metricsFailed = false;
+            metricsWritten = { 0, 0 };
+            return true;
+        }
+    }
+    return INDI::Dome::ISNewText(dev, name, texts, names, n);
+}
+
 /********************************************************************************************
  * Called by infrastructure when switch property modified
  * IDset* informs Client of the change
@@ -368,6 +1099,10 @@ bool RollOffIno::ISNewSwitch(const char *dev, const char *name, ISState *states,
     // Make sure the call is for our device
     if(dev != nullptr && strcmp(dev, getDeviceName()) == 0)
     {
+        // Requests that would collide with a roof movement wait for it to finish
+        if (queueRequest(name, states, names, n))
+            return true;
+
         // Check if the call for our Lock switch
         if (strcmp(name, LockSP.name) == 0)
         {
@@ -424,6 +1159,242 @@ bool RollOffIno::ISNewSwitch(const char *dev, const char *name, ISState *states,
             return true;
         }
 
+        if (strcmp(name, CalibrateSP.name) == 0)
+        {
+            IUUpdateSwitch(&CalibrateSP, states, names, n);
+            if (CalibrateS[CALIBRATE_START].s == ISS_ON)
+            {
+                if (!calibrationStart((int)CalibrateN[0].value))
+                {
+                    IUResetSwitch(&CalibrateSP);
+                    CalibrateSP.s = IPS_ALERT;
+                    IDSetSwitch(&CalibrateSP, nullptr);
+                }
+            }
+            else if (calState != CAL_IDLE)
+            {
+                Abort();
+                calibrationEnd(false, "cancelled");
+            }
+            return true;
+        }
+
+        if (strcmp(name, ControllerSP.name) == 0)
+        {
+            IUUpdateSwitch(&ControllerSP, states, names, n);
+            ControllerSP.s = IPS_OK;
+            IDSetSwitch(&ControllerSP, nullptr);
+            buttonState = BUTTON_UNKNOWN;
+            return true;
+        }
+
+        if (strcmp(name, PosSensorSP.name) == 0 || strcmp(name, PosByteOrderSP.name) == 0)
+        {
+            ISwitchVectorProperty *svp = (strcmp(name, PosSensorSP.name) == 0) ? &PosSensorSP : &PosByteOrderSP;
+            IUUpdateSwitch(svp, states, names, n);
+            svp->s = IPS_OK;
+            IDSetSwitch(svp, nullptr);
+            if (isConnected())
+            {
+                startPositionSensor();
+                if (PosSensorS[POS_SENSOR_OFF].s == ISS_ON)
+                    deleteProperty(RoofPositionNP.name);
+                else
+                    defineProperty(&RoofPositionNP);
+            }
+            return true;
+        }
+
+        if (strcmp(name, DriveSP.name) == 0 || strcmp(name, StepDirSP.name) == 0)
+        {
+            ISwitchVectorProperty *svp = (strcmp(name, DriveSP.name) == 0) ? &DriveSP : &StepDirSP;
+            if (motorRunning)
+            {
+                LOG_WARN("The motor drive cannot be changed while the roof is moving");
+                svp->s = IPS_ALERT;
+                IDSetSwitch(svp, nullptr);
+                return true;
+            }
+            IUUpdateSwitch(svp, states, names, n);
+            svp->s = IPS_OK;
+            IDSetSwitch(svp, nullptr);
+            if (isConnected())
+            {
+                startDrive();
+                if (DriveS[DRIVE_STEPPER].s == ISS_ON)
+                    defineProperty(&StepPositionNP);
+                else
+                    deleteProperty(StepPositionNP.name);
+            }
+            return true;
+        }
+
+        if (strcmp(name, RealtimeSP.name) == 0)
+        {
+            IUUpdateSwitch(&RealtimeSP, states, names, n);
+            RealtimeSP.s = IPS_OK;
+            if (isConnected())
+            {
+                if (RealtimeS[REALTIME_OFF].s == ISS_ON)
+                    lockMemory(false);
+                startTimingThreads();
+            }
+            IDSetSwitch(&RealtimeSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, ShmSP.name) == 0)
+        {
+            IUUpdateSwitch(&ShmSP, states, names, n);
+            ShmSP.s = IPS_OK;
+            if (isConnected())
+                openStatusShm();
+            IDSetSwitch(&ShmSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, LinkSP.name) == 0)
+        {
+            IUUpdateSwitch(&LinkSP, states, names, n);
+            LinkSP.s = IPS_OK;
+            IDSetSwitch(&LinkSP, nullptr);
+            if (isConnected())
+                LOG_INFO("The controller link will be used from the next connect");
+            return true;
+        }
+
+        if (strcmp(name, LinkProtocolSP.name) == 0)
+        {
+            IUUpdateSwitch(&LinkProtocolSP, states, names, n);
+            LinkProtocolSP.s = IPS_OK;
+            IDSetSwitch(&LinkProtocolSP, nullptr);
+            if (isConnected())
+                LOG_INFO("The controller protocol will be used from the next connect");
+            return true;
+        }
+
+        if (strcmp(name, JsonSocketSP.name) == 0)
+        {
+            IUUpdateSwitch(&JsonSocketSP, states, names, n);
+            JsonSocketSP.s = IPS_OK;
+            if (isConnected())
+                startStatusSocket();
+            IDSetSwitch(&JsonSocketSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, TraceSP.name) == 0)
+        {
+            IUUpdateSwitch(&TraceSP, states, names, n);
+            trace.enable(TraceS[TRACE_ON].s == ISS_ON);
+            TraceSP.s = trace.enabled() ? IPS_BUSY : IPS_IDLE;
+            IDSetSwitch(&TraceSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, TraceExportSP.name) == 0)
+        {
+            IUUpdateSwitch(&TraceExportSP, states, names, n);
+            IUResetSwitch(&TraceExportSP);
+            std::string path = deviceFile("_trace.json");
+            if (trace.writeJson(path.c_str()))
+            {
+                LOGF_INFO("Activity trace of %u spans written to %s", trace.recorded(), path.c_str());
+                TraceExportSP.s = IPS_OK;
+            }
+            else
+            {
+                LOGF_WARN("Unable to write the activity trace to %s: %s", path.c_str(), strerror(errno));
+                TraceExportSP.s = IPS_ALERT;
+            }
+            IDSetSwitch(&TraceExportSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, TimingBenchSP.name) == 0)
+        {
+            IUUpdateSwitch(&TimingBenchSP, states, names, n);
+            bool benchmark = (TimingBenchS[TIMING_BENCHMARK].s == ISS_ON);
+            IUResetSwitch(&TimingBenchSP);
+            if (!pulseWorker)
+                TimingBenchSP.s = IPS_ALERT;
+            else if (!pulseWorker->benchmarkFinished())
+                LOG_WARN("Timing benchmark already running");
+            else if (benchmark)
+                TimingBenchSP.s = timingBenchStart() ? IPS_BUSY : IPS_ALERT;
+            else
+            {
+                pulseWorker->widthError.reset();
+                if (positionSensor)
+                    positionSensor->wakeLatency.reset();
+                if (currentSensor)
+                    currentSensor->wakeLatency.reset();
+                updateTimingStats(true);
+                TimingBenchSP.s = IPS_OK;
+            }
+            IDSetSwitch(&TimingBenchSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, LoopbackSP.name) == 0)
+        {
+            IUUpdateSwitch(&LoopbackSP, states, names, n);
+            bool start = (LoopbackS[LOOP_START].s == ISS_ON);
+            IUResetSwitch(&LoopbackSP);
+            if (start)
+                LoopbackSP.s = loopbackStart() ? IPS_BUSY : IPS_ALERT;
+            else
+            {
+                if (loopbackBench)
+                    loopbackBench->cancel();
+                loopbackCheck();
+                LoopbackSP.s = IPS_IDLE;
+            }
+            IDSetSwitch(&LoopbackSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, CurSensorSP.name) == 0)
+        {
+            IUUpdateSwitch(&CurSensorSP, states, names, n);
+            CurSensorSP.s = IPS_OK;
+            IDSetSwitch(&CurSensorSP, nullptr);
+            if (isConnected())
+            {
+                startCurrentSensor();
+                if (CurSensorS[CUR_SENSOR_OFF].s == ISS_ON)
+                    deleteProperty(MotorCurrentNP.name);
+                else
+                    defineProperty(&MotorCurrentNP);
+            }
+            return true;
+        }
+
+        if (strcmp(name, CurTraceSP.name) == 0)
+        {
+            IUUpdateSwitch(&CurTraceSP, states, names, n);
+            CurTraceSP.s = IPS_OK;
+            IDSetSwitch(&CurTraceSP, nullptr);
+            return true;
+        }
+
+        if (strcmp(name, SensorVoteSP.name) == 0)
+        {
+            IUUpdateSwitch(&SensorVoteSP, states, names, n);
+            SensorVoteSP.s = IPS_OK;
+            IDSetSwitch(&SensorVoteSP, nullptr);
+            return true;
+        }
+
+        // Enable or disable output readback verification
+        if (strcmp(name, OutVerifySP.name) == 0)
+        {
+            IUUpdateSwitch(&OutVerifySP, states, names, n);
+            OutVerifySP.s = IPS_OK;
+            IDSetSwitch(&OutVerifySP, nullptr);
+            return true;
+        }
+
         // Look if GPIO definition relay
         for (int i=0; i < MAX_OUT_DEFS; i++)
         {
@@ -458,6 +1429,7 @@ bool RollOffIno::ISNewSwitch(const char *dev, const char *name, ISState *states,
                 IUUpdateSwitch(&inpFunctionSP[i], states, names, n);
                 inpFunctionSP[i].s = IPS_OK;
                 IDSetSwitch(&inpFunctionSP[i], nullptr);
+                buildInputMasks();
                 return true;
             }
             else if (!strcmp(name, inpActivateWhenSP[i].name))
@@ -465,6 +1437,7 @@ bool RollOffIno::ISNewSwitch(const char *dev, const char *name, ISState *states,
                 IUUpdateSwitch(&inpActivateWhenSP[i], states, names, n);
                 inpActivateWhenSP[i].s = IPS_OK;
                 IDSetSwitch(&inpActivateWhenSP[i], nullptr);
+                buildInputMasks();
                 return true;
             }
         }
@@ -478,6 +1451,7 @@ bool RollOffIno::ISNewSwitch(const char *dev, const char *name, ISState *states,
 void RollOffIno::gpioPinSet()
 {
     int required = 0;
+    int requiredInputs = 0;
     unsigned int gpio;
     int err;
     int pud;
@@ -486,6 +1460,11 @@ void RollOffIno::gpioPinSet()
     const char* sTime = "";
 
     LOG_DEBUG("Summary of GPIO pins defined: ");
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        outExpectedLevel[i] = -1;
+        outMismatch[i] = false;
+    }
     for (int i = 0; i < MAX_OUT_DEFS; i++)                 // definition 1, 2, ..
     {
         for (int j = 0; j < MAX_OUT_OPS; j++)              // Open, Close, . .
@@ -495,6 +1474,8 @@ void RollOffIno::gpioPinSet()
                 continue;
 
             gpio = outPinNumberN[i][0].value;
+            // Mode, resistor and initial level of the pin
+            TraceSpan span(trace, "set_mode", outFunctionS[i][j].name);
             if (((strcmp(outFunctionS[i][j].name, outOps[0]) == 0) ||
                  (strcmp(outFunctionS[i][j].name, outOps[1]) == 0)) && gpio > 2)
                 required++;
@@ -541,6 +1522,8 @@ void RollOffIno::gpioPinSet()
             }
             if (err != 0)
                 LOGF_WARN("GPIO write failed for %s, %d, returned: %s", outFunctionS[i][j].name, gpio, pigpio_error(err));
+            else if (strcmp(outFunctionS[i][j].name, ROOF_HEARTBEAT_OUT) != 0)     // A heartbeat has no steady level
+                outExpectedLevel[i] = (strcmp(sActivate, "High") == 0) ? 0 : 1;
 
             // Summarize the settings for this function
             LOGF_DEBUG("Position %s, Function %s, Pin %d, Mode Output, Activate %s, Resistor off, Timed %s",
@@ -557,9 +1540,13 @@ void RollOffIno::gpioPinSet()
                 continue;
 
             gpio = inpPinNumberN[i][0].value;
+            TraceSpan span(trace, "set_mode", inpFunctionS[i][j].name);
             if (((strcmp(inpFunctionS[i][j].name, inpOps[0]) == 0) ||
                  (strcmp(inpFunctionS[i][j].name, inpOps[1]) == 0)) && gpio > 2)
+            {
                 required++;
+                requiredInputs++;
+            }
 
              if ((err = set_mode(pi_id, gpio, PI_INPUT)) != 0)
             {
@@ -593,13 +1580,30 @@ void RollOffIno::gpioPinSet()
         }   // End opened, closed. . .
     }       // End definition 1, 2, . .
 
-    // Minimal is open, close, opened, closed
-    if (required < 4)
-        LOG_ERROR("The GPIO definitions must include relays OPEN, CLOSE, and switches OPENED, CLOSED");
-    return;
-}
+    buildInputMasks();
+    setEdgeCallbacks();
 
-/********************************************************************************************
+    // A linked controller needs no GPIO pins at all
+    if (controllerLink)
+        return;
+
+    // Minimal is open, close, opened, closed. A single button controller only uses OPEN, a stepper no relays.
+    if (DriveS[DRIVE_RELAYS].s != ISS_ON)
+    {
+        if (requiredInputs < 2)
+            LOG_ERROR("The GPIO definitions must include switches OPENED, CLOSED");
+    }
+    else if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+    {
+        if (required < 3)
+            LOG_ERROR("The GPIO definitions must include relay OPEN, and switches OPENED, CLOSED");
+    }
+    else if (required < 4)
+        LOG_ERROR("The GPIO definitions must include relays OPEN, CLOSE, and switches OPENED, CLOSED");
+    return;
+}
+
+/********************************************************************************************
 ** Establish conditions on a connect.
 *********************************************************************************************/
 bool RollOffIno::setupConditions()
@@ -725,16 +1729,26 @@ bool RollOffIno::setupConditions()
 
 void RollOffIno::updateRoofStatus()
 {
+    TraceSpan span(trace, "updateRoofStatus");
     bool auxiliaryState = false;
     bool lockedState = false;
     bool openedState = false;
     bool closedState = false;
+    bool wasOpened = (fullyOpenedLimitSwitch == ISS_ON);
+    bool wasClosed = (fullyClosedLimitSwitch == ISS_ON);
+    if (!isSimulation() && contactEstablished)
+        readGpioSnapshot();             // One bank read serves all the switch reads below
     getFullOpenedLimitSwitch(&openedState);
     getFullClosedLimitSwitch(&closedState);
     getRoofLockedSwitch(&lockedState);
     getRoofAuxSwitch(&auxiliaryState);
+    if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+        singleButtonEdges(wasOpened, wasClosed, openedState, closedState);
 
-    if (!openedState && !closedState && !roofOpening && !roofClosing)
+    if (openedState || closedState)
+        roofVented = false;
+
+    if (!openedState && !closedState && !roofOpening && !roofClosing && !roofVented)
     {
         if (limitMsg <= 10)
         {
@@ -746,6 +1760,8 @@ void RollOffIno::updateRoofStatus()
             limitMsg++;
             LOG_ERROR ("Roof stationary, not opened or closed. Will stop reporting this error.");
         }
+        else
+            metrics.add(DriverMetrics::SUPPRESSED_LOG);
     }
     else
         limitMsg = 0;
@@ -817,6 +1833,13 @@ void RollOffIno::updateRoofStatus()
             RoofStatusLP.s = IPS_BUSY;
         }
 
+        // Roof deliberately stopped part open
+        else if (roofVented)
+        {
+            RoofStatusL[ROOF_STATUS_OPENED].s = IPS_BUSY;
+            RoofStatusLP.s = IPS_OK;
+        }
+
         // Roof is stationary, neither opened or closed
         else
         {
@@ -837,8 +1860,11 @@ void RollOffIno::TimerHit()
 {
     double timeleft = CalcTimeLeft(MotionStart);
     uint32_t delay = INACTIVE_TIMING;   // inactive timer setting to maintain roof status lights
+    struct timespec tickStart, tickEnd;
     if (!isConnected())
         return; //  No need to reset timer if we are not connected anymore
+    TraceSpan span(trace, "TimerHit");
+    clock_gettime(CLOCK_MONOTONIC, &tickStart);
 
     if (isSimulation())
     {
@@ -857,7 +1883,15 @@ void RollOffIno::TimerHit()
         }
     }
 
+    if (controllerLink)
+        updateLink();
     updateRoofStatus();
+    driveCheck();
+    if (motorRunning && !roofOpening && !roofClosing)
+        motorStopped();
+    updateMotorDuty();
+    if (calState != CAL_IDLE)
+        calibrationStep();
 
     if (DomeMotionSP.s == IPS_BUSY)
     {
@@ -881,9 +1915,13 @@ void RollOffIno::TimerHit()
                 else if (timeleft <= 0)
                 {
                     LOG_WARN("Time allowed for opening the roof has expired?");
+                    metrics.add(DriverMetrics::MOVE_TIMEOUTS);
                     setDomeState(DOME_IDLE);
                     roofOpening = false;
                     roofTimedOut = EXPIRED_OPEN;
+                    // A close waiting for the open runs once the drive has stopped
+                    if (commands.pending(CommandQueue::MOTION) && stopAvailable())
+                        roofAbort();
                 }
                 else
                 {
@@ -902,6 +1940,7 @@ void RollOffIno::TimerHit()
                 else if (timeleft <= 0)
                 {
                     LOG_WARN("Time allowed for closing the roof has expired?");
+                    metrics.add(DriverMetrics::MOVE_TIMEOUTS);
                     setDomeState(DOME_IDLE);
                     roofClosing = false;
                     roofTimedOut = EXPIRED_CLOSE;
@@ -914,8 +1953,17 @@ void RollOffIno::TimerHit()
         }
     }
 
-    // Added to highlight WiFi issues, not able to recover lost connection without a reconnect
-    if (communicationErrors > MAX_CNTRL_COM_ERR)
+    // Poll faster around the time the travel model expects the limit switch to be reached
+    if (delay == ACTIVE_POLL_MS && motorRunning && RoofTravelN[motorDir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE].value > 0)
+    {
+        double remaining = expectedRunTime(motorDir) - msElapsed(motorStart) / 1000.0;
+        if (remaining < 2.0 * ACTIVE_POLL_MS / 1000 && remaining > -2.0)
+            delay = FAST_POLL_MS;
+    }
+
+    // Added to highlight WiFi issues, not able to recover lost connection without a reconnect. A controller
+    // link drops and reopens itself instead.
+    if (communicationErrors > MAX_CNTRL_COM_ERR && !controllerLink)
     {
         LOG_ERROR("Too many errors communicating with Arduino");
         LOG_ERROR("Try a fresh connect. Check communication equipment and operation of Arduino controller.");
@@ -924,10 +1972,43 @@ void RollOffIno::TimerHit()
         communicationErrors = 0;
     }
 
+    updatePosition();
+    updateEstimate();
+    publishStatus();
+    updateCurrent();
+    updateTimingStats(false);
+    loopbackCheck();
+    timingBenchCheck();
+    if (inpDisagreeChanged)
+    {
+        inpDisagreeChanged = false;
+        IDSetNumber(&InpDisagreeNP, nullptr);
+    }
+    if (relayCountsChanged)
+    {
+        relayCountsChanged = false;
+        IDSetNumber(&RelayCyclesNP, nullptr);
+        IDSetNumber(&RelayOnTimeNP, nullptr);
+    }
+    if (relayCountsDirty && msElapsed(relayCountsSaved) > RELAY_COUNT_SAVE_S * 1000L)
+        saveRelayCounts();
+    renewHeartbeat();
+    renewHeldRelays();
+    // Replies are back before the next pass reads the switches
+    if (controllerLink)
+        controllerLink->requestStatus();
+
     // Even when no roof movement requested, will come through occasionally. Use timer to update roof status
     // in case roof has been operated externally by a remote control, locks applied...
-    gettimeofday(&MotionStart, nullptr);
-    SetTimer(delay);
+    // MotionStart is left alone while moving so that the roof timeout can expire.
+    if (DomeMotionSP.s != IPS_BUSY)
+        gettimeofday(&MotionStart, nullptr);
+    clock_gettime(CLOCK_MONOTONIC, &tickEnd);
+    metrics.observeTick(elapsedMicros(tickStart, tickEnd));
+    writeMetrics();
+    // A move started from the queue sets its own timer
+    if (!runQueuedCommand())
+        SetTimer(delay);
 }
 
 float RollOffIno::CalcTimeLeft(timeval start)
@@ -947,6 +2028,13 @@ float RollOffIno::CalcTimeLeft(timeval start)
     return timeleft;
 }
 
+long RollOffIno::msElapsed(const timeval &start)
+{
+    struct timeval now { 0, 0 };
+    gettimeofday(&now, nullptr);
+    return (now.tv_sec - start.tv_sec) * 1000L + (now.tv_usec - start.tv_usec) / 1000L;
+}
+
 void RollOffIno::msSleep (int mSec)
 {
     struct timespec req = {0,0};
@@ -956,545 +2044,2762 @@ void RollOffIno::msSleep (int mSec)
 }
 
 /*
- * Direction: DOME_CW Clockwise = Open; DOME-CCW Counter clockwise = Close
- * Operation: MOTION_START, | MOTION_STOP
+ * Motor duty limiting. Heat is modelled as seconds of run time that decay exponentially with the cooling
+ * time constant. An open is refused when the heat now plus the expected run time would exceed the budget.
  */
-IPState RollOffIno::Move(DomeDirection dir, DomeMotionCommand operation)
+double RollOffIno::motorHeat()
 {
-    LOG_DEBUG("Roof received dome motion directive.");
-
-    updateRoofStatus();
-    if (operation == MOTION_START)
-    {
-        if (roofLockedSwitch)
-        {
-            LOG_WARN("Roof is externally locked, no movement possible");
-            return IPS_ALERT;
-        }
-        if (roofOpening)
-        {
-            LOG_DEBUG("Roof is in process of opening, wait for completion.");
-            return IPS_OK;
-        }
-        if (roofClosing)
-        {
-            LOG_DEBUG("Roof is in process of closing, wait for completion.");
-            return IPS_OK;
-        }
+    double tau = MotorDutyN[DUTY_COOLING].value * 60;
+    double heat = dutyHeat * exp(-msElapsed(dutyHeatTime) / 1000.0 / tau);
+    if (motorRunning)
+        heat += msElapsed(motorStart) / 1000.0;
+    return heat;
+}
 
-        // Open Roof
-        // DOME_CW --> OPEN. If we are asked to "open" while we are fully opened as the
-        // limit switch indicates, then we simply return false.
-        if (dir == DOME_CW)
-        {
-            if (fullyOpenedLimitSwitch == ISS_ON)
-            {
-                LOG_WARN("DOME_CW directive received but roof is already fully opened");
-                SetParked(false);
-                return IPS_ALERT;
-            }
+double RollOffIno::expectedRunTime(DomeDirection dir)
+{
+    double travel = RoofTravelN[dir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE].value;
+    if (travel > 0)
+        return travel;
+    return RoofTimeoutN[0].value;
+}
 
+bool RollOffIno::dutyAllowsMove(DomeDirection dir)
+{
+    double budget = MotorDutyN[DUTY_BUDGET].value;
+    if (budget <= 0)
+        return true;
+    return motorHeat() + expectedRunTime(dir) <= budget;
+}
 
-            // Initiate action
-            if (roofOpen())
-            {
-                roofOpening = true;
-                roofClosing = false;
-                LOG_INFO("Roof is opening...");
-            }
-            else
-            {
-                LOG_WARN("Failed to operate controller to open roof");
-                return IPS_ALERT;
-            }
-        }
+void RollOffIno::motorStarted(DomeDirection dir)
+{
+    updateEstimate();
+    dutyHeat = motorHeat();
+    gettimeofday(&dutyHeatTime, nullptr);
+    gettimeofday(&motorStart, nullptr);
+    motorDir = dir;
+    motorRunning = true;
+    metrics.add(dir == DOME_CW ? DriverMetrics::MOVES_OPEN : DriverMetrics::MOVES_CLOSE);
+    if (currentSensor)
+        currentSensor->arm(true);
+    publishStatus();
+}
 
-        // Close Roof
-        else if (dir == DOME_CCW)
+void RollOffIno::motorStopped()
+{
+    if (!motorRunning)
+        return;
+    updateEstimate();
+    double run = msElapsed(motorStart) / 1000.0;
+    dutyHeat = motorHeat();
+    gettimeofday(&dutyHeatTime, nullptr);
+    gettimeofday(&motorStopTime, nullptr);
+    motorRunning = false;
+    limitStopMask.store(0);
+    if (currentSensor)
+    {
+        currentSensor->arm(false);
+        MotorCurrentN[CURRENT_PEAK].value = currentSensor->peak();
+        MotorCurrentN[CURRENT_MEAN].value = currentSensor->mean();
+        IDSetNumber(&MotorCurrentNP, nullptr);
+        if (CurTraceS[CUR_TRACE_SAVE].s == ISS_ON)
         {
-            if (fullyClosedLimitSwitch == ISS_ON)
-            {
-                SetParked(true);
-                LOG_WARN("DOME_CCW directive received but roof is already fully closed");
-                return IPS_ALERT;
-            }
-            else if (INDI::Dome::isLocked())
-            {
-                DEBUG(INDI::Logger::DBG_WARNING,
-                      "Cannot close dome when mount is locking. See: Telescope parkng policy, in options tab");
-                return IPS_ALERT;
-            }
-            // Initiate action
-            if (roofClose())
-            {
-                roofClosing = true;
-                roofOpening = false;
-                LOG_INFO("Roof is closing...");
-            }
-            else
-            {
-                LOG_WARN("Failed to operate controller to close roof");
-                return IPS_ALERT;
-            }
+            std::string path = deviceFile("_current.csv");
+            if (!currentSensor->writeTrace(path.c_str()))
+                LOGF_DEBUG("Unable to write the motor current trace to %s", path.c_str());
         }
-        roofTimedOut = EXPIRED_CLEAR;
-        MotionRequest = (int)RoofTimeoutN[0].value;
-        LOGF_DEBUG("Roof motion timeout setting: %d", (int)MotionRequest);
-        gettimeofday(&MotionStart, nullptr);
-        SetTimer(INACTIVE_TIMING);
-        return IPS_BUSY;
     }
-    return    IPS_ALERT;
-}
-
-/*
- * Close Roof
- *
- */
-IPState RollOffIno::Park()
-{
-    IPState rc = INDI::Dome::Move(DOME_CCW, MOTION_START);
 
-    if (rc == IPS_BUSY)
+    // Only a run that ended on the limit switch for its direction is a complete travel. The status
+    // poll sees the switch up to one tick late so the model is refined gradually rather than replaced.
+    if ((motorDir == DOME_CW && fullyOpenedLimitSwitch == ISS_ON) ||
+        (motorDir == DOME_CCW && fullyClosedLimitSwitch == ISS_ON))
     {
-        LOG_INFO("RollOff ino is parking...");
-        return IPS_BUSY;
+        INumber *travel = &RoofTravelN[motorDir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE];
+        if (travel->value <= 0)
+            travel->value = run;
+        else
+            travel->value += TRAVEL_LEARN_RATE * (run - travel->value);
+        IDSetNumber(&RoofTravelNP, nullptr);
     }
-    else
-        return IPS_ALERT;
+    LOGF_DEBUG("Motor ran %.1f seconds, heat now %.0f seconds", run, dutyHeat);
+    publishStatus();
 }
 
-/*
- * Open Roof
- *
- */
-IPState RollOffIno::UnPark()
+void RollOffIno::updateMotorDuty()
 {
-    IPState rc = INDI::Dome::Move(DOME_CW, MOTION_START);
-    if (rc == IPS_BUSY)
-    {
-        LOG_INFO("RollOff ino is unparking...");
-        return IPS_BUSY;
-    }
-    else
-        return IPS_ALERT;
+    double budget = MotorDutyN[DUTY_BUDGET].value;
+    double heat = motorHeat();
+    double wait = 0;
+    double remaining = budget > heat ? budget - heat : 0;
+    double need = budget - expectedRunTime(DOME_CW);
+
+    if (budget > 0 && heat > need)
+        wait = (need > 0) ? MotorDutyN[DUTY_COOLING].value * 60 * log(heat / need) : -1;
+
+    if (std::lround(remaining) == std::lround(DutyStatusN[DUTY_REMAINING].value) &&
+        std::lround(heat) == std::lround(DutyStatusN[DUTY_HEAT].value) &&
+        std::lround(wait) == std::lround(DutyStatusN[DUTY_WAIT].value))
+        return;
+    DutyStatusN[DUTY_REMAINING].value = remaining;
+    DutyStatusN[DUTY_HEAT].value = heat;
+    DutyStatusN[DUTY_WAIT].value = wait;
+    // Busy while cooling is needed, alert when the budget can never cover a full open
+    DutyStatusNP.s = (wait < 0) ? IPS_ALERT : (wait > 0 ? IPS_BUSY : IPS_OK);
+    IDSetNumber(&DutyStatusNP, nullptr);
 }
 
 /*
- * Abort motion
+ * Vent mode. Open from closed and stop part way by pulsing ABORT at the time the travel model gives for the
+ * requested opening. The stop is timed by a monotonic one-shot timerfd in the INDI event loop so it does not
+ * depend on the status polling tick.
  */
-bool RollOffIno::Abort()
+bool RollOffIno::ventOpen(double percent)
 {
-    bool lockState;
-    bool openState;
-    bool closeState;
-
-    updateRoofStatus();
-    lockState = (roofLockedSwitch == ISS_ON);
-    openState = (fullyOpenedLimitSwitch == ISS_ON);
-    closeState = (fullyClosedLimitSwitch == ISS_ON);
+    double travel = RoofTravelN[TRAVEL_OPEN].value;
+    double start = RoofTravelN[TRAVEL_START].value;
 
-    if (lockState)
+    if (stopTimerFd < 0)
     {
-        LOG_WARN("Roof is externally locked, no action taken on abort request");
-        return true;
+        LOG_WARN("Vent not available, the stop timer could not be created");
+        return false;
     }
-
-    if (closeState && DomeMotionSP.s != IPS_BUSY)
+    if (!stopAvailable())
     {
-        LOG_WARN("Roof appears to be closed and stationary, no action taken on abort request");
-        return true;
+        LOG_WARN("Vent needs an ABORT relay to stop the roof part way");
+        return false;
     }
-    else if (openState && DomeMotionSP.s != IPS_BUSY)
+    if (travel <= start)
     {
-        LOG_WARN("Roof appears to be open and stationary, no action taken on abort request");
-        return true;
+        LOG_WARN("Vent needs the open travel time. Open and close the roof once to learn it, or enter it in Options");
+        return false;
     }
-    else if (DomeMotionSP.s != IPS_BUSY)
+    updateRoofStatus();
+    if (fullyClosedLimitSwitch != ISS_ON || roofOpening || roofClosing)
     {
-        LOG_WARN("Roof appears to be partially open and stationary, no action taken on abort request");
+        LOG_WARN("Vent can only be started with the roof closed and stationary");
+        return false;
     }
-    else if (DomeMotionSP.s == IPS_BUSY)
+    if (INDI::Dome::Move(DOME_CW, MOTION_START) != IPS_BUSY)
+        return false;
+    // The stop timer is still pressing the button, so the open has not started
+    if (timerAction == TIMER_BUTTON)
     {
-        if (DomeMotionS[DOME_CW].s == ISS_ON)
-        {
-            LOG_WARN("Abort roof action requested while the roof was opening. Direction correction may be needed on the next move request.");
-        }
-        else if (DomeMotionS[DOME_CCW].s == ISS_ON)
-        {
-            LOG_WARN("Abort roof action requested while the roof was closing. Direction correction may be needed on the next move request.");
-        }
-        roofClosing = false;
-        roofOpening = false;
-        MotionRequest = -1;
-        roofAbort();
+        LOG_WARN("Vent needs a single button controller that opens on the next press");
+        Abort();
+        return false;
     }
 
-    // If both limit switches are off, then we're neither parked nor unparked.
-    if (fullyOpenedLimitSwitch == ISS_OFF && fullyClosedLimitSwitch == ISS_OFF)
+    // The travel model is timed from the relay edge, so the stop is too rather than from when Move returned
+    double stopAt = start + (travel - start) * percent / 100.0;
+    struct timespec stopTime = moveCommanded;
+    addNanoseconds(&stopTime, (long)(stopAt * 1e9));
+    if (!armStopTimerAt(stopTime, TIMER_VENT_STOP))
     {
-        IUResetSwitch(&ParkSP);
-        ParkSP.s = IPS_IDLE;
-        IDSetSwitch(&ParkSP, nullptr);
+        Abort();
+        return false;
     }
+    ventTarget = percent;
+    LOGF_INFO("Roof venting to %.0f%% open, stopping after %.2f seconds", percent, stopAt);
     return true;
 }
 
-bool RollOffIno::getFullOpenedLimitSwitch(bool* switchState)
+void RollOffIno::ventStop()
 {
-    if (isSimulation())
+    // Opened fully, or stopped by other means, before the vent position was reached
+    if (!roofOpening)
     {
-        if (simRoofOpen)
+        if (VentNP.s == IPS_BUSY)
         {
-            fullyOpenedLimitSwitch = ISS_ON;
-            *switchState = true;
-        }
-        else
-        {
-            fullyOpenedLimitSwitch = ISS_OFF;
-            *switchState = false;
+            VentNP.s = IPS_ALERT;
+            IDSetNumber(&VentNP, nullptr);
         }
-        return true;
+        return;
     }
+    roofAbort();
+    roofOpening = false;
+    motorStopped();
+    roofVented = true;
+    setDomeState(DOME_IDLE);
+    SetParked(false);
+    VentNP.s = IPS_OK;
+    IDSetNumber(&VentNP, nullptr);
+    LOGF_INFO("Roof stopped at vent position %.0f%% open", ventTarget);
+    updateRoofStatus();
+}
 
-    if (readRoofSwitch(ROOF_OPENED_SWITCH, switchState))
-    {
-        if (*switchState)
-            fullyOpenedLimitSwitch = ISS_ON;
-        else
-            fullyOpenedLimitSwitch = ISS_OFF;
-        return true;
-    }
-    else
+bool RollOffIno::armStopTimer(double seconds, int action)
+{
+    struct itimerspec spec {};
+    spec.it_value.tv_sec = (time_t)seconds;
+    spec.it_value.tv_nsec = (long)((seconds - spec.it_value.tv_sec) * 1e9);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;
+    if (timerfd_settime(stopTimerFd, 0, &spec, nullptr) != 0)
     {
-        LOG_WARN("Unable to obtain from the controller whether or not the roof is opened");
+        LOGF_WARN("Unable to set the stop timer: %s", strerror(errno));
         return false;
     }
+    timerAction = action;
+    return true;
 }
 
-bool RollOffIno::getFullClosedLimitSwitch(bool* switchState)
+// An absolute CLOCK_MONOTONIC expiry, a time already past fires at once
+bool RollOffIno::armStopTimerAt(const struct timespec &at, int action)
 {
-    if (isSimulation())
+    struct itimerspec spec {};
+    spec.it_value = at;
+    if (timerfd_settime(stopTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0)
     {
-        if (simRoofClosed)
-        {
-            fullyClosedLimitSwitch = ISS_ON;
-            *switchState = true;
-        }
-        else
-        {
-            fullyClosedLimitSwitch = ISS_OFF;
-            *switchState = false;
-        }
-        return true;
-    }
-
-    if (readRoofSwitch(ROOF_CLOSED_SWITCH, switchState))
-    {
-        if (*switchState)
-            fullyClosedLimitSwitch = ISS_ON;
-        else
-            fullyClosedLimitSwitch = ISS_OFF;
-        return true;
-    }
-    else
-    {
-        LOG_WARN("Unable to obtain from the controller whether or not the roof is closed");
+        LOGF_WARN("Unable to set the stop timer: %s", strerror(errno));
         return false;
     }
+    timerAction = action;
+    return true;
 }
 
-bool RollOffIno::getRoofLockedSwitch(bool* switchState)
+void RollOffIno::disarmStopTimer()
 {
-    // If there is no lock switch, return success with status false
-    if (isSimulation())
-    {
-        roofLockedSwitch = ISS_OFF;
-        *switchState = false;                     // Not locked
-        return true;
-    }
-    if (readRoofSwitch(ROOF_LOCKED_SWITCH, switchState))
+    struct itimerspec spec {};
+    if (stopTimerFd >= 0)
+        timerfd_settime(stopTimerFd, 0, &spec, nullptr);
+    timerAction = TIMER_NONE;
+    reversePending = false;
+}
+
+void RollOffIno::stopTimerHelper(int fd, void *context)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    static_cast<RollOffIno *>(context)->timedAction();
+}
+
+void RollOffIno::timedAction()
+{
+    int action = timerAction;
+    timerAction = TIMER_NONE;
+    if (action == TIMER_VENT_STOP)
+        ventStop();
+    else if (action == TIMER_REVERSE)
+        reverseStart();
+    else if (action == TIMER_BUTTON)
+        singleButtonNext();
+}
+
+/*
+ * Reverse on demand. Stop the roof, wait the controller's minimum stop interval on the one-shot timer, then
+ * start it in the other direction. The new direction is reported as soon as the reversal is accepted, the
+ * motor is only counted as running once the start pulse is issued.
+ */
+IPState RollOffIno::reverseTo(DomeDirection dir)
+{
+    if (dir == DOME_CCW && INDI::Dome::isLocked())
     {
-        if (*switchState)
-            roofLockedSwitch = ISS_ON;
-        else
-            roofLockedSwitch = ISS_OFF;
+        DEBUG(INDI::Logger::DBG_WARNING,
+              "Cannot close dome when mount is locking. See: Telescope parkng policy, in options tab");
+        return IPS_ALERT;
+    }
+    if (dir == DOME_CW && !dutyAllowsMove(dir))
+    {
+        LOG_WARN("Motor duty budget used up, roof will not be reversed to open");
+        return IPS_ALERT;
+    }
+    if (!reversePending)
+    {
+        disarmStopTimer();
+        if (!roofAbort())
+        {
+            LOG_WARN("Failed to operate controller to stop the roof for reversal");
+            return IPS_ALERT;
+        }
+        motorStopped();
+    }
+    // A PWM drive ramps down, the reversal waits for it to run down whatever the configured delay
+    double delayMs = ReverseDelayN[0].value;
+    if (pwmDrive)
+        delayMs = std::max(delayMs, pwmDrive->runDownMs() + 20.0);
+    if (!armStopTimer(delayMs / 1000.0, TIMER_REVERSE))
+        return IPS_ALERT;
+    reversePending = true;
+    roofOpening = (dir == DOME_CW);
+    roofClosing = (dir == DOME_CCW);
+    roofVented = false;
+    roofTimedOut = EXPIRED_CLEAR;
+    MotionRequest = (int)RoofTimeoutN[0].value + delayMs / 1000.0;
+    gettimeofday(&MotionStart, nullptr);
+    LOGF_INFO("Roof reversing, will start %s in %.0f ms", dir == DOME_CW ? "opening" : "closing", delayMs);
+    return IPS_BUSY;
+}
+
+void RollOffIno::reverseStart()
+{
+    bool opening = roofOpening;
+
+    if (!reversePending)
+        return;
+    reversePending = false;
+    if (opening ? roofOpen() : roofClose())
+    {
+        motorStarted(opening ? DOME_CW : DOME_CCW);
+        LOGF_INFO("Roof is %s...", opening ? "opening" : "closing");
+    }
+    else
+    {
+        LOGF_WARN("Failed to operate controller to %s roof after stopping", opening ? "open" : "close");
+        roofOpening = false;
+        roofClosing = false;
+        setDomeState(DOME_IDLE);
+    }
+}
+
+/*
+ * Hold client requests that arrive while the roof is moving, or while earlier ones are still waiting, so that
+ * they run in order of priority once it has stopped. A request matching the movement under way merges with it.
+ * A close takes the place of any motion waiting, and is only held back by an open that cannot be reversed.
+ */
+bool RollOffIno::queueRequest(const char *name, ISState *states, char *names[], int n)
+{
+    CommandQueue::Kind kind;
+    int value;
+    ISwitchVectorProperty *svp;
+    const char *actionName = IUFindOnSwitchName(states, names, n);
+    bool moving = roofOpening || roofClosing || reversePending;
+
+    if (actionName == nullptr)
+        return false;
+    if (strcmp(name, ParkSP.name) == 0)
+    {
+        kind = CommandQueue::MOTION;
+        value = strcmp(actionName, ParkS[0].name) == 0 ? CommandQueue::MOVE_CLOSE : CommandQueue::MOVE_OPEN;
+        svp = &ParkSP;
+    }
+    else if (strcmp(name, DomeMotionSP.name) == 0)
+    {
+        kind = CommandQueue::MOTION;
+        value = strcmp(actionName, DomeMotionS[DOME_CCW].name) == 0 ? CommandQueue::MOVE_CLOSE : CommandQueue::MOVE_OPEN;
+        svp = &DomeMotionSP;
+    }
+    else if (strcmp(name, LockSP.name) == 0)
+    {
+        kind = CommandQueue::LOCK;
+        value = strcmp(actionName, LockS[LOCK_ENABLE].name) == 0;
+        svp = &LockSP;
+    }
+    else if (strcmp(name, AuxSP.name) == 0)
+    {
+        kind = CommandQueue::AUX;
+        value = strcmp(actionName, AuxS[AUX_ENABLE].name) == 0;
+        svp = &AuxSP;
+    }
+    else
+        return false;
+
+    // Handled here rather than by the base class, which would change the motion switch and so end the
+    // supervision of the movement under way
+    if (kind == CommandQueue::MOTION)
+    {
+        if (holdMotion(value) == CommandQueue::RUN)
+            return false;
+        // A held park shows as under way, the roof reports it parked once the close has run
+        if (svp == &ParkSP)
+        {
+            IUUpdateSwitch(&ParkSP, states, names, n);
+            ParkSP.s = IPS_BUSY;
+        }
+        IDSetSwitch(svp, nullptr);
         return true;
     }
+    if (!moving && !commands.pending(kind))
+        return false;
+    if (commands.post(kind, value))
+    {
+        metrics.add(DriverMetrics::QUEUED_REQUESTS);
+        LOGF_INFO("%s request will be carried out when the roof has stopped", svp->label);
+    }
     else
+        metrics.add(DriverMetrics::MERGED_REQUESTS);
+    IDSetSwitch(svp, nullptr);
+    return true;
+}
+
+/*
+ * Decide a roof motion request against the movement under way. An open reverses a closing roof, and a close an
+ * opening one, straight away when the controller can be stopped. Otherwise the request waits for the roof to
+ * stop, a close waiting for an open runs however the open ends.
+ */
+CommandQueue::Disposition RollOffIno::holdMotion(int value)
+{
+    int moving = roofOpening ? CommandQueue::MOVE_OPEN : roofClosing ? CommandQueue::MOVE_CLOSE : CommandQueue::MOVE_NONE;
+    CommandQueue::Disposition disposition = commands.motion(value, moving, canReverse());
+
+    if (disposition == CommandQueue::MERGE)
     {
-        LOG_WARN("Unable to obtain from the controller whether or not the roof is externally locked");
+        if (moving == value)
+            LOGF_DEBUG("Roof is already %s, request merged", roofOpening ? "opening" : "closing");
+        metrics.add(DriverMetrics::MERGED_REQUESTS);
+    }
+    else if (disposition == CommandQueue::HOLD)
+    {
+        metrics.add(DriverMetrics::QUEUED_REQUESTS);
+        if (moving == CommandQueue::MOVE_OPEN)
+            LOG_INFO("Roof is in process of opening, it will close when the open completes.");
+        else
+            LOGF_INFO("Roof %s request will be carried out when the roof has stopped",
+                      value == CommandQueue::MOVE_OPEN ? "open" : "close");
+    }
+    return disposition;
+}
+
+/*
+ * Replay the highest priority waiting request through the normal client path once the roof is at rest and
+ * the motor has had the reverse delay to stop turning. True if it started a roof movement.
+ */
+bool RollOffIno::runQueuedCommand()
+{
+    CommandQueue::Kind kind;
+    int value;
+    ISState states[1] = { ISS_ON };
+    char *names[1];
+    const char *svpName;
+
+    if (roofOpening || roofClosing || reversePending || motorRunning || calState != CAL_IDLE ||
+            DomeMotionSP.s == IPS_BUSY || (pwmDrive && pwmDrive->runDownMs() != 0) ||
+            (stepperDrive && stepperDrive->busy()))
+        return false;
+    if (msElapsed(motorStopTime) < ReverseDelayN[0].value || !commands.take(&kind, &value))
         return false;
+    switch (kind)
+    {
+        case CommandQueue::MOTION:
+            svpName = ParkSP.name;
+            names[0] = ParkS[value == CommandQueue::MOVE_CLOSE ? 0 : 1].name;
+            break;
+        case CommandQueue::LOCK:
+            svpName = LockSP.name;
+            names[0] = LockS[value ? LOCK_ENABLE : LOCK_DISABLE].name;
+            break;
+        default:
+            svpName = AuxSP.name;
+            names[0] = AuxS[value ? AUX_ENABLE : AUX_DISABLE].name;
+            break;
     }
+    LOGF_DEBUG("Running waiting request %s %s", svpName, names[0]);
+    ISNewSwitch(getDeviceName(), svpName, states, names, 1);
+    return DomeMotionSP.s == IPS_BUSY;
 }
 
-bool RollOffIno::getRoofAuxSwitch(bool* switchState)
+/*
+ * Calibration. Runs a supervised series of open and close cycles from the status timer, timing each from the
+ * relay edge to the release of the starting limit switch and to the arrival at the other limit switch.
+ * The averages become the travel model and a timeout with margin.
+ */
+bool RollOffIno::calibrationStart(int cycles)
 {
-    // If there is no lock switch, return success with status false
+    bool high;
+
     if (isSimulation())
     {
-        if (AuxS[AUX_ENABLE].s == ISS_OFF)
+        LOG_WARN("Calibration needs the roof hardware, not available in simulation");
+        return false;
+    }
+    if (calState != CAL_IDLE || roofOpening || roofClosing)
+    {
+        LOG_WARN("Calibration can only be started with the roof stationary");
+        return false;
+    }
+    if (inputGpio(ROOF_OPENED_SWITCH, &high) < 0 || inputGpio(ROOF_CLOSED_SWITCH, &high) < 0 ||
+        outputGpio(ROOF_OPEN_RELAY, &high) < 0 ||
+        (outputGpio(ROOF_CLOSE_RELAY, &high) < 0 && ControllerS[CONTROLLER_SINGLE].s != ISS_ON))
+    {
+        LOG_WARN("Calibration needs the OPEN, CLOSE relays and the OPENED, CLOSED switches defined");
+        return false;
+    }
+    calCycle = 0;
+    calOpen = calClose = calStart = 0;
+    roofTimedOut = EXPIRED_CLEAR;
+    CalibrateN[0].value = cycles;
+    calState = CAL_PREPARE;
+    CalibrateSP.s = IPS_BUSY;
+    IDSetSwitch(&CalibrateSP, nullptr);
+    LOGF_INFO("Roof calibration started, %d open and close cycles. Stay clear of the roof.", cycles);
+    calibrationStep();
+    return true;
+}
+
+void RollOffIno::calibrationStep()
+{
+    bool openHigh, closeHigh, openedHigh, closedHigh;
+    int openPin = outputGpio(ROOF_OPEN_RELAY, &openHigh);
+    int closePin = (ControllerS[CONTROLLER_SINGLE].s == ISS_ON) ? outputGpio(ROOF_OPEN_RELAY, &closeHigh) :
+                   outputGpio(ROOF_CLOSE_RELAY, &closeHigh);
+    int openedPin = inputGpio(ROOF_OPENED_SWITCH, &openedHigh);
+    int closedPin = inputGpio(ROOF_CLOSED_SWITCH, &closedHigh);
+
+    if (roofLockedSwitch == ISS_ON)
+    {
+        calibrationEnd(false, "roof is locked");
+        return;
+    }
+    if (roofTimedOut != EXPIRED_CLEAR)
+    {
+        calibrationEnd(false, "roof did not reach its limit switch in the time allowed");
+        return;
+    }
+    if (roofOpening || roofClosing)
+        return;
+
+    switch (calState)
+    {
+        case CAL_PREPARE:
+            if (fullyClosedLimitSwitch == ISS_ON)
+                break;
+            if (motorRunning || INDI::Dome::Move(DOME_CCW, MOTION_START) != IPS_BUSY)
+                calibrationEnd(false, "unable to close the roof to begin");
+            return;
+
+        case CAL_OPENING:
         {
-            roofAuxiliarySwitch = ISS_OFF;
-            *switchState = false;
-            return true;
+            if (fullyOpenedLimitSwitch != ISS_ON)
+            {
+                calibrationEnd(false, "roof stopped before it was opened");
+                return;
+            }
+            uint32_t pulse = edgeTick(openPin, openHigh);
+            uint32_t release = edgeTick(closedPin, !closedHigh);
+            uint32_t arrive = edgeTick(openedPin, openedHigh);
+            if (!pulse || !release || !arrive)
+            {
+                calibrationEnd(false, "switch edges were not reported by pigpiod");
+                return;
+            }
+            calStart += (uint32_t)(release - pulse) / 1e6;
+            calOpen += (uint32_t)(arrive - pulse) / 1e6;
+            LOGF_INFO("Calibration cycle %d open: start %.2fs, travel %.2fs", calCycle + 1, (uint32_t)(release - pulse) / 1e6,
+                      (uint32_t)(arrive - pulse) / 1e6);
+            break;
         }
-        else
+
+        case CAL_CLOSING:
+        {
+            if (fullyClosedLimitSwitch != ISS_ON)
+            {
+                calibrationEnd(false, "roof stopped before it was closed");
+                return;
+            }
+            uint32_t pulse = edgeTick(closePin, closeHigh);
+            uint32_t release = edgeTick(openedPin, !openedHigh);
+            uint32_t arrive = edgeTick(closedPin, closedHigh);
+            if (!pulse || !release || !arrive)
+            {
+                calibrationEnd(false, "switch edges were not reported by pigpiod");
+                return;
+            }
+            calStart += (uint32_t)(release - pulse) / 1e6;
+            calClose += (uint32_t)(arrive - pulse) / 1e6;
+            LOGF_INFO("Calibration cycle %d close: start %.2fs, travel %.2fs", calCycle + 1, (uint32_t)(release - pulse) / 1e6,
+                      (uint32_t)(arrive - pulse) / 1e6);
+            if (++calCycle >= (int)CalibrateN[0].value)
+            {
+                calibrationEnd(true, nullptr);
+                return;
+            }
+            break;
+        }
+    }
+
+    // Start the next move, opening from closed and closing from opened
+    bool opening = (calState != CAL_OPENING);
+    armEdgeCapture();
+    calState = opening ? CAL_OPENING : CAL_CLOSING;
+    if (INDI::Dome::Move(opening ? DOME_CW : DOME_CCW, MOTION_START) != IPS_BUSY)
+        calibrationEnd(false, "the roof move was not accepted");
+}
+
+void RollOffIno::calibrationEnd(bool success, const char *reason)
+{
+    calState = CAL_IDLE;
+    IUResetSwitch(&CalibrateSP);
+    if (!success)
+    {
+        CalibrateSP.s = IPS_ALERT;
+        IDSetSwitch(&CalibrateSP, nullptr);
+        LOGF_WARN("Roof calibration stopped, %s", reason);
+        return;
+    }
+
+    RoofTravelN[TRAVEL_OPEN].value = calOpen / calCycle;
+    RoofTravelN[TRAVEL_CLOSE].value = calClose / calCycle;
+    RoofTravelN[TRAVEL_START].value = calStart / (2 * calCycle);
+    RoofTravelNP.s = IPS_OK;
+    IDSetNumber(&RoofTravelNP, nullptr);
+    saveConfig(true, RoofTravelNP.name);
+
+    double travel = std::max(RoofTravelN[TRAVEL_OPEN].value, RoofTravelN[TRAVEL_CLOSE].value);
+    RoofTimeoutN[0].value = std::min(300.0, std::ceil(travel * 1.25 + 2));
+    RoofTimeoutNP.s = IPS_OK;
+    IDSetNumber(&RoofTimeoutNP, nullptr);
+    saveConfig(true, RoofTimeoutNP.name);
+
+    CalibrateSP.s = IPS_OK;
+    IDSetSwitch(&CalibrateSP, nullptr);
+    LOGF_INFO("Roof calibration complete: open %.2fs, close %.2fs, start delay %.2fs, timeout set to %.0fs",
+              RoofTravelN[TRAVEL_OPEN].value, RoofTravelN[TRAVEL_CLOSE].value, RoofTravelN[TRAVEL_START].value,
+              RoofTimeoutN[0].value);
+}
+
+/*
+ * Direction: DOME_CW Clockwise = Open; DOME-CCW Counter clockwise = Close
+ * Operation: MOTION_START, | MOTION_STOP
+ */
+IPState RollOffIno::Move(DomeDirection dir, DomeMotionCommand operation)
+{
+    TraceSpan span(trace, "Move", dir == DOME_CW ? "open" : "close");
+    LOG_DEBUG("Roof received dome motion directive.");
+
+    updateRoofStatus();
+    if (operation == MOTION_START)
+    {
+        if (roofLockedSwitch)
+        {
+            LOG_WARN("Roof is externally locked, no movement possible");
+            return IPS_ALERT;
+        }
+        // Requests for the opposite direction reverse the roof when the controller can be stopped, otherwise
+        // they were held before reaching here
+        if (((roofOpening && dir == DOME_CCW) || (roofClosing && dir == DOME_CW)) && canReverse())
+            return reverseTo(dir);
+        if (roofOpening)
+        {
+            LOG_DEBUG("Roof is in process of opening, wait for completion.");
+            return IPS_OK;
+        }
+        if (roofClosing)
+        {
+            LOG_DEBUG("Roof is in process of closing, wait for completion.");
+            return IPS_OK;
+        }
+
+        // Open Roof
+        // DOME_CW --> OPEN. If we are asked to "open" while we are fully opened as the
+        // limit switch indicates, then we simply return false.
+        if (dir == DOME_CW)
+        {
+            if (fullyOpenedLimitSwitch == ISS_ON)
+            {
+                LOG_WARN("DOME_CW directive received but roof is already fully opened");
+                SetParked(false);
+                return IPS_ALERT;
+            }
+
+
+            if (!dutyAllowsMove(dir))
+            {
+                updateMotorDuty();
+                if (DutyStatusN[DUTY_WAIT].value < 0)
+                    LOG_WARN("Motor duty budget is less than the time to open the roof, increase the budget");
+                else
+                    LOGF_WARN("Motor duty budget used up, roof can open in %.0f seconds", DutyStatusN[DUTY_WAIT].value);
+                return IPS_ALERT;
+            }
+
+            // Initiate action
+            if (roofOpen())
+            {
+                roofOpening = true;
+                roofClosing = false;
+                LOG_INFO("Roof is opening...");
+            }
+            else
+            {
+                LOG_WARN("Failed to operate controller to open roof");
+                metrics.add(DriverMetrics::MOVE_FAILURES);
+                return IPS_ALERT;
+            }
+        }
+
+        // Close Roof
+        else if (dir == DOME_CCW)
+        {
+            if (fullyClosedLimitSwitch == ISS_ON)
+            {
+                SetParked(true);
+                LOG_WARN("DOME_CCW directive received but roof is already fully closed");
+                return IPS_ALERT;
+            }
+            else if (INDI::Dome::isLocked())
+            {
+                DEBUG(INDI::Logger::DBG_WARNING,
+                      "Cannot close dome when mount is locking. See: Telescope parkng policy, in options tab");
+                return IPS_ALERT;
+            }
+            // A close is never refused for motor duty, leaving the roof open is the greater risk
+            if (!dutyAllowsMove(dir))
+                LOG_WARN("Closing the roof although the motor duty budget is used up");
+
+            // Initiate action
+            if (roofClose())
+            {
+                roofClosing = true;
+                roofOpening = false;
+                LOG_INFO("Roof is closing...");
+            }
+            else
+            {
+                LOG_WARN("Failed to operate controller to close roof");
+                metrics.add(DriverMetrics::MOVE_FAILURES);
+                return IPS_ALERT;
+            }
+        }
+        motorStarted(dir);
+        roofVented = false;
+        roofTimedOut = EXPIRED_CLEAR;
+        MotionRequest = (int)RoofTimeoutN[0].value;
+        LOGF_DEBUG("Roof motion timeout setting: %d", (int)MotionRequest);
+        gettimeofday(&MotionStart, nullptr);
+        SetTimer(INACTIVE_TIMING);
+        return IPS_BUSY;
+    }
+    return    IPS_ALERT;
+}
+
+/*
+ * Close Roof
+ *
+ */
+IPState RollOffIno::Park()
+{
+    TraceSpan span(trace, "Park");
+    // A park that does not come from a client, such as for the weather, waits here for a roof it cannot reverse
+    if (holdMotion(CommandQueue::MOVE_CLOSE) != CommandQueue::RUN)
+        return IPS_BUSY;
+    IPState rc = INDI::Dome::Move(DOME_CCW, MOTION_START);
+
+    if (rc == IPS_BUSY)
+    {
+        LOG_INFO("RollOff ino is parking...");
+        return IPS_BUSY;
+    }
+    else
+        return IPS_ALERT;
+}
+
+/*
+ * Open Roof
+ *
+ */
+IPState RollOffIno::UnPark()
+{
+    TraceSpan span(trace, "UnPark");
+    if (holdMotion(CommandQueue::MOVE_OPEN) != CommandQueue::RUN)
+        return IPS_BUSY;
+    IPState rc = INDI::Dome::Move(DOME_CW, MOTION_START);
+    if (rc == IPS_BUSY)
+    {
+        LOG_INFO("RollOff ino is unparking...");
+        return IPS_BUSY;
+    }
+    else
+        return IPS_ALERT;
+}
+
+/*
+ * Abort motion
+ */
+bool RollOffIno::Abort()
+{
+    TraceSpan span(trace, "Abort");
+    bool lockState;
+    bool openState;
+    bool closeState;
+
+    commands.clear();
+    updateRoofStatus();
+    lockState = (roofLockedSwitch == ISS_ON);
+    openState = (fullyOpenedLimitSwitch == ISS_ON);
+    closeState = (fullyClosedLimitSwitch == ISS_ON);
+
+    if (lockState)
+    {
+        LOG_WARN("Roof is externally locked, no action taken on abort request");
+        return true;
+    }
+
+    if (closeState && DomeMotionSP.s != IPS_BUSY)
+    {
+        LOG_WARN("Roof appears to be closed and stationary, no action taken on abort request");
+        return true;
+    }
+    else if (openState && DomeMotionSP.s != IPS_BUSY)
+    {
+        LOG_WARN("Roof appears to be open and stationary, no action taken on abort request");
+        return true;
+    }
+    else if (DomeMotionSP.s != IPS_BUSY)
+    {
+        LOG_WARN("Roof appears to be partially open and stationary, no action taken on abort request");
+    }
+    else if (DomeMotionSP.s == IPS_BUSY)
+    {
+        if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+        {
+            LOG_WARN("Abort roof action requested while the roof was moving.");
+        }
+        else if (DomeMotionS[DOME_CW].s == ISS_ON)
+        {
+            LOG_WARN("Abort roof action requested while the roof was opening. Direction correction may be needed on the next move request.");
+        }
+        else if (DomeMotionS[DOME_CCW].s == ISS_ON)
+        {
+            LOG_WARN("Abort roof action requested while the roof was closing. Direction correction may be needed on the next move request.");
+        }
+        roofClosing = false;
+        roofOpening = false;
+        MotionRequest = -1;
+        disarmStopTimer();
+        roofAbort();
+        motorStopped();
+        metrics.add(DriverMetrics::ABORTS);
+    }
+
+    // If both limit switches are off, then we're neither parked nor unparked.
+    if (fullyOpenedLimitSwitch == ISS_OFF && fullyClosedLimitSwitch == ISS_OFF)
+    {
+        IUResetSwitch(&ParkSP);
+        ParkSP.s = IPS_IDLE;
+        IDSetSwitch(&ParkSP, nullptr);
+    }
+    return true;
+}
+
+bool RollOffIno::getFullOpenedLimitSwitch(bool* switchState)
+{
+    if (isSimulation())
+    {
+        if (simRoofOpen)
+        {
+            fullyOpenedLimitSwitch = ISS_ON;
+            *switchState = true;
+        }
+        else
+        {
+            fullyOpenedLimitSwitch = ISS_OFF;
+            *switchState = false;
+        }
+        return true;
+    }
+
+    if (readRoofSwitch(ROOF_OPENED_SWITCH, switchState))
+    {
+        if (*switchState)
+            fullyOpenedLimitSwitch = ISS_ON;
+        else
+            fullyOpenedLimitSwitch = ISS_OFF;
+        return true;
+    }
+    else
+    {
+        LOG_WARN("Unable to obtain from the controller whether or not the roof is opened");
+        return false;
+    }
+}
+
+bool RollOffIno::getFullClosedLimitSwitch(bool* switchState)
+{
+    if (isSimulation())
+    {
+        if (simRoofClosed)
+        {
+            fullyClosedLimitSwitch = ISS_ON;
+            *switchState = true;
+        }
+        else
+        {
+            fullyClosedLimitSwitch = ISS_OFF;
+            *switchState = false;
+        }
+        return true;
+    }
+
+    if (readRoofSwitch(ROOF_CLOSED_SWITCH, switchState))
+    {
+        if (*switchState)
+            fullyClosedLimitSwitch = ISS_ON;
+        else
+            fullyClosedLimitSwitch = ISS_OFF;
+        return true;
+    }
+    else
+    {
+        LOG_WARN("Unable to obtain from the controller whether or not the roof is closed");
+        return false;
+    }
+}
+
+bool RollOffIno::getRoofLockedSwitch(bool* switchState, bool fresh)
+{
+    // If there is no lock switch, return success with status false
+    if (isSimulation())
+    {
+        roofLockedSwitch = ISS_OFF;
+        *switchState = false;                     // Not locked
+        return true;
+    }
+    if (readRoofSwitch(ROOF_LOCKED_SWITCH, switchState, fresh))
+    {
+        if (*switchState)
+            roofLockedSwitch = ISS_ON;
+        else
+            roofLockedSwitch = ISS_OFF;
+        return true;
+    }
+    else
+    {
+        LOG_WARN("Unable to obtain from the controller whether or not the roof is externally locked");
+        return false;
+    }
+}
+
+bool RollOffIno::getRoofAuxSwitch(bool* switchState)
+{
+    // If there is no lock switch, return success with status false
+    if (isSimulation())
+    {
+        if (AuxS[AUX_ENABLE].s == ISS_OFF)
+        {
+            roofAuxiliarySwitch = ISS_OFF;
+            *switchState = false;
+            return true;
+        }
+        else
+        {
+            roofAuxiliarySwitch = ISS_ON;
+            *switchState = true;
+            return true;
+        }
+    }
+    if (readRoofSwitch(ROOF_AUX_SWITCH, switchState))
+    {
+        if (*switchState)
+            roofAuxiliarySwitch = ISS_ON;
+        else
+            roofAuxiliarySwitch = ISS_OFF;
+        return true;
+    }
+    else
+    {
+        LOG_WARN("Unable to obtain from the controller whether or not the obs Aux switch is being used");
+        return false;
+    }
+}
+/*
+ * -------------------------------------------------------------------------------------------
+ *
+ */
+bool RollOffIno::roofOpen()
+{
+    // A relay press replaces this with the time its on level was written
+    clock_gettime(CLOCK_MONOTONIC, &moveCommanded);
+    if (isSimulation())
+    {
+        return true;
+    }
+    if (stepperDrive)
+    {
+        // From an unknown position allow the full travel, the limit switch ends the move
+        if (!stepperDrive->positionKnown())
+            stepperDrive->setPosition(0);
+        armLimitStop(DOME_CW);
+        return stepperDrive->moveTo(stepperDrive->travel());
+    }
+    if (pwmDrive)
+    {
+        armLimitStop(DOME_CW);
+        return pwmDrive->start(true);
+    }
+    if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+        return singleButtonTo(BUTTON_OPENING);
+    return pushRoofButton(ROOF_OPEN_RELAY, true, false);
+}
+
+bool RollOffIno::roofClose()
+{
+    clock_gettime(CLOCK_MONOTONIC, &moveCommanded);
+    if (isSimulation())
+    {
+        return true;
+    }
+    if (stepperDrive)
+    {
+        if (!stepperDrive->positionKnown())
+            stepperDrive->setPosition(stepperDrive->travel());
+        armLimitStop(DOME_CCW);
+        return stepperDrive->moveTo(0);
+    }
+    if (pwmDrive)
+    {
+        armLimitStop(DOME_CCW);
+        return pwmDrive->start(false);
+    }
+    if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+        return singleButtonTo(BUTTON_CLOSING);
+    return pushRoofButton(ROOF_CLOSE_RELAY, true, false);
+}
+
+bool RollOffIno::roofAbort()
+{
+    if (isSimulation())
+    {
+        return true;
+    }
+    if (ControllerS[CONTROLLER_SINGLE].s == ISS_ON)
+    {
+        // The rest of a series of presses is not wanted. Stopped in either direction is the goal, which
+        // stopped state it lands in does not matter.
+        if (timerAction == TIMER_BUTTON)
+            disarmStopTimer();
+        if (buttonState == BUTTON_OPENING || buttonState == BUTTON_CLOSING)
+            return singleButtonTo((buttonState + 1) % 4);
+        return true;
+    }
+    if (stepperDrive)
+    {
+        stepperDrive->stop(false);
+        return true;
+    }
+    if (pwmDrive)
+        return pwmDrive->stop(false);
+    return pushRoofButton(ROOF_ABORT_RELAY, true, false);
+}
+
+/*
+ * Single button controllers cycle open, stop, close, stop on each press. The driver models that cycle and
+ * presses the OPEN relay the fewest times needed to reach the wanted state, waiting the button interval
+ * between presses so the controller registers each one. The first press is made at once and the rest from
+ * the one-shot timer, so the event loop is not held for the intervals.
+ */
+bool RollOffIno::singleButtonTo(int target)
+{
+    if (timerAction == TIMER_BUTTON)
+        disarmStopTimer();          // A new target replaces the rest of an earlier series
+    if (buttonState == BUTTON_UNKNOWN)
+    {
+        // Stopped between the limits with no history, a stopped controller usually reverses on the next press
+        if (buttonLastMove == BUTTON_OPENING)
+            buttonState = BUTTON_NEXT_CLOSE;
+        else if (buttonLastMove == BUTTON_CLOSING)
+            buttonState = BUTTON_NEXT_OPEN;
+        else
+            buttonState = BUTTON_NEXT_OPEN;
+        LOGF_WARN("Single button controller state not known, assuming the next press will %s the roof",
+                  buttonState == BUTTON_NEXT_OPEN ? "open" : "close");
+    }
+
+    int presses = (target - buttonState + 4) % 4;
+    LOGF_DEBUG("Single button controller, %d press%s needed", presses, presses == 1 ? "" : "es");
+    buttonTarget = target;
+    if (presses == 0)
+        return true;
+    if (!singleButtonPress())
+        return false;
+    while (buttonState != buttonTarget)
+    {
+        // Without the timer the intervals are waited out here
+        if (stopTimerFd >= 0)
+            return armStopTimer(ButtonGapN[0].value / 1000.0, TIMER_BUTTON);
+        msSleep((int)ButtonGapN[0].value);
+        if (!singleButtonPress())
+            return false;
+    }
+    return true;
+}
+
+bool RollOffIno::singleButtonPress()
+{
+    if (!pushRoofButton(ROOF_OPEN_RELAY, true, false))
+        return false;
+    buttonState = (buttonState + 1) % 4;
+    if (buttonState == BUTTON_OPENING || buttonState == BUTTON_CLOSING)
+        buttonLastMove = buttonState;
+    return true;
+}
+
+// The next press of a series, from the one-shot timer
+void RollOffIno::singleButtonNext()
+{
+    if (buttonState == buttonTarget)
+        return;
+    if (!singleButtonPress())
+    {
+        LOG_WARN("Single button press failed part way through, the roof may not move as requested");
+        if (roofOpening || roofClosing)
+        {
+            roofOpening = false;
+            roofClosing = false;
+            setDomeState(DOME_IDLE);
+        }
+        return;
+    }
+    if (buttonState != buttonTarget)
+        armStopTimer(ButtonGapN[0].value / 1000.0, TIMER_BUTTON);
+}
+
+/*
+ * Keep the single button model in step with the limit switches. Arriving at a limit stops the controller,
+ * leaving a limit without a press from the driver means it was operated by a remote control.
+ */
+void RollOffIno::singleButtonEdges(bool wasOpened, bool wasClosed, bool openedState, bool closedState)
+{
+    if (openedState && !wasOpened)
+        buttonState = BUTTON_NEXT_CLOSE;
+    else if (closedState && !wasClosed)
+        buttonState = BUTTON_NEXT_OPEN;
+    else if (wasOpened && !openedState && buttonState != BUTTON_CLOSING)
+        buttonState = BUTTON_CLOSING;
+    else if (wasClosed && !closedState && buttonState != BUTTON_OPENING)
+        buttonState = BUTTON_OPENING;
+    else
+        return;
+    if (buttonState == BUTTON_OPENING || buttonState == BUTTON_CLOSING)
+        buttonLastMove = buttonState;
+}
+
+bool RollOffIno::setRoofLock(bool switchOn)
+{
+    if (isSimulation())
+    {
+        return false;
+    }
+    return pushRoofButton(ROOF_LOCK_RELAY, switchOn, true);
+}
+
+bool RollOffIno::setRoofAux(bool switchOn)
+{
+    if (isSimulation())
+    {
+        return false;
+    }
+    return pushRoofButton(ROOF_AUX_RELAY, switchOn, true);
+}
+
+/*
+ * If a single button controller, whether roof is moving or stopped, the state of the external controller
+ * will determine the effect on the roof. This could mean stopping, or starting in a reversed direction.
+ *
+ * The initial implementation using GPIO pins will only be supporting external controllers that control when
+ * the roof stops moving. This implies that for buttons/relays that cause a roof motion the length of the on
+ * state will temporary, less that a second. The existing polling timer will be used and the code will wait locally.
+ */
+
+bool RollOffIno::relayDefined(const char* button)
+{
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        for (int j = 0; j < MAX_OUT_OPS; j++)
+        {
+            if ((strcmp(button, outFunctionS[i][j].name) == 0) && (outFunctionS[i][j].s == ISS_ON))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool RollOffIno::pushRoofButton(const char* button, bool switchOn, bool ignoreLock)
+{
+    bool status = false;
+    bool roofLocked = false;
+    bool found = false;
+    bool moveFunction = false;
+    bool wantHigh = false;
+    unsigned int level;
+    unsigned int gpio = 0;
+    int intervalMilli = 0;
+    int def = -1;
+    int function = -1;
+
+    if (!contactEstablished)
+    {
+        LOG_WARN("No contact with the roof controller has been established");
+        return false;
+    }
+    if (!ignoreLock)
+    {
+        // In case it has been locked since the driver connected, always read at the time of the press
+        status = getRoofLockedSwitch(&roofLocked, true);
+        if (!status || roofLocked)
+        {
+            LOG_WARN("Roof external lock state prevents roof movement");
+            return false;
+        }
+    }
+
+    // A linked controller times its own relay pulses, the request is only queued here
+    if (controllerLink)
+    {
+        if (controllerLink->request("SET", button, switchOn ? "ON" : "OFF"))
+            return true;
+        LOGF_WARN("Unable to send %s to the controller, %s", button,
+                  controllerLink->ready() ? "too many requests waiting" : "no reply to the connect request yet");
+        return false;
+    }
+
+    status = true;
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        for (int j = 0; j < MAX_OUT_OPS; j++)
+        {
+            if ((strcmp(button, outFunctionS[i][j].name) == 0) && (outFunctionS[i][j].s == ISS_ON))
+            {
+                if ((strcmp(button, ROOF_OPEN_RELAY) == 0) || (strcmp(button, ROOF_CLOSE_RELAY) == 0) ||
+                    (strcmp(button, ROOF_ABORT_RELAY) == 0))
+                {
+                    moveFunction = true;
+                }
+                found = true;
+                function = j;
+                break;
+            }
+        }
+        if (found)
+        {
+            def = i;
+            gpio = outPinNumberN[i][0].value;
+            // switchOn true if turning relay on
+            if ((strcmp(outActivateWhenS[i][0].name, "High") == 0) && (outActivateWhenS[i][0].s == ISS_ON))
+                wantHigh = switchOn;
+            else if ((strcmp(outActivateWhenS[i][1].name, "Low") == 0) && (outActivateWhenS[i][1].s == ISS_ON))
+                wantHigh = !switchOn;
+
+            for (int j = 0; j < MAX_OUT_ACTIVE_LIMIT; j++)
+            {
+                if ((outActiveLimitS[i][j].s == ISS_ON))
+                {
+                    intervalMilli = activeLimitMilli[j];
+                    if ((intervalMilli == 0) && moveFunction)
+                    {
+                        status = false;
+                        LOGF_WARN("%s needs a Active Limit interval, No Limit only available for Lock and Aux.", button);
+                    }
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    if (!found && ((strcmp(button, ROOF_OPEN_RELAY) == 0) || (strcmp(button, ROOF_CLOSE_RELAY) == 0) ||
+                   (strcmp(button, ROOF_ABORT_RELAY) == 0)))
+    {
+        LOGF_WARN("A GPIO pin definition for %s was not found.", button);
+        return false;
+    }
+
+    // If a definition of the named optional relay is not found assume it is not being used.
+    if (!found && status)
+        return true;
+
+    if (found && !status)
+    {
+        LOGF_WARN("A usable GPIO pin definition for %s was not found.", button);
+        return status;
+    }
+
+    // If useTimer associate gpio pin, active hi/lo, with setting a timer to handle turning off the relay.
+    level = wantHigh ? 1 : 0;
+    //LOGF_WARN("*** GPIO write turn ON for: %s, pin: %d, level: %d, delay: %d", button, gpio, level, intervalMilli);
+    if (intervalMilli > 0)
+    {
+        // The pulse thread writes both levels and times the pulse, this thread waits for it to end. When
+        // verifying it watches for the edge report of the on level, the pin's edge callback adds no request.
+        int previous = outExpectedLevel[def];
+        outExpectedLevel[def] = level;
+        PulseWorker::Result pulse;
+        {
+            TraceSpan span(trace, "relay pulse", button);
+            pulse = pulseWorker->pulse(gpio, level, intervalMilli, OutVerifyS[OUT_VERIFY_ENABLE].s == ISS_ON);
+        }
+        if (pulse.bankRead)
+            applyGpioSnapshot(pulse.bank);
+        if (!pulse.written)
+        {
+            outExpectedLevel[def] = previous;
+            LOGF_WARN("GPIO write failed for %s, %d, returned: %s", button, gpio, pigpio_error(pulse.status));
+            return false;
+        }
+        // A relay that never followed the write is not an activation
+        if (pulse.asserted)
+            countRelay(function, true, intervalMilli);
+        if (strcmp(button, ROOF_OPEN_RELAY) == 0 || strcmp(button, ROOF_CLOSE_RELAY) == 0)
+            moveCommanded = pulse.start;
+        //LOGF_WARN("*** GPIO write turn OFF for: %s, pin: %d, level: %d, after delay of %d", button, gpio, level, intervalMilli);
+        if (pulse.status != 0)
+        {
+            LOGF_WARN("GPIO write reset failed for %s, %d, returned: %s", button, gpio, pigpio_error(pulse.status));
+            return false;
+        }
+        outExpectedLevel[def] = wantHigh ? 0 : 1;
+        if (!pulse.asserted)
+        {
+            LOGF_ERROR("%s relay on GPIO pin %d did not follow the write, pulse abandoned", button, gpio);
+            return false;
+        }
+        return true;
+    }
+
+    struct timespec callStart, callEnd;
+    clock_gettime(CLOCK_MONOTONIC, &callStart);
+    status = gpio_write(pi_id, gpio, level);
+    clock_gettime(CLOCK_MONOTONIC, &callEnd);
+    metrics.observeCall(elapsedMicros(callStart, callEnd));
+    trace.span("gpio_write", button, callStart, callEnd);
+    if (status != 0)
+    {
+        LOGF_WARN("GPIO write failed for %s, %d, returned: %s", button, gpio, pigpio_error(status));
+        return false;
+    }
+    outExpectedLevel[def] = level;
+    countRelay(function, switchOn, 0);
+    if (deadman && !(switchOn ? deadman->hold(gpio, wantHigh) : deadman->release(gpio)))
+        LOGF_WARN("Unable to update the dead-man release for %s on GPIO pin %d", button, gpio);
+    // The script restarted with a full deadline, the next renewal then checks a snapshot taken after this write
+    else if (deadman)
+        gettimeofday(&deadmanRenewed, nullptr);
+    return true;
+}
+
+bool RollOffIno::readRoofSwitch(const char* roofSwitchId, bool *result, bool fresh)
+{
+    int function = -1;
+
+    *result = false;
+
+    if (!contactEstablished)
+    {
+        LOG_WARN("No contact with the roof controller has been established");
+        return false;
+    }
+
+    for (int j = 0; j < MAX_INP_OPS - 1; j++)
+    {
+        if (strcmp(roofSwitchId, inpOps[j]) == 0)
+            function = j;
+    }
+    // inpOps is in the same order as the link's switches
+    if (controllerLink)
+        return function >= 0 && controllerLink->switchState(function, result);
+    if (function < 0 || inpMask[function] == 0)
+    {
+        if ((strcmp(roofSwitchId, ROOF_OPENED_SWITCH) == 0) || (strcmp(roofSwitchId, ROOF_CLOSED_SWITCH) == 0))
+        {
+            LOGF_WARN("A usable GPIO pin definition for %s was not found.", roofSwitchId);
+            return false;
+        }
+            // If a definition of another switch is not found assume it is not being used.
+        else
+            return true;
+    }
+
+    // The levels come from the bank snapshot, refreshed only if it is not recent or a fresh read is wanted
+    long age = msElapsed(gpioSnapshotTime);
+    if ((fresh || age < 0 || age > SNAPSHOT_MAX_AGE_MS) && !readGpioSnapshot())
+        return false;
+    *result = voteInput(function);
+    //LOGF_WARN("*** Reading: %s, snapshot: %08x, %s ***", roofSwitchId, gpioSnapshot, *result ? "ON" : "OFF");
+    return true;
+}
+
+/*
+ * Reduce the input definitions to bit masks. Called when the definitions change and on connect.
+ */
+void RollOffIno::buildInputMasks()
+{
+    for (int j = 0; j < MAX_INP_OPS - 1; j++)
+        inpMask[j] = 0;
+    inpLowMask = 0;
+
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+    {
+        inpDefGpio[i] = -1;
+        inpDefFunction[i] = -1;
+        unsigned int gpio = inpPinNumberN[i][0].value;
+        for (int j = 0; j < MAX_INP_OPS - 1; j++)
+        {
+            if (inpFunctionS[i][j].s == ISS_ON && gpio <= 31)
+            {
+                inpMask[j] |= 1u << gpio;
+                if (inpActivateWhenS[i][1].s == ISS_ON)
+                    inpLowMask |= 1u << gpio;
+                inpDefGpio[i] = gpio;
+                inpDefFunction[i] = j;
+            }
+        }
+    }
+}
+
+/*
+ * Combine the switches defined for a function. With a single switch every voting rule gives its state.
+ */
+bool RollOffIno::voteInput(int function)
+{
+    uint32_t active = (gpioSnapshot ^ inpLowMask) & inpMask[function];
+    int on = __builtin_popcount(active);
+    int total = __builtin_popcount(inpMask[function]);
+
+    if (SensorVoteS[VOTE_ALL].s == ISS_ON)
+        return on == total;
+    if (SensorVoteS[VOTE_ANY].s == ISS_ON)
+        return on > 0;
+    return 2 * on > total;
+}
+
+/*
+ * For functions with redundant switches, count each switch that disagrees with the voted state. A switch
+ * that keeps disagreeing is failing and can be replaced before it causes a missed park.
+ */
+void RollOffIno::countDisagreements()
+{
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+    {
+        int function = inpDefFunction[i];
+        if (function < 0 || __builtin_popcount(inpMask[function]) < 2)
+            continue;
+        bool on = ((gpioSnapshot ^ inpLowMask) >> inpDefGpio[i]) & 1;
+        if (on != voteInput(function))
+        {
+            InpDisagreeN[i].value++;
+            inpDisagreeChanged = true;
+        }
+    }
+}
+
+/*
+ * For each definition entry. Find the function name that matches the name of the switch wanted.
+ * See if it is selected. If not move on to the next entry. If a match found return its gpio pin # and high|low
+ * activation indicator. Returns -1 if the switch is not defined.
+ */
+int RollOffIno::inputGpio(const char* roofSwitchId, bool* activeHigh)
+{
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+    {
+        for (int j = 0; j < MAX_INP_OPS; j++)
+        {
+            if ((strcmp(roofSwitchId, inpFunctionS[i][j].name) == 0) && (inpFunctionS[i][j].s == ISS_ON))
+            {
+                *activeHigh = (inpActivateWhenS[i][0].s == ISS_ON);
+                return inpPinNumberN[i][0].value;
+            }
+        }
+    }
+    return -1;
+}
+
+int RollOffIno::outputGpio(const char* button, bool* activeHigh)
+{
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        for (int j = 0; j < MAX_OUT_OPS; j++)
+        {
+            if ((strcmp(button, outFunctionS[i][j].name) == 0) && (outFunctionS[i][j].s == ISS_ON))
+            {
+                *activeHigh = (outActivateWhenS[i][0].s == ISS_ON);
+                return outPinNumberN[i][0].value;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * What the driver uses a GPIO pin for, empty if nothing. Covers every defined output and input function and,
+ * unless drivePins is false, the pins of the selected motor drive.
+ */
+std::string RollOffIno::gpioUse(int gpio, bool drivePins)
+{
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        ISwitch *fn = IUFindOnSwitch(&outFunctionSP[i]);
+        if (fn != nullptr && fn != &outFunctionS[i][MAX_OUT_OPS - 1] && (int)outPinNumberN[i][0].value == gpio)
+            return std::string("the ") + fn->name + " output";
+    }
+    for (int i = 0; i < MAX_INP_DEFS; i++)
+    {
+        ISwitch *fn = IUFindOnSwitch(&inpFunctionSP[i]);
+        if (fn != nullptr && fn != &inpFunctionS[i][MAX_INP_OPS - 1] && (int)inpPinNumberN[i][0].value == gpio)
+            return std::string("the ") + fn->name + " input";
+    }
+    if (drivePins && DriveS[DRIVE_STEPPER].s == ISS_ON)
+    {
+        if ((int)StepperN[STEP_GPIO].value == gpio)
+            return "the stepper step output";
+        if ((int)StepperN[STEP_DIR_GPIO].value == gpio)
+            return "the stepper direction output";
+    }
+    if (drivePins && DriveS[DRIVE_PWM].s == ISS_ON)
+    {
+        if ((int)PwmN[PWM_GPIO].value == gpio)
+            return "the PWM output";
+        if ((int)PwmN[PWM_DIR_GPIO].value == gpio)
+            return "the PWM direction output";
+    }
+    return "";
+}
+
+/*
+ * Edge capture. pigpiod reports level changes on the defined pins, output pins included, with its microsecond
+ * tick. Only the first edge of each polarity after arming is kept so contact bounce does not move the times.
+ */
+void RollOffIno::setEdgeCallbacks()
+{
+    cancelEdgeCallbacks();
+    for (int i = 0; i < MAX_OUT_DEFS + MAX_INP_DEFS; i++)
+    {
+        bool output = (i < MAX_OUT_DEFS);
+        int def = output ? i : i - MAX_OUT_DEFS;
+        ISwitch *unused = output ? &outFunctionS[def][MAX_OUT_OPS - 1] : &inpFunctionS[def][MAX_INP_OPS - 1];
+        ISwitchVectorProperty *fn = output ? &outFunctionSP[def] : &inpFunctionSP[def];
+        unsigned int gpio = output ? outPinNumberN[def][0].value : inpPinNumberN[def][0].value;
+
+        if (IUFindOnSwitch(fn) == nullptr || unused->s == ISS_ON || gpio > 31 || edgeCallbackId[gpio] >= 0)
+            continue;
+        if (output && outFunctionS[def][MAX_OUT_OPS - 2].s == ISS_ON)      // Heartbeat edges would flood the callbacks
+            continue;
+        {
+            TraceSpan span(trace, "callback_ex", fn->name);
+            edgeCallbackId[gpio] = callback_ex(pi_id, gpio, EITHER_EDGE, edgeHelper, this);
+        }
+        if (edgeCallbackId[gpio] < 0)
+            LOGF_DEBUG("Edge reporting not available for GPIO pin %d: %s", gpio, pigpio_error(edgeCallbackId[gpio]));
+    }
+    if (pulseWorker)
+        pulseWorker->setEdgeMask(edgeMask());
+}
+
+uint32_t RollOffIno::edgeMask() const
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        if (edgeCallbackId[i] >= 0)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+void RollOffIno::cancelEdgeCallbacks()
+{
+    if (pulseWorker)
+        pulseWorker->setEdgeMask(0);
+    for (int i = 0; i < 32; i++)
+    {
+        if (edgeCallbackId[i] >= 0)
+            callback_cancel(edgeCallbackId[i]);
+        edgeCallbackId[i] = -1;
+    }
+}
+
+void RollOffIno::armEdgeCapture()
+{
+    for (int i = 0; i < 32; i++)
+    {
+        firstEdge[i][0].store(0, std::memory_order_relaxed);
+        firstEdge[i][1].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t RollOffIno::edgeTick(int gpio, bool level)
+{
+    if (gpio < 0 || gpio > 31)
+        return 0;
+    return firstEdge[gpio][level ? 1 : 0].load(std::memory_order_acquire);
+}
+
+void RollOffIno::edgeHelper(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata)
+{
+    RollOffIno *driver = static_cast<RollOffIno *>(userdata);
+    uint32_t none = 0;
+
+    if (gpio > 31 || level > 1)                 // Ignore watchdog timeouts
+        return;
+    driver->metrics.add(DriverMetrics::EDGE_EVENTS);
+    uint32_t bit = 1u << gpio;
+    if ((driver->limitStopMask.load(std::memory_order_acquire) & bit) &&
+            level == ((driver->limitStopLow.load(std::memory_order_relaxed) & bit) ? 0u : 1u))
+        driver->limitStop();
+    // Callbacks are cancelled before the worker is released
+    if (driver->pulseWorker)
+        driver->pulseWorker->edge(gpio, level);
+    // Tick 0 marks no edge, an edge at exactly tick 0 is recorded a microsecond late
+    driver->firstEdge[gpio][level].compare_exchange_strong(none, tick ? tick : 1, std::memory_order_acq_rel);
+}
+
+/*
+ * Read the levels of GPIO 0-31 in a single pigpiod request. The snapshot serves the input switch reads and,
+ * when enabled, confirms each output pin is at the level last written to it.
+ */
+bool RollOffIno::readGpioSnapshot()
+{
+    struct timespec callStart, callEnd;
+    clock_gettime(CLOCK_MONOTONIC, &callStart);
+    uint32_t bits = read_bank_1(pi_id);
+    clock_gettime(CLOCK_MONOTONIC, &callEnd);
+    metrics.observeCall(elapsedMicros(callStart, callEnd));
+    trace.span("read_bank_1", nullptr, callStart, callEnd);
+
+    if (bankReadFailed(bits))
+    {
+        LOGF_WARN("GPIO bank read failed, returned: %s", pigpio_error((int)bits));
+        communicationErrors++;
+        return false;
+    }
+    applyGpioSnapshot(bits);
+    return true;
+}
+
+void RollOffIno::applyGpioSnapshot(uint32_t bits)
+{
+    gpioSnapshot = bits;
+    gettimeofday(&gpioSnapshotTime, nullptr);
+    if (OutVerifyS[OUT_VERIFY_ENABLE].s == ISS_ON)
+        verifyOutputLevels();
+    countDisagreements();
+}
+
+void RollOffIno::verifyOutputLevels()
+{
+    bool changed = false;
+
+    for (int i = 0; i < MAX_OUT_DEFS; i++)
+    {
+        if (outExpectedLevel[i] < 0)
+            continue;
+        unsigned int gpio = outPinNumberN[i][0].value;
+        int level = (gpioSnapshot >> gpio) & 1;
+        bool mismatch = (level != outExpectedLevel[i]);
+
+        OutVerifyN[OUT_VERIFY_CHECKS].value++;
+        if (mismatch)
+        {
+            OutVerifyN[OUT_VERIFY_MISMATCHES].value++;
+            changed = true;
+        }
+        // Report once when a pin starts or stops disagreeing rather than every poll
+        if (mismatch && !outMismatch[i])
+            LOGF_WARN("Output %s GPIO pin %d reads %d, expected %d. Pin may be in use elsewhere", outFunctionSP[i].name, gpio,
+                      level, outExpectedLevel[i]);
+        else if (!mismatch && outMismatch[i])
+            LOGF_INFO("Output %s GPIO pin %d now matches the level written", outFunctionSP[i].name, gpio);
+        outMismatch[i] = mismatch;
+    }
+    if (changed || OutVerifyNP.s == IPS_ALERT)
+    {
+        OutVerifyNP.s = changed ? IPS_ALERT : IPS_OK;
+        IDSetNumber(&OutVerifyNP, nullptr);
+    }
+}
+
+/*
+ * Relay wear accounting. Counts are kept in memory and only written to file every RELAY_COUNT_SAVE_S or on
+ * disconnect. A timed pulse adds its active limit, a held relay (No Limit) adds the time between on and off.
+ */
+void RollOffIno::countRelay(int function, bool switchOn, int intervalMilli)
+{
+    if (function < 0 || function >= MAX_RELAY_OPS)
+        return;
+    if (intervalMilli > 0)
+    {
+        RelayCyclesN[function].value++;
+        RelayOnTimeN[function].value += intervalMilli / 1000.0;
+    }
+    else if (switchOn && !relayHeld[function])
+    {
+        RelayCyclesN[function].value++;
+        relayHeld[function] = true;
+        gettimeofday(&relayOnSince[function], nullptr);
+    }
+    else if (!switchOn && relayHeld[function])
+    {
+        RelayOnTimeN[function].value += msElapsed(relayOnSince[function]) / 1000.0;
+        relayHeld[function] = false;
+    }
+    else
+        return;
+    relayCountsChanged = true;
+    relayCountsDirty = true;
+}
+
+std::string RollOffIno::relayCountsFile()
+{
+    return deviceFile("_relays.txt");
+}
+
+// A file in the INDI configuration directory named for the device
+std::string RollOffIno::deviceFile(const char *suffix)
+{
+    const char *home = getenv("HOME");
+    std::string name = getDeviceName();
+    for (auto &c : name)
+    {
+        if (c == ' ')
+            c = '_';
+    }
+    return std::string(home ? home : "/tmp") + "/.indi/" + name + suffix;
+}
+
+void RollOffIno::loadRelayCounts()
+{
+    char fn[MAXINOTARGET + 1];
+    double cycles;
+    double onTime;
+
+    FILE *fp = fopen(relayCountsFile().c_str(), "r");
+    if (fp == nullptr)
+        return;
+    while (fscanf(fp, "%15s %lf %lf", fn, &cycles, &onTime) == 3)
+    {
+        for (int j = 0; j < MAX_RELAY_OPS; j++)
+        {
+            if (strcmp(fn, outOps[j]) == 0)
+            {
+                RelayCyclesN[j].value = cycles;
+                RelayOnTimeN[j].value = onTime;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+bool RollOffIno::saveRelayCounts()
+{
+    std::string path = relayCountsFile();
+    std::string temp = path + ".tmp";
+
+    gettimeofday(&relayCountsSaved, nullptr);
+    FILE *fp = fopen(temp.c_str(), "w");
+    if (fp == nullptr)
+    {
+        LOGF_WARN("Unable to save relay counts to %s: %s", temp.c_str(), strerror(errno));
+        return false;
+    }
+    for (int j = 0; j < MAX_RELAY_OPS; j++)
+        fprintf(fp, "%s %.0f %.1f\n", outOps[j], RelayCyclesN[j].value, RelayOnTimeN[j].value);
+    if (fclose(fp) != 0 || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        LOGF_WARN("Unable to save relay counts to %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    relayCountsDirty = false;
+    return true;
+}
+
+/*
+ * Start, restart or stop the distance sensor sampling thread to match the settings.
+ */
+void RollOffIno::startPositionSensor()
+{
+    positionSensor.reset();
+    positionSamples = 0;
+    positionErrors = 0;
+    if (PosSensorS[POS_SENSOR_OFF].s == ISS_ON || isSimulation())
+        return;
+
+    std::unique_ptr<I2cBus> bus;
+    if (PosSensorS[POS_SENSOR_PIGPIOD].s == ISS_ON)
+        bus.reset(new PigpiodI2cBus(pi_id));
+    else
+        bus.reset(new LinuxI2cBus());
+    positionSensor.reset(new PositionSensor(std::move(bus)));
+
+    PositionSensor::Options options;
+    options.bus = PosSensorN[POS_BUS].value;
+    options.address = PosSensorN[POS_ADDRESS].value;
+    options.reg = PosSensorN[POS_REGISTER].value;
+    options.rateHz = PosSensorN[POS_RATE].value;
+    options.mmPerCount = PosSensorN[POS_SCALE].value;
+    options.lsbFirst = (PosByteOrderS[POS_LSB_FIRST].s == ISS_ON);
+    options.realtime = realtimeOptions();
+    if (!positionSensor->start(options))
+    {
+        LOGF_ERROR("Unable to open the distance sensor at I2C bus %d address 0x%02x", options.bus, options.address);
+        positionSensor.reset();
+        RoofPositionNP.s = IPS_ALERT;
+        return;
+    }
+    LOGF_DEBUG("Distance sensor sampling at %.0f per second", options.rateHz);
+}
+
+/*
+ * Publish the latest filtered distance as a percentage of the travel between the closed and opened distances.
+ */
+void RollOffIno::updatePosition()
+{
+    if (!positionSensor)
+        return;
+    uint32_t samples = positionSensor->samples();
+    uint32_t errors = positionSensor->errors();
+    if (samples == positionSamples)
+    {
+        // Only failed reads since the last tick
+        if (RoofPositionNP.s != IPS_ALERT && errors != positionErrors)
+        {
+            RoofPositionNP.s = IPS_ALERT;
+            IDSetNumber(&RoofPositionNP, nullptr);
+        }
+        positionErrors = errors;
+        return;
+    }
+    positionErrors = errors;
+    positionSamples = samples;
+
+    double mm = positionSensor->distance();
+    double percent = openFraction(mm) * 100;
+    if (std::fabs(percent - RoofPositionN[POSITION_PERCENT].value) < 0.5 && RoofPositionNP.s == IPS_OK)
+        return;
+    RoofPositionN[POSITION_PERCENT].value = percent;
+    RoofPositionN[POSITION_MM].value = mm;
+    RoofPositionNP.s = IPS_OK;
+    IDSetNumber(&RoofPositionNP, nullptr);
+}
+
+/*
+ * Start, restart or stop the motor current sampling thread to match the settings. A trip from the thread wakes
+ * the event loop through the sensor eventfd.
+ */
+void RollOffIno::startCurrentSensor()
+{
+    if (currentTripId >= 0)
+        IERmCallback(currentTripId);
+    currentTripId = -1;
+    currentSensor.reset();
+    if (CurSensorS[CUR_SENSOR_OFF].s == ISS_ON || isSimulation())
+        return;
+
+    std::unique_ptr<SpiBus> bus;
+    if (CurSensorS[CUR_SENSOR_PIGPIOD].s == ISS_ON)
+        bus.reset(new PigpiodSpiBus(pi_id));
+    else
+        bus.reset(new LinuxSpiBus());
+    currentSensor.reset(new CurrentSensor(std::move(bus)));
+
+    CurrentSensor::Options options;
+    options.spiChannel = CurSensorN[CUR_SPI_CHANNEL].value;
+    options.adcChannel = CurSensorN[CUR_ADC_CHANNEL].value;
+    options.rateHz = CurSensorN[CUR_RATE].value;
+    options.ampsPerCount = CurSensorN[CUR_SCALE].value;
+    options.zeroCounts = CurSensorN[CUR_ZERO].value;
+    options.overcurrentAmps = CurSensorN[CUR_OVERCURRENT].value;
+    options.stallAmps = CurSensorN[CUR_STALL].value;
+    options.stallMs = CurSensorN[CUR_STALL_MS].value;
+    options.inrushMs = CurSensorN[CUR_INRUSH_MS].value;
+    options.realtime = realtimeOptions();
+    if (!currentSensor->start(options))
+    {
+        LOGF_ERROR("Unable to open the motor current ADC on SPI chip select %d", options.spiChannel);
+        currentSensor.reset();
+        MotorCurrentNP.s = IPS_ALERT;
+        return;
+    }
+    currentTripId = IEAddCallback(currentSensor->eventFd(), currentTripHelper, this);
+    if (motorRunning)
+        currentSensor->arm(true);
+    MotorCurrentNP.s = IPS_OK;
+    LOGF_DEBUG("Motor current sampling at %.0f per second", options.rateHz);
+}
+
+void RollOffIno::currentTripHelper(int fd, void *context)
+{
+    uint64_t trips;
+    if (read(fd, &trips, sizeof(trips)) != sizeof(trips))
+        return;
+    static_cast<RollOffIno *>(context)->currentTrip();
+}
+
+/*
+ * Stop the roof on a stall or overcurrent reported by the current sensor.
+ */
+void RollOffIno::currentTrip()
+{
+    if (!currentSensor || !motorRunning)
+        return;
+    int trip = currentSensor->trip();
+    if (trip == CurrentSensor::TRIP_NONE)
+        return;
+    LOGF_ERROR("Motor %s at %.1f A, stopping the roof", trip == CurrentSensor::TRIP_STALL ? "stall" : "overcurrent",
+               currentSensor->current());
+    MotorCurrentN[CURRENT_TRIPS].value++;
+    metrics.add(DriverMetrics::CURRENT_TRIPS);
+    MotorCurrentNP.s = IPS_ALERT;
+    Abort();
+    setDomeState(DOME_IDLE);
+    IDSetNumber(&MotorCurrentNP, nullptr);
+}
+
+/*
+ * Publish the present motor current while the roof is moving.
+ */
+void RollOffIno::updateCurrent()
+{
+    if (!currentSensor || !motorRunning)
+        return;
+    MotorCurrentN[CURRENT_NOW].value = currentSensor->current();
+    MotorCurrentN[CURRENT_PEAK].value = currentSensor->peak();
+    MotorCurrentN[CURRENT_MEAN].value = currentSensor->mean();
+    IDSetNumber(&MotorCurrentNP, nullptr);
+}
+
+// Distance sensor reading as a fraction of the travel between the closed and opened distances
+double RollOffIno::openFraction(double mm)
+{
+    double span = PosSensorN[POS_OPENED_MM].value - PosSensorN[POS_CLOSED_MM].value;
+    double fraction = (span != 0) ? (mm - PosSensorN[POS_CLOSED_MM].value) / span : 0;
+    return std::min(1.0, std::max(0.0, fraction));
+}
+
+/*
+ * Bring the fused position estimate up to date. The timing model gives the velocity: none while stopped or
+ * waiting out the start delay, otherwise the travel model speed. Limit switches and new distance sensor
+ * samples give the position.
+ */
+void RollOffIno::updateEstimate()
+{
+    double dt = (estimateTime.tv_sec != 0) ? msElapsed(estimateTime) / 1000.0 : 0;
+    gettimeofday(&estimateTime, nullptr);
+    roofEstimator.predict(dt);
+
+    if (!motorRunning || msElapsed(motorStart) / 1000.0 < RoofTravelN[TRAVEL_START].value)
+        roofEstimator.measureVelocity(0, ESTIMATE_STOPPED_VAR);
+    else
+    {
+        // Speed from the learned travel is good to about 20%, from the timeout it is only an upper bound
+        bool learned = RoofTravelN[motorDir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE].value > 0;
+        double run = expectedRunTime(motorDir) - RoofTravelN[TRAVEL_START].value;
+        if (run > 0)
+        {
+            double speed = 1 / run;
+            double error = learned ? 0.2 * speed : speed;
+            roofEstimator.measureVelocity(motorDir == DOME_CW ? speed : -speed, error * error);
+        }
+    }
+
+    if (fullyClosedLimitSwitch == ISS_ON && fullyOpenedLimitSwitch != ISS_ON)
+        roofEstimator.measurePosition(0, ESTIMATE_SWITCH_VAR);
+    else if (fullyOpenedLimitSwitch == ISS_ON && fullyClosedLimitSwitch != ISS_ON)
+        roofEstimator.measurePosition(1, ESTIMATE_SWITCH_VAR);
+
+    if (positionSensor && positionSensor->samples() != estimateSamples)
+    {
+        estimateSamples = positionSensor->samples();
+        double span = PosSensorN[POS_OPENED_MM].value - PosSensorN[POS_CLOSED_MM].value;
+        if (span != 0)
+            roofEstimator.measurePosition(openFraction(positionSensor->distance()), ESTIMATE_SENSOR_MM2 / (span * span));
+    }
+
+    double percent = roofEstimator.position() * 100;
+    double speed = roofEstimator.velocity() * 100;
+    double sigma = roofEstimator.positionSigma() * 100;
+    if (std::fabs(percent - RoofEstimateN[ESTIMATE_POSITION].value) < 0.5 &&
+        std::fabs(speed - RoofEstimateN[ESTIMATE_VELOCITY].value) < 0.05 &&
+        std::fabs(sigma - RoofEstimateN[ESTIMATE_SIGMA].value) < 0.5 && RoofEstimateNP.s == IPS_OK)
+        return;
+    RoofEstimateN[ESTIMATE_POSITION].value = percent;
+    RoofEstimateN[ESTIMATE_VELOCITY].value = speed;
+    RoofEstimateN[ESTIMATE_SIGMA].value = sigma;
+    RoofEstimateNP.s = IPS_OK;
+    IDSetNumber(&RoofEstimateNP, nullptr);
+}
+
+RealtimeOptions RollOffIno::realtimeOptions()
+{
+    RealtimeOptions options;
+    options.enabled = (RealtimeS[REALTIME_ON].s == ISS_ON);
+    options.priority = RealtimeN[REALTIME_PRIORITY].value;
+    options.cpu = RealtimeN[REALTIME_CPU].value;
+    return options;
+}
+
+/*
+ * Start or restart the pulse thread and the sensor threads with the real-time settings. In real-time mode the
+ * process memory is locked so none of them wait on a page fault.
+ */
+void RollOffIno::startTimingThreads()
+{
+    RealtimeOptions options = realtimeOptions();
+    RealtimeSP.s = IPS_OK;
+    if (options.enabled && !lockMemory(true))
+    {
+        LOGF_WARN("Unable to lock memory for real-time timing: %s", strerror(errno));
+        RealtimeSP.s = IPS_ALERT;
+    }
+    if (pulseWorker && !pulseWorker->start(options))
+    {
+        LOGF_WARN("Unable to run the pulse thread at SCHED_FIFO priority %d, needs CAP_SYS_NICE or an rtprio limit",
+                  options.priority);
+        RealtimeSP.s = IPS_ALERT;
+    }
+    startPositionSensor();
+    startCurrentSensor();
+    updateTimingStats(true);
+}
+
+/*
+ * Publish the pulse width error and sensor wakeup latency distributions, at most every TIMING_STATS_S
+ * unless forced. The latency is from the current sensor, the thread that has to react quickly, or
+ * otherwise the distance sensor.
+ */
+void RollOffIno::updateTimingStats(bool force)
+{
+    if (!pulseWorker)
+        return;
+    long age = msElapsed(timingStatsTime);
+    if (!force && age >= 0 && age < TIMING_STATS_S * 1000)
+        return;
+    gettimeofday(&timingStatsTime, nullptr);
+
+    const JitterStats *wake = nullptr;
+    if (currentSensor)
+        wake = &currentSensor->wakeLatency;
+    else if (positionSensor)
+        wake = &positionSensor->wakeLatency;
+
+    const JitterStats &width = pulseWorker->widthError;
+    if (!force && width.count() == TimingStatsN[TIMING_PULSES].value && wake == nullptr)
+        return;
+    TimingStatsN[TIMING_PULSES].value = width.count();
+    TimingStatsN[TIMING_PULSE_P50].value = width.percentile(0.5);
+    TimingStatsN[TIMING_PULSE_P99].value = width.percentile(0.99);
+    TimingStatsN[TIMING_PULSE_MAX].value = width.maxMs();
+    TimingStatsN[TIMING_WAKE_P50].value = wake ? wake->percentile(0.5) : 0;
+    TimingStatsN[TIMING_WAKE_P99].value = wake ? wake->percentile(0.99) : 0;
+    TimingStatsN[TIMING_WAKE_MAX].value = wake ? wake->maxMs() : 0;
+    TimingStatsNP.s = IPS_OK;
+    IDSetNumber(&TimingStatsNP, nullptr);
+}
+
+/*
+ * Start the loopback benchmark. Both pins are driven or reconfigured so neither may be a pin the driver
+ * uses, and the roof must be still.
+ */
+bool RollOffIno::loopbackStart()
+{
+    int out = LoopbackN[LOOP_OUT_GPIO].value;
+    int in = LoopbackN[LOOP_IN_GPIO].value;
+
+    if (!contactEstablished || isSimulation())
+        return false;
+    if (loopbackBench && !loopbackBench->finished())
+    {
+        LOG_WARN("Loopback benchmark already running");
+        return false;
+    }
+    if (pulseWorker && !pulseWorker->benchmarkFinished())
+    {
+        LOG_WARN("Loopback benchmark not run while the timing benchmark is running");
+        return false;
+    }
+    if (DomeMotionSP.s == IPS_BUSY || calState != CAL_IDLE)
+    {
+        LOG_WARN("Loopback benchmark not run while the roof is moving");
+        return false;
+    }
+    if (out == in)
+    {
+        LOG_WARN("Loopback benchmark needs different output and input pins");
+        return false;
+    }
+    for (int gpio : { out, in })
+    {
+        std::string use = gpioUse(gpio);
+        if (!use.empty())
+        {
+            LOGF_WARN("GPIO %d is %s, choose spare pins for the loopback benchmark", gpio, use.c_str());
+            return false;
+        }
+    }
+
+    LoopbackBenchmark::Options options;
+    options.outGpio = out;
+    options.inGpio = in;
+    options.pulseMs = LoopbackN[LOOP_PULSE_MS].value;
+    options.count = LoopbackN[LOOP_COUNT].value;
+    options.loadThreads = LoopbackN[LOOP_LOAD].value;
+    options.realtime = realtimeOptions();
+    loopbackBench.reset(new LoopbackBenchmark(pi_id));
+    if (!loopbackBench->start(options))
+    {
+        LOGF_WARN("Unable to set GPIO %d as output and %d as input for the loopback benchmark", out, in);
+        loopbackBench.reset();
+        return false;
+    }
+    LOGF_INFO("Loopback benchmark started, %d pulses of %d ms for each mechanism with %d load threads", options.count,
+              options.pulseMs, options.loadThreads);
+    return true;
+}
+
+/*
+ * Publish the loopback results once the benchmark has finished.
+ */
+void RollOffIno::loopbackCheck()
+{
+    const char *mechanisms[LoopbackBenchmark::MECH_COUNT] = { "Sleep", "Timer", "Wave", "Script" };
+
+    if (!loopbackBench || !loopbackBench->finished())
+        return;
+    for (int m = 0; m < LoopbackBenchmark::MECH_COUNT; m++)
+    {
+        const JitterStats &error = loopbackBench->error[m];
+        LoopResultN[m * 4].value = error.percentile(0.5);
+        LoopResultN[m * 4 + 1].value = error.percentile(0.99);
+        LoopResultN[m * 4 + 2].value = error.maxMs();
+        LoopResultN[m * 4 + 3].value = loopbackBench->missed[m].load();
+        if (loopbackBench->unavailable[m].load())
+            LOGF_INFO("Loopback %s: not available from pigpiod", mechanisms[m]);
+        else
+            LOGF_INFO("Loopback %s: %u measured, %u missed, error median %.2f ms, 99%% %.2f ms, max %.2f ms", mechanisms[m],
+                      error.count(), loopbackBench->missed[m].load(), LoopResultN[m * 4].value,
+                      LoopResultN[m * 4 + 1].value, LoopResultN[m * 4 + 2].value);
+    }
+    LoopResultNP.s = IPS_OK;
+    IDSetNumber(&LoopResultNP, nullptr);
+    loopbackBench.reset();
+    if (LoopbackSP.s == IPS_BUSY)
+    {
+        LoopbackSP.s = IPS_OK;
+        IDSetSwitch(&LoopbackSP, nullptr);
+    }
+}
+
+/*
+ * Start the pulse thread benchmark on the loopback output pin, which must be spare, no jumper is needed since
+ * pigpiod reports the edges of an output. The roof is not moved while it runs, a relay pulse cancels it.
+ */
+bool RollOffIno::timingBenchStart()
+{
+    int gpio = LoopbackN[LOOP_OUT_GPIO].value;
+
+    if (!contactEstablished || isSimulation())
+        return false;
+    if (DomeMotionSP.s == IPS_BUSY || calState != CAL_IDLE)
+    {
+        LOG_WARN("Timing benchmark not run while the roof is moving");
+        return false;
+    }
+    if (loopbackBench)
+    {
+        LOG_WARN("Timing benchmark not run while the loopback benchmark is running");
+        return false;
+    }
+    std::string use = gpioUse(gpio);
+    if (!use.empty())
+    {
+        LOGF_WARN("GPIO %d is %s, choose a spare loopback output pin for the timing benchmark", gpio, use.c_str());
+        return false;
+    }
+    if (positionSensor)
+        positionSensor->wakeLatency.reset();
+    if (currentSensor)
+        currentSensor->wakeLatency.reset();
+    if (!pulseWorker->benchmark(gpio, TIMING_BENCH_COUNT, TIMING_BENCH_MS))
+        return false;
+    LOGF_INFO("Timing benchmark started, %d pulses of %d ms on GPIO %d with real-time timing %s", TIMING_BENCH_COUNT,
+              TIMING_BENCH_MS, gpio, pulseWorker->realtime() ? "on" : "off");
+    return true;
+}
+
+// Publish the timing benchmark results once the pulse thread has finished it
+void RollOffIno::timingBenchCheck()
+{
+    if (!pulseWorker || TimingBenchSP.s != IPS_BUSY || !pulseWorker->benchmarkFinished())
+        return;
+    if (pulseWorker->benchUnavailable.load())
+    {
+        LOGF_WARN("Unable to drive GPIO %d and watch its edges for the timing benchmark",
+                  (int)LoopbackN[LOOP_OUT_GPIO].value);
+        TimingBenchSP.s = IPS_ALERT;
+        IDSetSwitch(&TimingBenchSP, nullptr);
+        return;
+    }
+    const JitterStats &width = pulseWorker->benchWidth;
+    const JitterStats &latency = pulseWorker->benchLatency;
+    TimingBenchN[BENCH_WIDTH_P50].value = width.percentile(0.5);
+    TimingBenchN[BENCH_WIDTH_P99].value = width.percentile(0.99);
+    TimingBenchN[BENCH_WIDTH_MAX].value = width.maxMs();
+    TimingBenchN[BENCH_LATENCY_P50].value = latency.percentile(0.5);
+    TimingBenchN[BENCH_LATENCY_P99].value = latency.percentile(0.99);
+    TimingBenchN[BENCH_LATENCY_MAX].value = latency.maxMs();
+    TimingBenchN[BENCH_MISSED].value = pulseWorker->benchMissed.load();
+    TimingBenchNP.s = IPS_OK;
+    IDSetNumber(&TimingBenchNP, nullptr);
+    LOGF_INFO("Timing benchmark, real-time timing %s, %u measured, %u missed: width error median %.2f ms, 99%% %.2f ms, "
+              "max %.2f ms, edge latency median %.2f ms, 99%% %.2f ms, max %.2f ms",
+              pulseWorker->realtime() ? "on" : "off", width.count(), pulseWorker->benchMissed.load(),
+              TimingBenchN[BENCH_WIDTH_P50].value, TimingBenchN[BENCH_WIDTH_P99].value, TimingBenchN[BENCH_WIDTH_MAX].value,
+              TimingBenchN[BENCH_LATENCY_P50].value, TimingBenchN[BENCH_LATENCY_P99].value,
+              TimingBenchN[BENCH_LATENCY_MAX].value);
+    TimingBenchSP.s = IPS_OK;
+    IDSetSwitch(&TimingBenchSP, nullptr);
+    updateTimingStats(true);
+}
+
+// The roof can be stopped part way, needed to reverse or vent
+bool RollOffIno::stopAvailable()
+{
+    return relayDefined(ROOF_ABORT_RELAY) || ControllerS[CONTROLLER_SINGLE].s == ISS_ON || stepperDrive != nullptr ||
+           pwmDrive != nullptr;
+}
+
+// A moving roof can be stopped and sent the other way
+bool RollOffIno::canReverse()
+{
+    return stopAvailable() && stopTimerFd >= 0 && !isSimulation();
+}
+
+/*
+ * Create the step and direction or PWM drive when one is selected, or release them.
+ */
+void RollOffIno::startDrive()
+{
+    std::lock_guard<std::mutex> lock(driveMutex);
+    stepperDrive.reset();
+    pwmDrive.reset();
+    if (isSimulation())
+        return;
+
+    if (DriveS[DRIVE_PWM].s == ISS_ON)
+    {
+        PwmDrive::Options options;
+        options.pwmGpio = PwmN[PWM_GPIO].value;
+        options.dirGpio = PwmN[PWM_DIR_GPIO].value;
+        options.dirOpenHigh = (StepDirS[STEP_DIR_OPEN_HIGH].s == ISS_ON);
+        options.freqHz = PwmN[PWM_FREQ].value;
+        options.maxDuty = PwmN[PWM_MAX_DUTY].value * 10;
+        options.creepDuty = PwmN[PWM_CREEP_DUTY].value * 10;
+        options.accelMs = PwmN[PWM_ACCEL_MS].value;
+        options.decelMs = PwmN[PWM_DECEL_MS].value;
+        if (options.pwmGpio == options.dirGpio)
+        {
+            LOG_ERROR("The PWM and direction GPIO pins must be different");
+            return;
+        }
+        for (unsigned gpio : { options.pwmGpio, options.dirGpio })
+        {
+            std::string use = gpioUse(gpio, false);
+            if (!use.empty())
+            {
+                LOGF_ERROR("PWM drive GPIO %d is already %s", gpio, use.c_str());
+                return;
+            }
+        }
+        pwmDrive.reset(new PwmDrive(pi_id, trace));
+        if (!pwmDrive->configure(options))
         {
-            roofAuxiliarySwitch = ISS_ON;
-            *switchState = true;
-            return true;
+            LOGF_ERROR("Unable to set PWM GPIO pins %d and %d as outputs", options.pwmGpio, options.dirGpio);
+            pwmDrive.reset();
+            return;
         }
+        LOGF_DEBUG("PWM drive on GPIO %d using %s PWM at %d Hz, direction GPIO %d", options.pwmGpio,
+                   pwmDrive->hardware() ? "hardware" : "DMA", options.freqHz, options.dirGpio);
+        return;
     }
-    if (readRoofSwitch(ROOF_AUX_SWITCH, switchState))
+    if (DriveS[DRIVE_STEPPER].s != ISS_ON)
+        return;
+
+    StepperDrive::Options options;
+    options.stepGpio = StepperN[STEP_GPIO].value;
+    options.dirGpio = StepperN[STEP_DIR_GPIO].value;
+    options.dirOpenHigh = (StepDirS[STEP_DIR_OPEN_HIGH].s == ISS_ON);
+    options.travel = StepperN[STEP_TRAVEL].value;
+    options.startHz = StepperN[STEP_START_HZ].value;
+    options.maxHz = StepperN[STEP_MAX_HZ].value;
+    options.accel = StepperN[STEP_ACCEL].value;
+    options.pulseUs = StepperN[STEP_PULSE_US].value;
+    if (options.stepGpio == options.dirGpio)
     {
-        if (*switchState)
-            roofAuxiliarySwitch = ISS_ON;
-        else
-            roofAuxiliarySwitch = ISS_OFF;
-        return true;
+        LOG_ERROR("The stepper step and direction GPIO pins must be different");
+        return;
     }
-    else
+    for (unsigned gpio : { options.stepGpio, options.dirGpio })
     {
-        LOG_WARN("Unable to obtain from the controller whether or not the obs Aux switch is being used");
-        return false;
+        std::string use = gpioUse(gpio, false);
+        if (!use.empty())
+        {
+            LOGF_ERROR("Stepper GPIO %d is already %s", gpio, use.c_str());
+            return;
+        }
+    }
+    stepperDrive.reset(new StepperDrive(pi_id, trace));
+    if (!stepperDrive->configure(options))
+    {
+        LOGF_ERROR("Unable to set stepper GPIO pins %d and %d as outputs", options.stepGpio, options.dirGpio);
+        stepperDrive.reset();
+        return;
     }
+    LOGF_DEBUG("Stepper drive on step GPIO %d direction GPIO %d, %ld steps of travel", options.stepGpio, options.dirGpio,
+               options.travel);
 }
+
 /*
- * -------------------------------------------------------------------------------------------
- *
+ * Stop a step and direction or PWM drive on the limit switch it is heading for. Runs on the pigpiod_if2 callback
+ * thread as soon as the edge is reported. Inputs without edge reporting are left to driveCheck().
  */
-bool RollOffIno::roofOpen()
+void RollOffIno::armLimitStop(DomeDirection dir)
 {
-    if (isSimulation())
-    {
-        return true;
-    }
-    return pushRoofButton(ROOF_OPEN_RELAY, true, false);
+    if (stepperDrive)
+        stepperDrive->clearHalt();
+    if (pwmDrive)
+        pwmDrive->clearHalt();
+    limitStopped.store(false);
+    limitStopLow.store(inpLowMask, std::memory_order_relaxed);
+    // inpMask is indexed as inpOps, opened then closed
+    limitStopMask.store(inpMask[dir == DOME_CW ? 0 : 1], std::memory_order_release);
 }
 
-bool RollOffIno::roofClose()
+void RollOffIno::limitStop()
 {
-    if (isSimulation())
-    {
-        return true;
-    }
-    return pushRoofButton(ROOF_CLOSE_RELAY, true, false);
+    if (limitStopMask.exchange(0) == 0)
+        return;
+    std::lock_guard<std::mutex> lock(driveMutex);
+    if (stepperDrive)
+        stepperDrive->halt();
+    if (pwmDrive)
+        pwmDrive->halt();
+    limitStopped.store(true);
 }
 
-bool RollOffIno::roofAbort()
+/*
+ * Stepper position upkeep each tick. The limit switches home the step count, and end a move early here if
+ * the edge callback did not. A move that reaches its soft limit without seeing the switch is stopped there.
+ */
+void RollOffIno::driveCheck()
 {
-    if (isSimulation())
+    bool opened = (fullyOpenedLimitSwitch == ISS_ON && fullyClosedLimitSwitch != ISS_ON);
+    bool closed = (fullyClosedLimitSwitch == ISS_ON && fullyOpenedLimitSwitch != ISS_ON);
+
+    // The PWM drive stops at once on the limit switch if the edge callback has not already stopped it, ramps
+    // down once motion has ended any other way, and slows to the approach duty when the travel model expects
+    // the limit within the deceleration time
+    if (pwmDrive && pwmDrive->target() > 0)
     {
-        return true;
+        if ((opened && roofOpening) || (closed && roofClosing))
+            pwmDrive->stop(true);
+        else if (!roofOpening && !roofClosing)
+            pwmDrive->stop(false);
+        else if (motorRunning && !pwmDrive->slowing() &&
+                 RoofTravelN[motorDir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE].value > 0 &&
+                 expectedRunTime(motorDir) - msElapsed(motorStart) / 1000.0 < PwmN[PWM_DECEL_MS].value / 1000 + PWM_APPROACH_S)
+            pwmDrive->slow();
     }
-    return pushRoofButton(ROOF_ABORT_RELAY, true, false);
-}
 
-bool RollOffIno::setRoofLock(bool switchOn)
-{
-    if (isSimulation())
+    if (!stepperDrive)
+        return;
+    bool busy = stepperDrive->busy();
+
+    if ((opened && (!busy || roofOpening)) || (closed && (!busy || roofClosing)))
     {
-        return false;
+        if (busy)
+            stepperDrive->stop(true);
+        stepperDrive->setPosition(opened ? stepperDrive->travel() : 0);
+    }
+    // A stop from the limit switch edge allows one tick for the switch to show in the snapshot
+    else if (!busy && motorRunning && (roofOpening || roofClosing) && !reversePending && !limitStopped.exchange(false))
+    {
+        LOGF_WARN("Roof stopped at the %s soft limit without reaching the limit switch", roofOpening ? "opened" : "closed");
+        roofOpening = false;
+        roofClosing = false;
+        setDomeState(DOME_IDLE);
+    }
+
+    long steps = stepperDrive->positionKnown() ? stepperDrive->position() : -1;
+    if (steps != (long)StepPositionN[0].value)
+    {
+        StepPositionN[0].value = steps;
+        StepPositionNP.s = IPS_OK;
+        IDSetNumber(&StepPositionNP, nullptr);
     }
-    return pushRoofButton(ROOF_LOCK_RELAY, switchOn, true);
 }
 
-bool RollOffIno::setRoofAux(bool switchOn)
+/*
+ * Start the heartbeat when an output is defined for it. The pin idles at the inactive level of its definition.
+ */
+void RollOffIno::startHeartbeat()
 {
-    if (isSimulation())
+    bool activeHigh = true;
+
+    heartbeat.reset();
+    int gpio = outputGpio(ROOF_HEARTBEAT_OUT, &activeHigh);
+    if (gpio < 0 || isSimulation())
+        return;
+
+    Heartbeat::Options options;
+    options.gpio = gpio;
+    options.idleHigh = !activeHigh;
+    options.freqHz = HeartbeatN[HEARTBEAT_FREQ].value;
+    options.deadlineMs = HeartbeatN[HEARTBEAT_DEADLINE].value * 1000;
+    heartbeat.reset(new Heartbeat(pi_id, trace));
+    if (!heartbeat->start(options))
     {
-        return false;
+        LOGF_ERROR("Unable to start the heartbeat on GPIO pin %d", gpio);
+        heartbeat.reset();
+        HeartbeatNP.s = IPS_ALERT;
+        IDSetNumber(&HeartbeatNP, nullptr);
+        return;
     }
-    return pushRoofButton(ROOF_AUX_RELAY, switchOn, true);
+    LOGF_DEBUG("Heartbeat on GPIO %d at %.1f Hz using %s, stops %.0f seconds after the driver stops renewing it",
+               gpio, options.freqHz, heartbeat->hardware() ? "hardware PWM" : "a pigpiod script",
+               HeartbeatN[HEARTBEAT_DEADLINE].value);
+    HeartbeatNP.s = IPS_OK;
+    IDSetNumber(&HeartbeatNP, nullptr);
 }
 
 /*
- * If a single button controller, whether roof is moving or stopped, the state of the external controller
- * will determine the effect on the roof. This could mean stopping, or starting in a reversed direction.
- *
- * The initial implementation using GPIO pins will only be supporting external controllers that control when
- * the roof stops moving. This implies that for buttons/relays that cause a roof motion the length of the on
- * state will temporary, less that a second. The existing polling timer will be used and the code will wait locally.
+ * Called at the end of each healthy pass of TimerHit. While the controller link is failing the renewals are
+ * withheld so the external watchdog sees the driver as down.
  */
-
-bool RollOffIno::pushRoofButton(const char* button, bool switchOn, bool ignoreLock)
+void RollOffIno::renewHeartbeat()
 {
-    bool status = false;
-    bool roofLocked = false;
-    bool found = false;
-    bool moveFunction = false;
-    bool wantHigh = false;
-    unsigned int level;
-    unsigned int gpio = 0;
-    int intervalMilli = 0;
-
-    if (!contactEstablished)
+    if (!heartbeat || communicationErrors > MAX_CNTRL_COM_ERR)
+        return;
+    if (!heartbeat->renew())
     {
-        LOG_WARN("No contact with the roof controller has been established");
-        return false;
+        if (HeartbeatNP.s != IPS_ALERT)
+            LOG_WARN("The heartbeat deadline was missed and the heartbeat stopped, it has been restarted");
+        HeartbeatNP.s = IPS_ALERT;
+        IDSetNumber(&HeartbeatNP, nullptr);
     }
-    status = getRoofLockedSwitch(&roofLocked);      // In case it has been locked since the driver connected
-    if ((!status || roofLocked) && !ignoreLock)
+    else if (HeartbeatNP.s == IPS_ALERT)
     {
-        LOG_WARN("Roof external lock state prevents roof movement");
-        return false;
+        HeartbeatNP.s = IPS_OK;
+        IDSetNumber(&HeartbeatNP, nullptr);
     }
+}
 
-    status = true;
+/*
+ * Renew the dead-man deadline of held Lock and Aux relays. Renewing every quarter of the deadline keeps the
+ * extra pigpiod traffic to one update_script every few seconds, whether the deadline passed is seen in the bank
+ * snapshot the switch reads already took. When it was missed pigpiod has already released the relays, bring
+ * the driver's view of them up to date.
+ */
+void RollOffIno::renewHeldRelays()
+{
+    if (!deadman || !deadman->holding() || communicationErrors > MAX_CNTRL_COM_ERR ||
+        msElapsed(deadmanRenewed) < HoldDeadlineN[0].value * 1000 / 4)
+        return;
+    long age = msElapsed(gpioSnapshotTime);
+    if ((age < 0 || age > SNAPSHOT_MAX_AGE_MS) && !readGpioSnapshot())
+        return;
+    gettimeofday(&deadmanRenewed, nullptr);
+    if (deadman->renew(gpioSnapshot))
+        return;
+
+    LOG_WARN("The held relay dead-man deadline was missed, held Lock and Aux relays have been released");
     for (int i = 0; i < MAX_OUT_DEFS; i++)
     {
-        for (int j = 0; j < MAX_OUT_OPS; j++)
+        for (int j = 0; j < MAX_RELAY_OPS; j++)
         {
-            if ((strcmp(button, outFunctionS[i][j].name) == 0) && (outFunctionS[i][j].s == ISS_ON))
-            {
-                if ((strcmp(button, ROOF_OPEN_RELAY) == 0) || (strcmp(button, ROOF_CLOSE_RELAY) == 0) ||
-                    (strcmp(button, ROOF_ABORT_RELAY) == 0))
-                {
-                    moveFunction = true;
-                }
-                found = true;
-                break;
-            }
+            if (outFunctionS[i][j].s != ISS_ON || !relayHeld[j])
+                continue;
+            outExpectedLevel[i] = (outActivateWhenS[i][0].s == ISS_ON) ? 0 : 1;
+            countRelay(j, false, 0);
         }
-        if (found)
-        {
-            gpio = outPinNumberN[i][0].value;
-            // switchOn true if turning relay on
-            if ((strcmp(outActivateWhenS[i][0].name, "High") == 0) && (outActivateWhenS[i][0].s == ISS_ON))
-                wantHigh = switchOn;
-            else if ((strcmp(outActivateWhenS[i][1].name, "Low") == 0) && (outActivateWhenS[i][1].s == ISS_ON))
-                wantHigh = !switchOn;
+    }
+}
 
-            for (int j = 0; j < MAX_OUT_ACTIVE_LIMIT; j++)
-            {
-                if ((outActiveLimitS[i][j].s == ISS_ON))
-                {
-                    intervalMilli = activeLimitMilli[j];
-                    if ((intervalMilli == 0) && moveFunction)
-                    {
-                        status = false;
-                        LOGF_WARN("%s needs a Active Limit interval, No Limit only available for Lock and Aux.", button);
-                    }
-                    break;
-                }
-            }
-            break;
-        }
+/*
+ * Open or close the shared memory status to match the option. The segment is named for the device, for example
+ * /dev/shm/indi_RollOff_rpi, see statusshm.h for the layout and a reader.
+ */
+void RollOffIno::openStatusShm()
+{
+    if (ShmS[SHM_ON].s != ISS_ON)
+    {
+        statusShm.close();
+        return;
     }
-    if (!found && ((strcmp(button, ROOF_OPEN_RELAY) == 0) || (strcmp(button, ROOF_CLOSE_RELAY) == 0) ||
-                   (strcmp(button, ROOF_ABORT_RELAY) == 0)))
+    std::string name = std::string("/indi_") + getDeviceName();
+    for (auto &c : name)
     {
-        LOGF_WARN("A GPIO pin definition for %s was not found.", button);
-        return false;
+        if (c == ' ')
+            c = '_';
     }
+    if (statusShm.open(name))
+    {
+        LOGF_DEBUG("Publishing roof status in shared memory %s", name.c_str());
+        publishStatus();
+        return;
+    }
+    LOGF_WARN("Unable to create the shared memory status %s: %s", name.c_str(), strerror(errno));
+    ShmSP.s = IPS_ALERT;
+}
 
-    // If a definition of the named optional relay is not found assume it is not being used.
-    if (!found && status)
-        return true;
-
-    if (found && !status)
+// The status shared with local readers, through the shared memory and the JSON socket
+RoofStatusData RollOffIno::statusData()
+{
+    RoofStatusData data {};
+    data.switches = (fullyOpenedLimitSwitch == ISS_ON ? RoofStatusData::SW_OPENED : 0) |
+                    (fullyClosedLimitSwitch == ISS_ON ? RoofStatusData::SW_CLOSED : 0) |
+                    (roofLockedSwitch == ISS_ON ? RoofStatusData::SW_LOCKED : 0) |
+                    (roofAuxiliarySwitch == ISS_ON ? RoofStatusData::SW_AUX : 0);
+    data.gpioLevels = gpioSnapshot;
+    data.domeState = getDomeState();
+    data.connected = 1;
+    data.openFraction = roofEstimator.position();
+    data.positionSigma = roofEstimator.positionSigma();
+    data.etaSeconds = -1;
+    if (motorRunning)
     {
-        LOGF_WARN("A usable GPIO pin definition for %s was not found.", button);
-        return status;
+        data.motion = (motorDir == DOME_CW) ? RoofStatusData::MOTION_OPENING : RoofStatusData::MOTION_CLOSING;
+        if (RoofTravelN[motorDir == DOME_CW ? TRAVEL_OPEN : TRAVEL_CLOSE].value > 0)
+            data.etaSeconds = std::max(0.0, expectedRunTime(motorDir) - msElapsed(motorStart) / 1000.0);
     }
+    return data;
+}
 
-    // If useTimer associate gpio pin, active hi/lo, with setting a timer to handle turning off the relay.
-    level = wantHigh ? 1 : 0;
-    //LOGF_WARN("*** GPIO write turn ON for: %s, pin: %d, level: %d, delay: %d", button, gpio, level, intervalMilli);
-    status = gpio_write(pi_id, gpio, level);
-    if (status != 0)
+std::string RollOffIno::statusJson(const RoofStatusData &data)
+{
+    const char *state = "unknown";
+    char json[512];
+
+    switch (data.domeState)
     {
-        LOGF_WARN("GPIO write failed for %s, %d, returned: %s", button, gpio, pigpio_error(status));
-        return false;
+        case DOME_IDLE:
+            state = "idle";
+            break;
+        case DOME_MOVING:
+            state = "moving";
+            break;
+        case DOME_PARKING:
+            state = "parking";
+            break;
+        case DOME_UNPARKING:
+            state = "unparking";
+            break;
+        case DOME_PARKED:
+            state = "parked";
+            break;
+        case DOME_UNPARKED:
+            state = "unparked";
+            break;
+        case DOME_ERROR:
+            state = "error";
+            break;
+        default:
+            break;
     }
-    else
+    const char *motion[] = { "none", "opening", "closing" };
+    snprintf(json, sizeof(json),
+             "{\"opened\":%s,\"closed\":%s,\"locked\":%s,\"aux\":%s,\"state\":\"%s\",\"motion\":\"%s\","
+             "\"position\":%.3f,\"sigma\":%.3f,\"eta\":%.1f}",
+             (data.switches & RoofStatusData::SW_OPENED) ? "true" : "false",
+             (data.switches & RoofStatusData::SW_CLOSED) ? "true" : "false",
+             (data.switches & RoofStatusData::SW_LOCKED) ? "true" : "false",
+             (data.switches & RoofStatusData::SW_AUX) ? "true" : "false", state, motion[data.motion], data.openFraction,
+             data.positionSigma, data.etaSeconds);
+    return json;
+}
+
+/*
+ * Hand the status to the shared memory and to JSON socket subscribers. Subscribers only get an event when the
+ * status they would see has changed.
+ */
+void RollOffIno::publishStatus()
+{
+    if (!statusShm.isOpen() && !(statusSocket && statusSocket->subscribed()))
+        return;
+    RoofStatusData data = statusData();
+    statusShm.publish(data);
+    if (statusSocket && statusSocket->subscribed())
     {
-        if (intervalMilli > 0)
+        std::string json = statusJson(data);
+        if (json != statusPushed)
         {
-            msSleep(intervalMilli);
-            level = wantHigh ? 0 : 1;
-            //LOGF_WARN("*** GPIO write turn OFF for: %s, pin: %d, level: %d, after delay of %d", button, gpio, level, intervalMilli);
-            status = gpio_write(pi_id, gpio, level);
-            if (status != 0)
-            {
-                LOGF_WARN("GPIO write reset failed for %s, %d, returned: %s", button, gpio, pigpio_error(status));
-                return false;
-            }
+            statusPushed = json;
+            statusSocket->push(json);
         }
+        else
+            metrics.add(DriverMetrics::SUPPRESSED_STATUS);
     }
-    return true;
 }
 
-bool RollOffIno::readRoofSwitch(const char* roofSwitchId, bool *result)
+/*
+ * Open the JSON socket in the INDI configuration directory, and on a localhost TCP port when one is set.
+ */
+void RollOffIno::startStatusSocket()
 {
-    bool found = false;
-    bool activeHigh = false;
-    bool activeLow = false;
-    unsigned int gpio = 0;
-    int retValue = 0;
-
-    *result = false;
+    statusSocket.reset();
+    statusPushed.clear();
+    if (JsonSocketS[JSON_SOCKET_ON].s != ISS_ON)
+        return;
 
-    if (!contactEstablished)
+    statusSocket.reset(new StatusSocket([this](const std::string &cmd) { return socketCommand(cmd); }));
+    std::string path = deviceFile(".sock");
+    if (!statusSocket->listenUnix(path))
+        LOGF_WARN("Unable to listen for JSON requests on %s: %s", path.c_str(), strerror(errno));
+    else
+        LOGF_DEBUG("Listening for JSON requests on %s", path.c_str());
+    int port = JsonPortN[0].value;
+    if (port > 0)
     {
-        LOG_WARN("No contact with the roof controller has been established");
-        return false;
+        if (!statusSocket->listenTcp(port))
+            LOGF_WARN("Unable to listen for JSON requests on localhost port %d: %s", port, strerror(errno));
+        else
+            LOGF_DEBUG("Listening for JSON requests on localhost port %d", port);
     }
+}
 
-    // For each definition entry. Find the function name that matches the name of the switch wanted.
-    // See if it is selected. If not move on to the next entry. If a match found get its gpio pin # and high|low
-    // activation indicator.
-    for (int i = 0; i < MAX_INP_DEFS; i++)
+/*
+ * Carry out one JSON socket command. Roof commands are given to ISNewSwitch as if a client had set the
+ * property, so they have the same checks, logging and state changes as any other request.
+ */
+std::string RollOffIno::socketCommand(const std::string &cmd)
+{
+    ISwitchVectorProperty *svp = nullptr;
+    ISwitch *sp = nullptr;
+
+    if (cmd == "status")
+        return "{\"ok\":true,\"status\":" + statusJson(statusData()) + "}";
+    if (cmd == "open")
     {
-        for (int j = 0; j < MAX_INP_OPS; j++)
-        {
-            if ((strcmp(roofSwitchId, inpFunctionS[i][j].name) == 0) && (inpFunctionS[i][j].s == ISS_ON))
-            {
-                found = true;
-                break;
-            }
-        }
-        if (found)
-        {
-            gpio = inpPinNumberN[i][0].value;
-            if ((strcmp(inpActivateWhenS[i][0].name, "High") == 0) && (inpActivateWhenS[i][0].s == ISS_ON))
-                activeHigh = true;
-            else if ((strcmp(inpActivateWhenS[i][1].name, "Low") == 0) && (inpActivateWhenS[i][1].s == ISS_ON))
-                activeLow = true;
-            break;
-        }
+        svp = &ParkSP;
+        sp = &ParkS[1];
     }
-    if (!found)
+    else if (cmd == "close")
     {
-        if ((strcmp(roofSwitchId, ROOF_OPENED_SWITCH) == 0) || (strcmp(roofSwitchId, ROOF_CLOSED_SWITCH) == 0))
-        {
-            LOGF_WARN("A usable GPIO pin definition for %s was not found.", roofSwitchId);
-            return false;
-        }
-            // If a definition of another switch is not found assume it is not being used.
-        else
-            return true;
+        svp = &ParkSP;
+        sp = &ParkS[0];
     }
-
-    // Read gpio pin. if high & activeHigh or low && activeLow set *result true else set *result false.
-    retValue = gpio_read(pi_id, gpio);
-    if (retValue == PI_BAD_GPIO)
+    else if (cmd == "abort")
     {
-        LOGF_WARN("GPIO read failed for %s, %d, returned: %s", roofClosing, gpio, pigpio_error(retValue));
-        return false;
+        svp = &AbortSP;
+        sp = &AbortS[0];
     }
+    else
+        return "{\"ok\":false,\"error\":\"unknown command\"}";
+
+    ISState states[1] = { ISS_ON };
+    char *names[1] = { sp->name };
+    ISNewSwitch(getDeviceName(), svp->name, states, names, 1);
+    bool ok = (svp->s != IPS_ALERT);
+    return std::string("{\"ok\":") + (ok ? "true" : "false") + ",\"status\":" + statusJson(statusData()) + "}";
+}
 
-    if ((activeHigh && retValue == 1) || (activeLow && retValue == 0))
+/*
+ * Open the link to an Arduino controller when one is selected. The controller answers the connect request
+ * once it has booted, until then the switch reads report no state. A TCP controller that cannot be reached
+ * yet does not fail the connect, the link keeps retrying in the background and the roof reports no state.
+ */
+bool RollOffIno::startLink()
+{
+    bool tcp = (LinkS[LINK_TCP].s == ISS_ON);
+
+    stopLink();
+    if ((LinkS[LINK_SERIAL].s != ISS_ON && !tcp) || isSimulation())
+        return true;
+
+    std::unique_ptr<LinkTransport> transport;
+    if (tcp)
     {
-        *result = true;
-        //LOGF_WARN("*** Reading: %s, pin: %d, value: %d, ON ***", roofSwitchId, gpio, retValue);
+        const char *colon = strrchr(LinkT[0].text, ':');
+        int port = colon ? atoi(colon + 1) : 0;
+        std::unique_ptr<TcpTransport> socket(new TcpTransport());
+        if (port <= 0 || port > 65535 || !socket->resolve(std::string(LinkT[0].text, colon - LinkT[0].text), port))
+        {
+            LOGF_ERROR("Unable to resolve the controller address %s, expected host:port", LinkT[0].text);
+            return false;
+        }
+        transport = std::move(socket);
     }
     else
+        transport.reset(new SerialTransport(LinkT[0].text, LinkBaudN[0].value));
+
+    auto protocol = static_cast<ControllerLink::Protocol>(IUFindOnSwitchIndex(&LinkProtocolSP));
+    controllerLink.reset(new ControllerLink(std::move(transport), [this](bool error, const char *message)
+    {
+        if (error)
+            LOGF_WARN("%s", message);
+        else
+            LOGF_INFO("%s", message);
+    }, protocol));
+    // The descriptor changes each time the link is reopened
+    controllerLink->onFdChange([this](int fd)
     {
-        *result = false;
-        //LOGF_WARN("*** Reading: %s, pin: %d, value: %d, OFF ***", roofSwitchId, gpio, retValue);
+        if (linkCallbackId >= 0)
+            IERmCallback(linkCallbackId);
+        linkCallbackId = (fd >= 0) ? IEAddCallback(fd, linkHelper, this) : -1;
+    });
+    if (!controllerLink->open())
+    {
+        if (tcp)
+            LOGF_WARN("Controller %s not reachable yet, retrying in the background", LinkT[0].text);
+        else
+        {
+            LOGF_ERROR("Unable to open the controller serial port %s: %s", LinkT[0].text, strerror(errno));
+            controllerLink.reset();
+            return false;
+        }
     }
+    LinkStatusN[LINK_STAT_UP].value = 0;
+    LinkStatusN[LINK_STAT_RECONNECTS].value = 0;
+    LinkStatusN[LINK_STAT_ERRORS].value = 0;
+    if (tcp)
+        LOGF_DEBUG("Controller link to %s", LinkT[0].text);
+    else
+        LOGF_DEBUG("Controller link on %s at %.0f baud", LinkT[0].text, LinkBaudN[0].value);
     return true;
 }
 
+void RollOffIno::stopLink()
+{
+    // Closing the link removes its input callback
+    controllerLink.reset();
+}
+
+/*
+ * Called at the start of each TimerHit. Errors count towards the communication error limit that stops the
+ * heartbeat and held relay renewals, the count starts again each time the link comes back.
+ */
+void RollOffIno::updateLink()
+{
+    controllerLink->poll();
+    int errors = controllerLink->takeErrors();
+    communicationErrors += errors;
+    metrics.add(DriverMetrics::LINK_ERRORS, errors);
+    if (controllerLink->reconnects() != LinkStatusN[LINK_STAT_RECONNECTS].value)
+        communicationErrors = 0;
+
+    bool answering = controllerLink->up() && controllerLink->ready();
+    if (errors == 0 && answering == (LinkStatusN[LINK_STAT_UP].value != 0) &&
+            controllerLink->reconnects() == LinkStatusN[LINK_STAT_RECONNECTS].value)
+        return;
+    LinkStatusN[LINK_STAT_UP].value = answering;
+    LinkStatusN[LINK_STAT_RECONNECTS].value = controllerLink->reconnects();
+    LinkStatusN[LINK_STAT_ERRORS].value += errors;
+    LinkStatusNP.s = answering ? IPS_OK : IPS_ALERT;
+    IDSetNumber(&LinkStatusNP, nullptr);
+}
+
+void RollOffIno::linkHelper(int fd, void *context)
+{
+    static_cast<RollOffIno *>(context)->linkReceive();
+}
+
+void RollOffIno::linkReceive()
+{
+    controllerLink->receive();
+}
+
+/*
+ * Write the metrics textfile every METRICS_WRITE_S seconds when a path is set. A failing write is reported
+ * once, until the path is changed.
+ */
+void RollOffIno::writeMetrics()
+{
+    if (MetricsT[0].text == nullptr || MetricsT[0].text[0] == '\0' || metricsFailed ||
+            (metricsWritten.tv_sec != 0 && msElapsed(metricsWritten) < METRICS_WRITE_S * 1000L))
+        return;
+    gettimeofday(&metricsWritten, nullptr);
+    if (!metrics.writeTextfile(MetricsT[0].text, getDeviceName()))
+    {
+        LOGF_WARN("Unable to write the metrics file %s: %s", MetricsT[0].text, strerror(errno));
+        metricsFailed = true;
+        MetricsTP.s = IPS_ALERT;
+        IDSetText(&MetricsTP, nullptr);
+    }
+}
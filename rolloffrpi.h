@@ -21,8 +21,26 @@
 #pragma once
 
 #include "indidome.h"
+#include "positionsensor.h"
+#include "currentsensor.h"
+#include "roofestimator.h"
+#include "pulseworker.h"
+#include "loopbackbench.h"
+#include "stepperdrive.h"
+#include "pwmdrive.h"
+#include "heartbeat.h"
+#include "deadman.h"
+#include "statusshm.h"
+#include "statussocket.h"
+#include "controllerlink.h"
+#include "metrics.h"
+#include "tracerecorder.h"
+#include "commandqueue.h"
 #include <pigpiod_if2.h>
 
+#include <atomic>
+#include <mutex>
+
 class RollOffIno : public INDI::Dome
 {
   public:
@@ -35,6 +53,7 @@ class RollOffIno : public INDI::Dome
     const char *getDefaultName() override;
     bool updateProperties() override;
     virtual bool ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n) override;
+    virtual bool ISNewText(const char *dev, const char *name, char *texts[], char *names[], int n) override;
     virtual bool saveConfigItems(FILE *fp) override;
     virtual bool ISSnoopDevice(XMLEle *root) override;
     virtual bool Handshake() override;
@@ -52,24 +71,105 @@ class RollOffIno : public INDI::Dome
 
   private:
     void updateRoofStatus();
-    bool getRoofLockedSwitch(bool*);
+    bool getRoofLockedSwitch(bool*, bool fresh = false);
     bool getRoofAuxSwitch(bool*);
     bool setRoofLock(bool switchOn);
     bool setRoofAux(bool switchOn);
-    bool readRoofSwitch(const char* roofSwitchId, bool* result);
+    bool readRoofSwitch(const char* roofSwitchId, bool* result, bool fresh = false);
+    bool readGpioSnapshot();
+    void applyGpioSnapshot(uint32_t bits);
+    RealtimeOptions realtimeOptions();
+    void startTimingThreads();
+    void updateTimingStats(bool force);
+    bool loopbackStart();
+    void startDrive();
+    void startHeartbeat();
+    void renewHeartbeat();
+    void renewHeldRelays();
+    void openStatusShm();
+    void publishStatus();
+    RoofStatusData statusData();
+    std::string statusJson(const RoofStatusData &data);
+    void startStatusSocket();
+    std::string socketCommand(const std::string &cmd);
+    void driveCheck();
+    void armLimitStop(DomeDirection dir);
+    void limitStop();
+    bool stopAvailable();
+    bool canReverse();
+    void loopbackCheck();
+    bool timingBenchStart();
+    void timingBenchCheck();
+    void startPositionSensor();
+    void updatePosition();
+    double openFraction(double mm);
+    void updateEstimate();
+    void startCurrentSensor();
+    void updateCurrent();
+    void currentTrip();
+    static void currentTripHelper(int fd, void *context);
+    int inputGpio(const char* roofSwitchId, bool* activeHigh);
+    void buildInputMasks();
+    bool voteInput(int function);
+    void countDisagreements();
+    int outputGpio(const char* button, bool* activeHigh);
+    std::string gpioUse(int gpio, bool drivePins = true);
+    void setEdgeCallbacks();
+    void cancelEdgeCallbacks();
+    uint32_t edgeMask() const;
+    void armEdgeCapture();
+    uint32_t edgeTick(int gpio, bool level);
+    static void edgeHelper(int pi, unsigned gpio, unsigned level, uint32_t tick, void *userdata);
+    void verifyOutputLevels();
+    void countRelay(int function, bool switchOn, int intervalMilli);
+    void loadRelayCounts();
+    bool saveRelayCounts();
+    std::string relayCountsFile();
+    std::string deviceFile(const char *suffix);
     bool roofOpen();
     bool roofClose();
     bool roofAbort();
+    bool singleButtonTo(int target);
+    bool singleButtonPress();
+    void singleButtonNext();
+    void singleButtonEdges(bool wasOpened, bool wasClosed, bool openedState, bool closedState);
     bool pushRoofButton(const char*, bool switchOn, bool ignoreLock);
     bool initRoofProperties();
     void gpioPinSet();
         //    bool initialContact();
         //    bool evaluateResponse(char*, bool*);
-    bool writeIno(const char*);
-    bool readIno(char*);
+    bool startLink();
+    void stopLink();
+    static void linkHelper(int fd, void *context);
+    void linkReceive();
+    void updateLink();
+    void writeMetrics();
     void msSleep(int);
     bool setupConditions();
+    double motorHeat();
+    double expectedRunTime(DomeDirection dir);
+    bool dutyAllowsMove(DomeDirection dir);
+    void motorStarted(DomeDirection dir);
+    void motorStopped();
+    void updateMotorDuty();
+    bool relayDefined(const char* button);
+    bool ventOpen(double percent);
+    void ventStop();
+    bool armStopTimer(double seconds, int action);
+    bool armStopTimerAt(const struct timespec &at, int action);
+    void timedAction();
+    IPState reverseTo(DomeDirection dir);
+    bool queueRequest(const char *name, ISState *states, char *names[], int n);
+    CommandQueue::Disposition holdMotion(int value);
+    bool runQueuedCommand();
+    void reverseStart();
+    void disarmStopTimer();
+    static void stopTimerHelper(int fd, void *context);
+    bool calibrationStart(int cycles);
+    void calibrationStep();
+    void calibrationEnd(bool success, const char *reason);
     float CalcTimeLeft(timeval);
+    long msElapsed(const timeval&);
     double MotionRequest { 0 };
     struct timeval MotionStart { 0, 0 };
     bool contactEstablished = false;
@@ -95,6 +195,40 @@ class RollOffIno : public INDI::Dome
     INumberVectorProperty RoofTimeoutNP;
     enum { EXPIRED_CLEAR, EXPIRED_OPEN, EXPIRED_CLOSE };
     unsigned int roofTimedOut;
+
+    INumber MotorDutyN[2] {};
+    INumberVectorProperty MotorDutyNP;
+    enum { DUTY_BUDGET, DUTY_COOLING };
+
+    INumber DutyStatusN[3] {};
+    INumberVectorProperty DutyStatusNP;
+    enum { DUTY_REMAINING, DUTY_HEAT, DUTY_WAIT };
+
+    // Motor heat in seconds of equivalent run time, decaying with the cooling time constant
+    double dutyHeat = 0;
+    struct timeval dutyHeatTime { 0, 0 };
+    bool motorRunning = false;
+    DomeDirection motorDir = DOME_CW;
+    struct timeval motorStart { 0, 0 };
+
+    // Travel model, seconds from the relay pulse. Learned from complete moves, can also be entered.
+    INumber RoofTravelN[3] {};
+    INumberVectorProperty RoofTravelNP;
+    enum { TRAVEL_OPEN, TRAVEL_CLOSE, TRAVEL_START };
+
+    INumber VentN[1] {};
+    INumberVectorProperty VentNP;
+    double ventTarget = 0;                      // Percent open requested for a vent move in progress
+    bool roofVented = false;                    // Stopped part open by a vent move
+    struct timespec moveCommanded {};           // CLOCK_MONOTONIC of the press or drive start that set the roof moving
+    int stopTimerFd = -1;                       // Monotonic one-shot timerfd used to end timed moves
+    int stopTimerId = -1;
+    enum { TIMER_NONE, TIMER_VENT_STOP, TIMER_REVERSE, TIMER_BUTTON };
+    int timerAction = TIMER_NONE;
+
+    INumber ReverseDelayN[1] {};
+    INumberVectorProperty ReverseDelayNP;
+    bool reversePending = false;                // Stopped, waiting out the reverse delay before starting back
     bool simRoofOpen = false;
     bool simRoofClosed = true;
     unsigned int communicationErrors = 0;
@@ -111,16 +245,20 @@ class RollOffIno : public INDI::Dome
 #define ROOF_ABORT_RELAY    "ABORT"
 #define ROOF_LOCK_RELAY     "LOCK"
 #define ROOF_AUX_RELAY      "AUXSET"
+#define ROOF_HEARTBEAT_OUT  "HEARTBEAT"
 
 #if defined ROLLOFF_RPI
 
 #define MAX_OUT_DEFS 5  // Max # of definitions of output commands
-#define MAX_OUT_OPS 6   // Open, Close, Abort, Lock, Aux-request, Unused
+#define MAX_OUT_OPS 7   // Open, Close, Abort, Lock, Aux-request, Heartbeat, Unused
+#define MAX_RELAY_OPS 5 // The leading outOps that are relays, counted for wear
 #define MAX_OUT_ACTIVE_LIMIT 5 // Max number of definitions of how long to close relay
-#define MAX_INP_DEFS 4  // Max # of definitions of input responses
+#define MAX_INP_DEFS 8  // Max # of definitions of input responses, allows redundant opened and closed switches
 #define MAX_INP_OPS 5   // Fully-opened, Fully-Closed, Locked, Aux-response, Unused
 
     const char  *GPIO_TAB = "Define GPIO";
+    const char  *DIAG_TAB = "Diagnostics";
+    const char  *SENSOR_TAB = "Sensors";
     // Labels
     const std::string functionL = "Function ";
     const std::string outPinL = "Output GPIO";
@@ -140,7 +278,7 @@ class RollOffIno : public INDI::Dome
     const std::string inpActive = "INPACT";
 
     const char* inpOps[MAX_INP_OPS] = {ROOF_OPENED_SWITCH, ROOF_CLOSED_SWITCH, ROOF_LOCKED_SWITCH, ROOF_AUX_SWITCH, "Unused"};
-    const char* outOps[MAX_OUT_OPS] = {ROOF_OPEN_RELAY, ROOF_CLOSE_RELAY, ROOF_ABORT_RELAY, ROOF_LOCK_RELAY, ROOF_AUX_RELAY, "Unused"};
+    const char* outOps[MAX_OUT_OPS] = {ROOF_OPEN_RELAY, ROOF_CLOSE_RELAY, ROOF_ABORT_RELAY, ROOF_LOCK_RELAY, ROOF_AUX_RELAY, ROOF_HEARTBEAT_OUT, "Unused"};
     const char* outActiveLimit[MAX_OUT_ACTIVE_LIMIT] = {"0.1s", "0.25s", "0.5s", "0.75s", "No Limit"};
     int activeLimitMilli[MAX_OUT_ACTIVE_LIMIT] = {100, 250, 500, 750, 0};
 
@@ -165,7 +303,246 @@ class RollOffIno : public INDI::Dome
     ISwitch inpActivateWhenS[MAX_INP_DEFS][2];
     ISwitchVectorProperty inpActivateWhenSP[MAX_INP_DEFS];
 
-    int pi_id;        // pigpiod RPi identifier
+    ISwitch OutVerifyS[2];
+    ISwitchVectorProperty OutVerifySP;
+    enum { OUT_VERIFY_ENABLE, OUT_VERIFY_DISABLE };
+
+    INumber OutVerifyN[2];
+    INumberVectorProperty OutVerifyNP;
+    enum { OUT_VERIFY_CHECKS, OUT_VERIFY_MISMATCHES };
+
+    // Activations and cumulative on time per relay function, indexed as outOps
+    INumber RelayCyclesN[MAX_RELAY_OPS];
+    INumberVectorProperty RelayCyclesNP;
+    INumber RelayOnTimeN[MAX_RELAY_OPS];
+    INumberVectorProperty RelayOnTimeNP;
+    struct timeval relayOnSince[MAX_RELAY_OPS] {};
+    bool relayHeld[MAX_RELAY_OPS] {};
+    bool relayCountsChanged = false;            // Since last published to the client
+    bool relayCountsDirty = false;              // Since last written to the counts file
+    struct timeval relayCountsSaved { 0, 0 };
+
+    ISwitch ControllerS[2];
+    ISwitchVectorProperty ControllerSP;
+    enum { CONTROLLER_SEPARATE, CONTROLLER_SINGLE };
+
+    INumber ButtonGapN[1] {};
+    INumberVectorProperty ButtonGapNP;
+
+    // Single button controller cycle: each press advances to the next state, limit switches stop it
+    enum { BUTTON_NEXT_OPEN, BUTTON_OPENING, BUTTON_NEXT_CLOSE, BUTTON_CLOSING, BUTTON_UNKNOWN };
+    int buttonState = BUTTON_UNKNOWN;
+    int buttonLastMove = BUTTON_UNKNOWN;        // Last known moving state, used when stopped between limits
+    int buttonTarget = BUTTON_UNKNOWN;          // State a series of presses is heading for
+
+    ISwitch CalibrateS[2];
+    ISwitchVectorProperty CalibrateSP;
+    enum { CALIBRATE_START, CALIBRATE_CANCEL };
+
+    INumber CalibrateN[1] {};
+    INumberVectorProperty CalibrateNP;
+
+    enum { CAL_IDLE, CAL_PREPARE, CAL_OPENING, CAL_CLOSING };
+    int calState = CAL_IDLE;
+    int calCycle = 0;
+    double calOpen = 0;                         // Sums over the completed cycles, seconds
+    double calClose = 0;
+    double calStart = 0;
+
+    // First pigpiod tick of a low (0) and high (1) edge on each GPIO since the capture was armed, 0 if none.
+    // Written from the pigpiod_if2 callback thread.
+    std::atomic<uint32_t> firstEdge[32][2] {};
+    int edgeCallbackId[32];
+
+    ISwitch SensorVoteS[3];
+    ISwitchVectorProperty SensorVoteSP;
+    enum { VOTE_ANY, VOTE_ALL, VOTE_MAJORITY };
+
+    INumber InpDisagreeN[MAX_INP_DEFS];
+    INumberVectorProperty InpDisagreeNP;
+    bool inpDisagreeChanged = false;
+
+    // Input definitions reduced to GPIO bit masks so each function is voted from the bank snapshot
+    uint32_t inpMask[MAX_INP_OPS - 1] {};       // Pins defined for each input function, indexed as inpOps
+    uint32_t inpLowMask = 0;                    // Pins that are active when low
+    int inpDefGpio[MAX_INP_DEFS];               // Pin and function of each definition, -1 if unused
+    int inpDefFunction[MAX_INP_DEFS];
+
+    ISwitch PosSensorS[3];
+    ISwitchVectorProperty PosSensorSP;
+    enum { POS_SENSOR_OFF, POS_SENSOR_PIGPIOD, POS_SENSOR_I2CDEV };
+
+    INumber PosSensorN[7] {};
+    INumberVectorProperty PosSensorNP;
+    enum { POS_BUS, POS_ADDRESS, POS_REGISTER, POS_RATE, POS_SCALE, POS_CLOSED_MM, POS_OPENED_MM };
+
+    ISwitch PosByteOrderS[2];
+    ISwitchVectorProperty PosByteOrderSP;
+    enum { POS_MSB_FIRST, POS_LSB_FIRST };
+
+    INumber RoofPositionN[2] {};
+    INumberVectorProperty RoofPositionNP;
+    enum { POSITION_PERCENT, POSITION_MM };
+
+    std::unique_ptr<PositionSensor> positionSensor;
+    uint32_t positionSamples = 0;
+    uint32_t positionErrors = 0;
+
+    ISwitch CurSensorS[3];
+    ISwitchVectorProperty CurSensorSP;
+    enum { CUR_SENSOR_OFF, CUR_SENSOR_PIGPIOD, CUR_SENSOR_SPIDEV };
+
+    INumber CurSensorN[9] {};
+    INumberVectorProperty CurSensorNP;
+    enum { CUR_SPI_CHANNEL, CUR_ADC_CHANNEL, CUR_RATE, CUR_SCALE, CUR_ZERO, CUR_OVERCURRENT, CUR_STALL, CUR_STALL_MS,
+           CUR_INRUSH_MS };
+
+    ISwitch CurTraceS[2];
+    ISwitchVectorProperty CurTraceSP;
+    enum { CUR_TRACE_OFF, CUR_TRACE_SAVE };
+
+    INumber MotorCurrentN[4] {};
+    INumberVectorProperty MotorCurrentNP;
+    enum { CURRENT_NOW, CURRENT_PEAK, CURRENT_MEAN, CURRENT_TRIPS };
+
+    INumber RoofEstimateN[3] {};
+    INumberVectorProperty RoofEstimateNP;
+    enum { ESTIMATE_POSITION, ESTIMATE_VELOCITY, ESTIMATE_SIGMA };
+    RoofEstimator roofEstimator;
+    struct timeval estimateTime { 0, 0 };
+    uint32_t estimateSamples = 0;               // Distance sensor samples already applied to the estimate
+
+    ISwitch RealtimeS[2];
+    ISwitchVectorProperty RealtimeSP;
+    enum { REALTIME_OFF, REALTIME_ON };
+
+    INumber RealtimeN[2] {};
+    INumberVectorProperty RealtimeNP;
+    enum { REALTIME_PRIORITY, REALTIME_CPU };
+
+    INumber TimingStatsN[7] {};
+    INumberVectorProperty TimingStatsNP;
+    enum { TIMING_PULSES, TIMING_PULSE_P50, TIMING_PULSE_P99, TIMING_PULSE_MAX, TIMING_WAKE_P50, TIMING_WAKE_P99,
+           TIMING_WAKE_MAX };
+
+    ISwitch TimingBenchS[2];
+    ISwitchVectorProperty TimingBenchSP;
+    enum { TIMING_BENCHMARK, TIMING_RESET };
+
+    // Median, 99th percentile and maximum of the benchmark pulse width error and edge detection latency
+    INumber TimingBenchN[7] {};
+    INumberVectorProperty TimingBenchNP;
+    enum { BENCH_WIDTH_P50, BENCH_WIDTH_P99, BENCH_WIDTH_MAX, BENCH_LATENCY_P50, BENCH_LATENCY_P99, BENCH_LATENCY_MAX,
+           BENCH_MISSED };
+
+    ISwitch TraceS[2];
+    ISwitchVectorProperty TraceSP;
+    enum { TRACE_OFF, TRACE_ON };
+    ISwitch TraceExportS[1];
+    ISwitchVectorProperty TraceExportSP;
+    TraceRecorder trace;
+
+    CommandQueue commands;
+    struct timeval motorStopTime { 0, 0 };
+
+    std::unique_ptr<PulseWorker> pulseWorker;
+    struct timeval timingStatsTime { 0, 0 };
+
+    INumber LoopbackN[5] {};
+    INumberVectorProperty LoopbackNP;
+    enum { LOOP_OUT_GPIO, LOOP_IN_GPIO, LOOP_PULSE_MS, LOOP_COUNT, LOOP_LOAD };
+
+    ISwitch LoopbackS[2];
+    ISwitchVectorProperty LoopbackSP;
+    enum { LOOP_START, LOOP_CANCEL };
+
+    // Median, 99th percentile and maximum error, and missed pulses, for each LoopbackBenchmark mechanism
+    INumber LoopResultN[LoopbackBenchmark::MECH_COUNT * 4] {};
+    INumberVectorProperty LoopResultNP;
+    std::unique_ptr<LoopbackBenchmark> loopbackBench;
+
+    ISwitch DriveS[3];
+    ISwitchVectorProperty DriveSP;
+    enum { DRIVE_RELAYS, DRIVE_STEPPER, DRIVE_PWM };
+
+    INumber StepperN[7] {};
+    INumberVectorProperty StepperNP;
+    enum { STEP_GPIO, STEP_DIR_GPIO, STEP_TRAVEL, STEP_START_HZ, STEP_MAX_HZ, STEP_ACCEL, STEP_PULSE_US };
+
+    ISwitch StepDirS[2];
+    ISwitchVectorProperty StepDirSP;
+    enum { STEP_DIR_OPEN_HIGH, STEP_DIR_OPEN_LOW };
+
+    INumber StepPositionN[1] {};
+    INumberVectorProperty StepPositionNP;
+    std::unique_ptr<StepperDrive> stepperDrive;
+
+    INumber PwmN[7] {};
+    INumberVectorProperty PwmNP;
+    enum { PWM_GPIO, PWM_DIR_GPIO, PWM_FREQ, PWM_MAX_DUTY, PWM_CREEP_DUTY, PWM_ACCEL_MS, PWM_DECEL_MS };
+    std::unique_ptr<PwmDrive> pwmDrive;
+
+    // Inputs of the limit switch the drive is heading for and which of them are active low. The edge callback
+    // stops the drive when the first of them becomes active, without waiting for the status tick.
+    std::atomic<uint32_t> limitStopMask { 0 };
+    std::atomic<uint32_t> limitStopLow { 0 };
+    std::atomic<bool> limitStopped { false };
+    std::mutex driveMutex;                      // Held by the callback using a drive and while one is replaced
+
+    INumber HeartbeatN[2] {};
+    INumberVectorProperty HeartbeatNP;
+    enum { HEARTBEAT_FREQ, HEARTBEAT_DEADLINE };
+    std::unique_ptr<Heartbeat> heartbeat;
+
+    INumber HoldDeadlineN[1] {};
+    INumberVectorProperty HoldDeadlineNP;
+    std::unique_ptr<DeadmanRelays> deadman;
+    struct timeval deadmanRenewed { 0, 0 };
+
+    ISwitch ShmS[2];
+    ISwitchVectorProperty ShmSP;
+    enum { SHM_OFF, SHM_ON };
+    StatusShm statusShm;
+
+    ISwitch JsonSocketS[2];
+    ISwitchVectorProperty JsonSocketSP;
+    enum { JSON_SOCKET_OFF, JSON_SOCKET_ON };
+    INumber JsonPortN[1] {};
+    INumberVectorProperty JsonPortNP;
+    std::unique_ptr<StatusSocket> statusSocket;
+    std::string statusPushed;                   // Last status sent to subscribers
+
+    IText MetricsT[1] {};
+    ITextVectorProperty MetricsTP;
+    DriverMetrics metrics;
+    struct timeval metricsWritten { 0, 0 };
+    bool metricsFailed = false;
+
+    // Roof switches and relays on an Arduino controller rather than GPIO pins
+    ISwitch LinkS[3];
+    ISwitchVectorProperty LinkSP;
+    enum { LINK_GPIO, LINK_SERIAL, LINK_TCP };
+    IText LinkT[1] {};
+    ITextVectorProperty LinkTP;
+    INumber LinkBaudN[1] {};
+    INumberVectorProperty LinkBaudNP;
+    ISwitch LinkProtocolS[2];
+    ISwitchVectorProperty LinkProtocolSP;
+    INumber LinkStatusN[3] {};
+    INumberVectorProperty LinkStatusNP;
+    enum { LINK_STAT_UP, LINK_STAT_RECONNECTS, LINK_STAT_ERRORS };
+    std::unique_ptr<ControllerLink> controllerLink;
+    int linkCallbackId = -1;
+
+    std::unique_ptr<CurrentSensor> currentSensor;
+    int currentTripId = -1;                     // Event loop callback on the sensor trip eventfd
+
+    uint32_t gpioSnapshot = 0;                  // Levels of GPIO 0-31 from the last read_bank_1
+    struct timeval gpioSnapshotTime { 0, 0 };
+    int outExpectedLevel[MAX_OUT_DEFS];         // Level last written to each output, -1 if not yet written
+    bool outMismatch[MAX_OUT_DEFS] {};
+
+    int pi_id = -1;   // pigpiod RPi identifier, -1 when there is no session
     bool roofPropInit = false;
 };
 
@@ -0,0 +1,86 @@
+/*
+ Roof position and velocity estimate fused from the available sources
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "roofestimator.h"
+
+#include <cmath>
+
+void RoofEstimator::reset(double position, double variance)
+{
+    x[0] = position;
+    x[1] = 0;
+    P[0][0] = variance;
+    P[0][1] = P[1][0] = 0;
+    P[1][1] = 0;
+}
+
+void RoofEstimator::predict(double dt)
+{
+    if (dt <= 0)
+        return;
+
+    // Constant velocity model, P = F P F' + Q with F = [1 dt; 0 1]
+    x[0] += x[1] * dt;
+    double p00 = P[0][0] + dt * (P[1][0] + P[0][1]) + dt * dt * P[1][1];
+    double p01 = P[0][1] + dt * P[1][1];
+    P[0][0] = p00 + ACCEL_NOISE * dt * dt * dt / 3;
+    P[0][1] = P[1][0] = p01 + ACCEL_NOISE * dt * dt / 2;
+    P[1][1] += ACCEL_NOISE * dt;
+
+    // The roof cannot travel past its limits
+    if (x[0] < 0)
+        x[0] = 0;
+    else if (x[0] > 1)
+        x[0] = 1;
+}
+
+void RoofEstimator::measurePosition(double position, double variance)
+{
+    update(0, position, variance);
+}
+
+void RoofEstimator::measureVelocity(double velocity, double variance)
+{
+    update(1, velocity, variance);
+}
+
+// Scalar update of one observed state
+void RoofEstimator::update(int state, double z, double variance)
+{
+    double s = P[state][state] + variance;
+    if (s <= 0)
+        return;
+    double k0 = P[0][state] / s;
+    double k1 = P[1][state] / s;
+    double innovation = z - x[state];
+    x[0] += k0 * innovation;
+    x[1] += k1 * innovation;
+
+    // P = (I - K H) P, H selects the observed state
+    double ps0 = P[state][0];
+    double ps1 = P[state][1];
+    P[0][0] -= k0 * ps0;
+    P[0][1] -= k0 * ps1;
+    P[1][0] -= k1 * ps0;
+    P[1][1] -= k1 * ps1;
+}
+
+double RoofEstimator::positionSigma() const
+{
+    return P[0][0] > 0 ? std::sqrt(P[0][0]) : 0;
+}
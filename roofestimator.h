@@ -0,0 +1,51 @@
+/*
+ Roof position and velocity estimate fused from the available sources
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+/*
+ * Two state Kalman filter over the roof position, as a fraction open from 0 to 1, and its velocity in
+ * fractions per second. Each source is applied as it arrives: the timing model as a velocity, limit
+ * switches and the distance sensor as positions. The state is a fixed pair of values and a 2x2 covariance
+ * so updates never allocate.
+ */
+class RoofEstimator
+{
+  public:
+    RoofEstimator() { reset(0.5, 1.0 / 12); }
+
+    // Start again from a position and its variance, with the roof assumed stationary
+    void reset(double position, double variance);
+    // Advance the estimate by dt seconds
+    void predict(double dt);
+    void measurePosition(double position, double variance);
+    void measureVelocity(double velocity, double variance);
+
+    double position() const { return x[0]; }
+    double velocity() const { return x[1]; }
+    double positionSigma() const;
+
+  private:
+    void update(int state, double z, double variance);
+
+    // Acceleration noise, (fraction/s^2)^2 per second. Allows a 20 second roof to start or stop within a second.
+    static constexpr double ACCEL_NOISE = 0.0025;
+
+    double x[2];
+    double P[2][2];
+};
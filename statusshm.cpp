@@ -0,0 +1,87 @@
+/*
+ Roof status in POSIX shared memory for local readers
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "statusshm.h"
+
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+bool StatusShm::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, sizeof(RoofStatusShm)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, sizeof(RoofStatusShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    // A driver that died part way through an update leaves seq odd. Start from odd whatever was left, so the
+    // initialisation is itself an update readers retry across, and leave seq even once it is done.
+    shm = static_cast<RoofStatusShm *>(map);
+    uint32_t seq = shm->seq.load(std::memory_order_relaxed) | 1;
+    shm->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    // Readers check magic and version first, so mark the header invalid until the rest is in place
+    shm->magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    shm->version = ROOF_SHM_VERSION;
+    shm->size = sizeof(RoofStatusData);
+    memset(&shm->data, 0, sizeof(shm->data));
+    shm->data.etaSeconds = -1;
+    std::atomic_thread_fence(std::memory_order_release);
+    shm->magic = ROOF_SHM_MAGIC;
+    shm->seq.store(seq + 1, std::memory_order_release);
+    updates = 0;
+    return true;
+}
+
+void StatusShm::close()
+{
+    if (shm == nullptr)
+        return;
+    RoofStatusData data = shm->data;
+    data.connected = 0;
+    publish(data);
+    munmap(shm, sizeof(RoofStatusShm));
+    shm = nullptr;
+}
+
+void StatusShm::publish(const RoofStatusData &data)
+{
+    if (shm == nullptr)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint32_t seq = shm->seq.load(std::memory_order_relaxed);
+    shm->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&shm->data, &data, sizeof(data));
+    shm->data.updatedNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    shm->data.updates = ++updates;
+    shm->seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,107 @@
+/*
+ Roof status in POSIX shared memory for local readers
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define ROOF_SHM_MAGIC      0x52464f52      // "ROFR"
+#define ROOF_SHM_VERSION    1
+
+/*
+ * The status published to other local processes. Fields are only ever appended, so the segment's size says
+ * how much of this a writer filled in. A reader built against an older version reads the part it knows, one
+ * built against a newer version gets zero in the fields the writer did not have.
+ */
+struct RoofStatusData
+{
+    enum { SW_OPENED = 1, SW_CLOSED = 2, SW_LOCKED = 4, SW_AUX = 8 };
+    enum { MOTION_NONE, MOTION_OPENING, MOTION_CLOSING };
+
+    uint32_t switches;          // SW_ bits from the voted limit, lock and aux inputs
+    uint32_t gpioLevels;        // Raw levels of GPIO 0-31 at the last bank read
+    int32_t domeState;          // INDI::Dome::DomeState
+    int32_t motion;             // MOTION_ value
+    int32_t connected;          // Zero once the driver has disconnected, the other fields are then stale
+    int32_t reserved;
+    double openFraction;        // Estimated position, 0 closed to 1 opened
+    double positionSigma;       // Standard deviation of the estimate, as a fraction of travel
+    double etaSeconds;          // Expected time to the limit while moving, negative when unknown
+    int64_t updatedNs;          // CLOCK_REALTIME of the update
+    uint64_t updates;           // Count of updates since the segment was created
+};
+
+/*
+ * Layout of the segment. seq is odd while the driver writes, readers retry until they see the same even
+ * value before and after copying the data.
+ */
+struct RoofStatusShm
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;              // sizeof(RoofStatusData) as written
+    std::atomic<uint32_t> seq;
+    uint32_t pad;
+    RoofStatusData data;
+};
+
+/*
+ * Consumer side copy of the status, header only so tools need nothing else. Returns false if the segment
+ * is not a roof status or the writer kept it busy for every retry. shm need only be mapped as far as the
+ * reader's own RoofStatusShm or the writer's size, whichever is smaller.
+ */
+inline bool readRoofStatus(const RoofStatusShm *shm, RoofStatusData *out, int retries = 100)
+{
+    if (shm->magic != ROOF_SHM_MAGIC || shm->version < 1 || shm->size == 0)
+        return false;
+    size_t known = shm->size < sizeof(*out) ? shm->size : sizeof(*out);
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < retries; i++)
+    {
+        uint32_t before = shm->seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(out, &shm->data, known);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shm->seq.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Writer side, owned by the driver. The segment is /dev/shm/<name> and is left in place on close with
+ * connected cleared, so readers see the driver went away rather than a missing file.
+ */
+class StatusShm
+{
+  public:
+    ~StatusShm() { close(); }
+
+    bool open(const std::string &name);
+    void close();
+    bool isOpen() const { return shm != nullptr; }
+    void publish(const RoofStatusData &data);
+
+  private:
+    RoofStatusShm *shm = nullptr;
+    uint64_t updates = 0;
+};
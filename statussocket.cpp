@@ -0,0 +1,271 @@
+/*
+ Local JSON status and command socket
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "statussocket.h"
+
+#include <indidevapi.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_CLIENTS     16
+#define MAX_LINE        1024            // Longest request accepted, a longer one closes the connection
+#define MAX_PENDING     65536           // Unsent replies and events before a slow client is dropped
+
+StatusSocket::~StatusSocket()
+{
+    while (!clients.empty())
+        drop(clients.back().get());
+    for (int id : listenIds)
+        IERmCallback(id);
+    for (int fd : listenFds)
+        close(fd);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+bool StatusSocket::listenUnix(const std::string &path)
+{
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());       // Left behind if the driver was killed
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    unixPath = path;
+    listenFds.push_back(fd);
+    listenIds.push_back(IEAddCallback(fd, acceptHelper, this));
+    return true;
+}
+
+bool StatusSocket::listenTcp(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    listenFds.push_back(fd);
+    listenIds.push_back(IEAddCallback(fd, acceptHelper, this));
+    return true;
+}
+
+void StatusSocket::acceptHelper(int fd, void *context)
+{
+    static_cast<StatusSocket *>(context)->accept(fd);
+}
+
+void StatusSocket::readHelper(int fd, void *context)
+{
+    Client *client = static_cast<Client *>(context);
+    client->server->read(client);
+}
+
+void StatusSocket::accept(int fd)
+{
+    int conn = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn < 0)
+        return;
+    if (clients.size() >= MAX_CLIENTS)
+    {
+        close(conn);
+        return;
+    }
+    std::unique_ptr<Client> client(new Client { this, conn, -1, false, false, std::string(), std::string() });
+    client->callbackId = IEAddCallback(conn, readHelper, client.get());
+    clients.push_back(std::move(client));
+}
+
+void StatusSocket::read(Client *client)
+{
+    char buf[512];
+
+    ssize_t n = recv(client->fd, buf, sizeof(buf), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        drop(client);
+        return;
+    }
+    if (n < 0)
+        return;
+    client->in.append(buf, n);
+
+    // Answer every complete line, pipelined requests arrive together. A handler can publish status and so drop
+    // any client, this one included, those are only freed once the requests are answered.
+    size_t start = 0;
+    size_t end;
+    dispatching++;
+    while (!client->dropped && (end = client->in.find('\n', start)) != std::string::npos)
+    {
+        std::string line = client->in.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            request(client, line);
+    }
+    dispatching--;
+    if (!client->dropped)
+    {
+        client->in.erase(0, start);
+        if (client->in.size() > MAX_LINE)
+            drop(client);
+    }
+    reap();
+}
+
+// The string value of key in a flat JSON object, or the raw token for other values
+static std::string jsonField(const std::string &line, const char *key)
+{
+    std::string quoted = std::string("\"") + key + "\"";
+    size_t at = line.find(quoted);
+    if (at == std::string::npos || (at = line.find(':', at + quoted.size())) == std::string::npos)
+        return std::string();
+    at = line.find_first_not_of(" \t", at + 1);
+    if (at == std::string::npos)
+        return std::string();
+    if (line[at] == '"')
+    {
+        size_t close = line.find('"', at + 1);
+        return close == std::string::npos ? std::string() : line.substr(at, close - at + 1);
+    }
+    size_t close = line.find_first_of(",} \t", at);
+    return line.substr(at, close == std::string::npos ? std::string::npos : close - at);
+}
+
+void StatusSocket::request(Client *client, const std::string &line)
+{
+    std::string cmd;
+    std::string id;
+
+    if (line[0] == '{')
+    {
+        cmd = jsonField(line, "cmd");
+        if (cmd.size() >= 2 && cmd.front() == '"')
+            cmd = cmd.substr(1, cmd.size() - 2);
+        id = jsonField(line, "id");
+        // Echoed back as is, so only plain numbers and strings without escapes
+        bool plain = !id.empty() && (id[0] == '"' ? id.find('\\') == std::string::npos
+                                                  : id.find_first_not_of("-0123456789") == std::string::npos);
+        if (!plain)
+            id.clear();
+    }
+    else
+        cmd = line.substr(0, line.find_first_of(" \t"));
+
+    std::string reply;
+    if (cmd == "subscribe" || cmd == "unsubscribe")
+    {
+        client->subscribed = (cmd == "subscribe");
+        reply = handle("status");
+    }
+    else
+        reply = handle(cmd);
+    if (client->dropped)
+        return;
+    // The command is echoed inside quotes, so one that would need escaping is not
+    if (cmd.find_first_of("\"\\") != std::string::npos)
+        cmd = "?";
+    send(client, "{\"id\":" + (id.empty() ? std::string("null") : id) + ",\"cmd\":\"" + cmd + "\",\"reply\":" + reply + "}");
+}
+
+void StatusSocket::send(Client *client, const std::string &line)
+{
+    client->out += line;
+    client->out += '\n';
+    ssize_t n = ::send(client->fd, client->out.data(), client->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0)
+        client->out.erase(0, n);
+    else if (n < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        drop(client);
+        return;
+    }
+    // There is no write callback in the event loop, a client that stops reading is eventually dropped
+    if (client->out.size() > MAX_PENDING)
+        drop(client);
+}
+
+void StatusSocket::push(const std::string &status)
+{
+    // Collected first since send() may drop clients
+    std::vector<Client *> targets;
+    for (auto &client : clients)
+    {
+        if (client->subscribed && !client->dropped)
+            targets.push_back(client.get());
+    }
+    for (Client *client : targets)
+    {
+        if (!client->dropped)
+            send(client, "{\"event\":\"status\",\"status\":" + status + "}");
+    }
+}
+
+bool StatusSocket::subscribed() const
+{
+    return std::any_of(clients.begin(), clients.end(),
+                       [](const std::unique_ptr<Client> &c) { return c->subscribed && !c->dropped; });
+}
+
+void StatusSocket::drop(Client *client)
+{
+    if (client->dropped)
+        return;
+    IERmCallback(client->callbackId);
+    close(client->fd);
+    client->dropped = true;
+    if (dispatching == 0)
+        reap();
+}
+
+void StatusSocket::reap()
+{
+    if (dispatching > 0)
+        return;
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [](const std::unique_ptr<Client> &c) { return c->dropped; }),
+                  clients.end());
+}
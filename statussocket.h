@@ -0,0 +1,77 @@
+/*
+ Local JSON status and command socket
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Serves roof status and accepts roof commands as one JSON object per line, on a Unix domain socket and
+ * optionally a TCP port bound to localhost. A request is {"cmd":"status"} with an optional "id" that is
+ * echoed in the reply, or just the bare command word. Requests on one connection are answered in order, so
+ * clients may send several without waiting. "subscribe" makes the connection receive a status event each
+ * time push() is called, "unsubscribe" stops them.
+ *
+ * Everything runs in the INDI event loop through IEAddCallback, so the handler can use the driver directly.
+ */
+class StatusSocket
+{
+  public:
+    // Returns the reply for one command as a JSON object
+    using Handler = std::function<std::string(const std::string &cmd)>;
+
+    explicit StatusSocket(Handler handler) : handle(std::move(handler)) {}
+    ~StatusSocket();
+
+    bool listenUnix(const std::string &path);
+    bool listenTcp(int port);
+    // Send a status event to subscribed connections
+    void push(const std::string &status);
+    bool subscribed() const;
+
+  private:
+    struct Client
+    {
+        StatusSocket *server;
+        int fd;
+        int callbackId;
+        bool subscribed;
+        bool dropped;               // Closed while a request was handled, freed by reap()
+        std::string in;
+        std::string out;
+    };
+
+    static void acceptHelper(int fd, void *context);
+    static void readHelper(int fd, void *context);
+    void accept(int fd);
+    void read(Client *client);
+    void request(Client *client, const std::string &line);
+    void send(Client *client, const std::string &line);
+    void drop(Client *client);
+    void reap();
+
+    Handler handle;
+    std::string unixPath;
+    std::vector<int> listenFds;
+    std::vector<int> listenIds;
+    std::vector<std::unique_ptr<Client>> clients;
+    int dispatching { 0 };
+};
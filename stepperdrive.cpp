@@ -0,0 +1,316 @@
+/*
+ Step and direction roof drive using pigpiod waveforms
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "stepperdrive.h"
+
+#include <pigpiod_if2.h>
+
+#include <algorithm>
+#include <cmath>
+
+#define DIR_SETUP_US    20          // Delay between setting the direction and the first step
+#define MAX_CHAIN       600         // Bytes of wave_chain commands, ample for MAX_SEGMENTS segments
+
+StepperDrive::StepperDrive(int pi, TraceRecorder &recorder) : pi_id(pi), trace(recorder)
+{
+    std::fill(levelWave, levelWave + RAMP_LEVELS + 1, -1);
+}
+
+StepperDrive::~StepperDrive()
+{
+    if (moving)
+        wave_tx_stop(pi_id);
+    deleteWaves();
+}
+
+bool StepperDrive::configure(const Options &options)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    stop(true);
+    deleteWaves();
+    opts = options;
+    opts.startHz = std::max(1.0, opts.startHz);
+    opts.maxHz = std::max(opts.startHz, opts.maxHz);
+    TraceSpan span(trace, "set_mode", "stepper");
+    configured = (set_mode(pi_id, opts.stepGpio, PI_OUTPUT) == 0 && set_mode(pi_id, opts.dirGpio, PI_OUTPUT) == 0);
+    if (configured)
+        gpio_write(pi_id, opts.stepGpio, 0);
+    return configured;
+}
+
+void StepperDrive::setPosition(long steps)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pos = steps;
+    known = true;
+}
+
+/*
+ * Ramp levels from the start rate to peak, each held for the steps that constant acceleration takes to pass
+ * through it. One step waveform is created for every level.
+ */
+bool StepperDrive::createWaves(double peak)
+{
+    deleteWaves();
+    TraceSpan span(trace, "wave_create", "stepper");
+    levels = (peak > opts.startHz * 1.05) ? RAMP_LEVELS : 0;
+    for (int i = 0; i <= levels; i++)
+    {
+        double lo = opts.startHz + (peak - opts.startHz) * i / std::max(levels, 1);
+        double hi = opts.startHz + (peak - opts.startHz) * (i + 1) / std::max(levels, 1);
+        levelRate[i] = (i == levels) ? peak : (lo + hi) / 2;
+        if (i < levels)
+            levelSteps[i] = std::max(1L, (long)std::ceil((hi * hi - lo * lo) / (2 * opts.accel)));
+
+        uint32_t period = std::max<uint32_t>((uint32_t)(1e6 / levelRate[i]), 2 * opts.pulseUs);
+        gpioPulse_t step[2] = { { 1u << opts.stepGpio, 0, opts.pulseUs }, { 0, 1u << opts.stepGpio, period - opts.pulseUs } };
+        wave_add_new(pi_id);
+        levelWave[i] = -1;
+        if (wave_add_generic(pi_id, 2, step) < 0 || (levelWave[i] = wave_create(pi_id)) < 0)
+        {
+            levels = i;
+            deleteWaves();
+            return false;
+        }
+    }
+    return true;
+}
+
+void StepperDrive::deleteWaves()
+{
+    TraceSpan span(trace, "wave_delete", "stepper");
+    for (int i = 0; i <= levels; i++)
+    {
+        if (levelWave[i] >= 0)
+            wave_delete(pi_id, levelWave[i]);
+        levelWave[i] = -1;
+    }
+    levels = 0;
+    levelWave[0] = -1;
+}
+
+/*
+ * Plan a move of steps from rest. The peak rate is lowered until the acceleration and deceleration ramps fit,
+ * and until each ramp level fits in a single chain loop.
+ */
+bool StepperDrive::plan(long steps, int firstLevel)
+{
+    double peak = opts.maxHz;
+    long ramp = 0;
+    for (int attempt = 0; attempt < 40; attempt++)
+    {
+        ramp = (long)std::ceil((peak * peak - opts.startHz * opts.startHz) / (2 * opts.accel)) + RAMP_LEVELS;
+        double below = peak - (peak - opts.startHz) / RAMP_LEVELS;
+        bool levelFits = (peak * peak - below * below) / (2 * opts.accel) < MAX_REPEAT;
+        if ((2 * ramp <= steps && levelFits) || peak <= opts.startHz)
+            break;
+        peak = std::max(opts.startHz, peak * 0.9);
+    }
+    if (!createWaves(peak))
+        return false;
+
+    segmentCount = 0;
+    long left = steps;
+    for (int i = firstLevel; i < levels && left > 0; i++)
+    {
+        long n = std::min(levelSteps[i], left / 2);
+        if (n > 0)
+            segments[segmentCount++] = { levelWave[i], levelRate[i], n };
+        left -= 2 * n;
+    }
+    int accelSegments = segmentCount;
+    if (left > 0)
+        segments[segmentCount++] = { levelWave[levels], levelRate[levels], left };
+    for (int i = accelSegments - 1; i >= 0; i--)
+        segments[segmentCount++] = segments[i];
+    return true;
+}
+
+// Send the planned segments as one wave chain. False if the plan needs more loops than pigpiod allows.
+bool StepperDrive::send(int dir)
+{
+    uint8_t chain[MAX_CHAIN];
+    unsigned len = 0;
+    int counters = 0;
+
+    chain[len++] = 255;
+    chain[len++] = 2;
+    chain[len++] = DIR_SETUP_US;
+    chain[len++] = 0;
+    for (int s = 0; s < segmentCount; s++)
+    {
+        // A loop repeats at most MAX_REPEAT times. A longer run nests a second loop around one of the full
+        // length, and a third loop takes the remainder.
+        long outer = segments[s].steps / MAX_REPEAT;
+        long rest = segments[s].steps % MAX_REPEAT;
+        counters += (outer > 0 ? 2 : 0) + (rest > 0 ? 1 : 0);
+        if (outer > MAX_REPEAT || counters > MAX_COUNTERS || len + 20 > MAX_CHAIN)
+            return false;
+        if (outer > 0)
+        {
+            uint8_t loop[] = { 255, 0, 255, 0, (uint8_t)segments[s].wave, 255, 1, MAX_REPEAT & 0xff, MAX_REPEAT >> 8,
+                               255, 1, (uint8_t)(outer & 0xff), (uint8_t)(outer >> 8) };
+            std::copy(loop, loop + sizeof(loop), chain + len);
+            len += sizeof(loop);
+        }
+        if (rest > 0)
+        {
+            uint8_t loop[] = { 255, 0, (uint8_t)segments[s].wave, 255, 1, (uint8_t)(rest & 0xff), (uint8_t)(rest >> 8) };
+            std::copy(loop, loop + sizeof(loop), chain + len);
+            len += sizeof(loop);
+        }
+    }
+    {
+        TraceSpan span(trace, "wave_chain", "stepper");
+        gpio_write(pi_id, opts.dirGpio, (dir > 0) == opts.dirOpenHigh ? 1 : 0);
+        if (wave_chain(pi_id, reinterpret_cast<char *>(chain), len) != 0)
+            return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &moveStart);
+    moveDir = dir;
+    moveFrom = pos;
+    moving = true;
+    return true;
+}
+
+bool StepperDrive::moveTo(long target)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!configured || halted)
+        return false;
+    // A decelerating stop still in progress is cut short, its waves are replaced by the new plan
+    stop(true);
+    target = std::min(std::max(target, 0L), opts.travel);
+    long steps = std::labs(target - pos);
+    if (steps == 0)
+        return true;
+    if (!plan(steps, 0))
+        return false;
+    return send(target > pos ? 1 : -1);
+}
+
+// Steps completed so far, from the time since the chain started walked through the plan
+long StepperDrive::stepsDone()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double t = (now.tv_sec - moveStart.tv_sec) + (now.tv_nsec - moveStart.tv_nsec) / 1e9 - DIR_SETUP_US / 1e6;
+    long done = 0;
+    for (int s = 0; s < segmentCount && t > 0; s++)
+    {
+        double length = segments[s].steps / segments[s].rate;
+        if (t >= length)
+            done += segments[s].steps;
+        else
+            done += (long)(t * segments[s].rate);
+        t -= length;
+    }
+    return done;
+}
+
+bool StepperDrive::busy()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!moving)
+        return false;
+    {
+        TraceSpan span(trace, "wave_tx_busy", "stepper");
+        if (wave_tx_busy(pi_id) == 1)
+            return true;
+    }
+    long total = 0;
+    for (int s = 0; s < segmentCount; s++)
+        total += segments[s].steps;
+    pos = moveFrom + moveDir * total;
+    moving = false;
+    return false;
+}
+
+long StepperDrive::position()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (busy())
+        return moveFrom + moveDir * stepsDone();
+    return pos;
+}
+
+// Level of the acceleration ramp at or below rate
+int StepperDrive::levelAt(double rate)
+{
+    int level = 0;
+    while (level < levels && levelRate[level] < rate)
+        level++;
+    return level;
+}
+
+void StepperDrive::stop(bool immediate)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!busy())
+        return;
+
+    // Rate now, from the segment the plan puts the chain in
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double t = (now.tv_sec - moveStart.tv_sec) + (now.tv_nsec - moveStart.tv_nsec) / 1e9;
+    double rate = opts.startHz;
+    for (int s = 0; s < segmentCount; s++)
+    {
+        rate = segments[s].rate;
+        t -= segments[s].steps / segments[s].rate;
+        if (t <= 0)
+            break;
+    }
+    long done = stepsDone();
+    {
+        TraceSpan span(trace, "wave_tx_stop", "stepper");
+        wave_tx_stop(pi_id);
+    }
+    pos = moveFrom + moveDir * done;
+    moving = false;
+    if (immediate || rate <= opts.startHz * 1.05)
+        return;
+
+    // Decelerate through the ramp levels below the present rate, the waves are still defined
+    int level = levelAt(rate);
+    segmentCount = 0;
+    long steps = 0;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        segments[segmentCount++] = { levelWave[i], levelRate[i], levelSteps[i] };
+        steps += levelSteps[i];
+    }
+    long limit = (moveDir > 0) ? opts.travel - pos : pos;
+    if (segmentCount == 0 || steps > limit || halted)
+        return;
+    // The motor is already stopped if the deceleration chain is refused
+    send(moveDir);
+}
+
+void StepperDrive::halt()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    halted = true;
+    stop(true);
+}
+
+void StepperDrive::clearHalt()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    halted = false;
+}
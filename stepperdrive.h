@@ -0,0 +1,108 @@
+/*
+ Step and direction roof drive using pigpiod waveforms
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include "tracerecorder.h"
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+
+/*
+ * Drives a stepper or servo driver through step and direction pins. Each move is planned as a trapezoidal
+ * profile of a few constant rate segments. Every rate gets a one step pigpiod waveform, and wave_chain repeats
+ * them the planned number of times, so the daemon DMA produces every step and the driver does no per step
+ * work. The position is counted in steps from the plan and the time since the chain started, and moves
+ * are limited to 0 (closed) through the travel (opened). halt() may be called from another thread, such as
+ * the pigpiod_if2 callback thread when a limit switch is reached, and blocks further moves until clearHalt().
+ */
+class StepperDrive
+{
+  public:
+    struct Options
+    {
+        unsigned stepGpio { 0 };
+        unsigned dirGpio { 0 };
+        bool dirOpenHigh { true };
+        long travel { 10000 };          // Steps from closed to opened
+        double startHz { 200 };         // Rate the motor can start and stop at without a ramp
+        double maxHz { 10000 };
+        double accel { 10000 };         // Steps per second squared
+        unsigned pulseUs { 5 };         // Step pulse width
+    };
+
+    StepperDrive(int pi, TraceRecorder &recorder);
+    ~StepperDrive();
+
+    bool configure(const Options &options);
+    // Start moving to target, clamped to the soft limits. Any move in progress is stopped first.
+    bool moveTo(long target);
+    // Stop, decelerating through the ramp unless immediate
+    void stop(bool immediate);
+    // Stop at once and refuse moves until clearHalt()
+    void halt();
+    void clearHalt();
+    bool busy();
+    long position();
+    bool positionKnown() const { return known; }
+    void setPosition(long steps);
+    long travel() const { return opts.travel; }
+
+  private:
+    // pigpiod allows 20 loop counters in a chain. Each ramp segment takes one, the peak rate segment up to three.
+    static constexpr int MAX_COUNTERS = 20;
+    static constexpr int RAMP_LEVELS = (MAX_COUNTERS - 3) / 2;
+    static constexpr int MAX_SEGMENTS = 2 * RAMP_LEVELS + 1;
+    static constexpr long MAX_REPEAT = 65535;
+
+    struct Segment
+    {
+        int wave;
+        double rate;
+        long steps;
+    };
+
+    bool plan(long steps, int firstLevel);
+    bool createWaves(double peak);
+    void deleteWaves();
+    bool send(int dir);
+    long stepsDone();
+    int levelAt(double rate);
+
+    int pi_id;
+    TraceRecorder &trace;
+    Options opts;
+    bool configured = false;
+    std::recursive_mutex mutex;
+    bool halted = false;
+
+    int levelWave[RAMP_LEVELS + 1];         // One step waveform per ramp level, the last is the peak rate
+    double levelRate[RAMP_LEVELS + 1];
+    long levelSteps[RAMP_LEVELS];           // Steps spent at each level while accelerating
+    int levels = 0;
+
+    Segment segments[MAX_SEGMENTS];
+    int segmentCount = 0;
+    bool moving = false;
+    int moveDir = 1;
+    long moveFrom = 0;
+    struct timespec moveStart { 0, 0 };
+    long pos = 0;
+    bool known = false;
+};
@@ -0,0 +1,186 @@
+/*
+ Arduino controller emulator for the controller link tests
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+ * The controller end of the Arduino roll-off protocol, served on a pty master or a connected socket. Each
+ * "(CMD:TARGET:VALUE)" request is answered as the sketch does: CON with the version, GET with the switch state,
+ * SET with the value repeated. Targets in refused are answered with a NAK. While muted requests are read and
+ * dropped, like a controller that has hung.
+ */
+class ControllerEmulator
+{
+  public:
+    virtual ~ControllerEmulator() = default;
+
+    enum { SW_OPENED = 0x01, SW_CLOSED = 0x02, SW_LOCKED = 0x04, SW_AUX = 0x08 };
+
+    // The descriptor is not owned
+    void attach(int descriptor)
+    {
+        fd = descriptor;
+        in.clear();
+    }
+
+    // Answer every complete request that has arrived
+    virtual void serve()
+    {
+        char buf[256];
+        ssize_t n;
+
+        while (fd >= 0 && (n = ::read(fd, buf, sizeof(buf))) > 0)
+            in.append(buf, n);
+        size_t end;
+        while ((end = in.find(')')) != std::string::npos)
+        {
+            std::string request = in.substr(0, end + 1);
+            in.erase(0, end + 1);
+            size_t start = request.find('(');
+            if (start != std::string::npos)
+                answer(request.substr(start));
+        }
+    }
+
+    bool mute = false;
+    int switches = SW_OPENED;
+    std::string version = "V1.0";
+    std::string refused = "ABORT";
+    int requests = 0;
+
+  protected:
+    void answer(const std::string &request)
+    {
+        char cmd[8] = "";
+        char target[16] = "";
+        char value[16] = "";
+        char reply[64];
+
+        requests++;
+        if (mute || sscanf(request.c_str(), "(%7[^:]:%15[^:]:%15[^)])", cmd, target, value) < 2)
+            return;
+        if (strcmp(cmd, "CON") == 0)
+            snprintf(reply, sizeof(reply), "(ACK:%s:%s)\r\n", target, version.c_str());
+        else if (refused == target)
+            snprintf(reply, sizeof(reply), "(NAK:%s:not moving)\r\n", target);
+        else if (strcmp(cmd, "GET") == 0)
+            snprintf(reply, sizeof(reply), "(ACK:%s:%s)\r\n", target, (switches & switchBit(target)) ? "ON" : "OFF");
+        else
+            snprintf(reply, sizeof(reply), "(ACK:%s:%s)\r\n", target, value);
+        send(reply, strlen(reply));
+    }
+
+    void send(const char *data, size_t len)
+    {
+        if (fd >= 0 && ::write(fd, data, len) != (ssize_t)len)
+            fprintf(stderr, "emulator: short write: %s\n", strerror(errno));
+    }
+
+    static int switchBit(const char *target)
+    {
+        static const char *targets[] = { "OPENED", "CLOSED", "LOCKED", "AUXSTATE" };
+        for (int i = 0; i < 4; i++)
+            if (strcmp(target, targets[i]) == 0)
+                return 1 << i;
+        return 0;
+    }
+
+    int fd = -1;
+    std::string in;
+};
+
+/*
+ * A network controller on a loopback port. One connection is served at a time, a new one replaces it. Writes
+ * to a peer that has gone away raise SIGPIPE, tests using this ignore it.
+ */
+class TcpControllerEmulator : public ControllerEmulator
+{
+  public:
+    ~TcpControllerEmulator() override
+    {
+        stop();
+    }
+
+    // Listen on port, or on any free port when it is 0. Returns the port, or -1
+    int listen(int port = 0)
+    {
+        struct sockaddr_in addr {};
+        socklen_t len = sizeof(addr);
+        int one = 1;
+
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0)
+            return -1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(listenFd, 1) != 0 ||
+                getsockname(listenFd, (struct sockaddr *)&addr, &len) != 0)
+        {
+            stop();
+            return -1;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    void serve() override
+    {
+        int conn = listenFd < 0 ? -1 : accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn >= 0)
+        {
+            hangup();
+            connection = conn;
+            attach(conn);
+            connections++;
+        }
+        ControllerEmulator::serve();
+    }
+
+    // Close the connection, as a controller that resets
+    void hangup()
+    {
+        if (connection >= 0)
+            close(connection);
+        connection = -1;
+        attach(-1);
+    }
+
+    // Close the connection and stop listening, as a controller that is switched off
+    void stop()
+    {
+        hangup();
+        if (listenFd >= 0)
+            close(listenFd);
+        listenFd = -1;
+    }
+
+    int connections = 0;
+
+  private:
+    int listenFd = -1;
+    int connection = -1;
+};
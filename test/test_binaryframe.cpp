@@ -0,0 +1,159 @@
+/*
+ Binary frame codec, known values and a randomized stream
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "binaryframe.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void testKnownValues()
+{
+    BinaryFrame frame;
+    const BinaryFrame *found;
+    size_t used;
+
+    // The CRC-16/CCITT-FALSE check value
+    CHECK(binaryCrc(reinterpret_cast<const uint8_t *>("123456789"), 9) == 0x29B1);
+
+    binaryEncode(&frame, FRAME_STATUS | FRAME_REPLY, 7, STATUS_OPENED | STATUS_LOCKED, 0);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&frame);
+    CHECK(bytes[0] == BINARY_SYNC && bytes[1] == (FRAME_STATUS | FRAME_REPLY) && bytes[2] == 7);
+
+    // A partial frame waits for the rest without discarding anything
+    for (size_t len = 1; len < BINARY_FRAME_SIZE; len++)
+        CHECK(binaryDecode(bytes, len, &used, &found) == BINARY_NEED_MORE && used == 0 && found == nullptr);
+    CHECK(binaryDecode(bytes, BINARY_FRAME_SIZE, &used, &found) == BINARY_FRAME);
+    CHECK(used == BINARY_FRAME_SIZE && found == &frame && found->arg[0] == (STATUS_OPENED | STATUS_LOCKED));
+
+    // Every single bit error after the sync byte is caught, and only the sync byte is discarded
+    for (int bit = 8; bit < BINARY_FRAME_SIZE * 8; bit++)
+    {
+        BinaryFrame damaged = frame;
+        reinterpret_cast<uint8_t *>(&damaged)[bit / 8] ^= 1 << (bit % 8);
+        CHECK(binaryDecode(reinterpret_cast<const uint8_t *>(&damaged), BINARY_FRAME_SIZE, &used, &found) ==
+              BINARY_CORRUPT && used == 1);
+    }
+
+    // Noise with no sync byte is all discarded
+    uint8_t noise[] = { 0x00, 0xFF, 0x5A, 0x12 };
+    CHECK(binaryDecode(noise, sizeof(noise), &used, &found) == BINARY_NEED_MORE && used == sizeof(noise));
+    CHECK(binaryDecode(noise, 0, &used, &found) == BINARY_NEED_MORE && used == 0);
+}
+
+/*
+ * A stream of noise, truncated frames, frames with a bad CRC and valid frames, the valid ones numbered through
+ * their sequence and argument bytes. It is fed in random sized pieces through a buffer the size of the link's,
+ * decoded the way ControllerLink::receive() does. Every valid frame must come out in order. A false sync in the
+ * noise passes the CRC about one time in 65536 and can swallow the start of the valid frame after it, so a
+ * frame may only be missing where a spurious one was found, and those must stay that rare.
+ */
+static void testRandomStream(unsigned seed, int segments)
+{
+    std::mt19937 random(seed);
+    std::vector<uint8_t> stream;
+    BinaryFrame frame;
+    int valid = 0;
+
+    auto frameBytes = [&]() { return reinterpret_cast<uint8_t *>(&frame); };
+    for (int i = 0; i < segments; i++)
+    {
+        switch (random() % 4)
+        {
+            case 0:         // Noise, sync bytes included
+                for (int n = random() % 16; n > 0; n--)
+                    stream.push_back(random() % 8 == 0 ? BINARY_SYNC : random() & 0xFF);
+                break;
+            case 1:         // The start of a frame
+                binaryEncode(&frame, random() & 0xFF, random() & 0xFF, random() & 0xFF, random() & 0xFF);
+                stream.insert(stream.end(), frameBytes(), frameBytes() + 1 + random() % (BINARY_FRAME_SIZE - 1));
+                break;
+            case 2:         // A whole frame with one byte after the sync damaged
+                binaryEncode(&frame, random() & 0xFF, random() & 0xFF, random() & 0xFF, random() & 0xFF);
+                frameBytes()[1 + random() % (BINARY_FRAME_SIZE - 1)] ^= 1 + random() % 255;
+                stream.insert(stream.end(), frameBytes(), frameBytes() + BINARY_FRAME_SIZE);
+                break;
+            default:
+                binaryEncode(&frame, FRAME_STATUS | FRAME_REPLY, valid & 0xFF, (valid >> 8) & 0xFF, valid >> 16);
+                stream.insert(stream.end(), frameBytes(), frameBytes() + BINARY_FRAME_SIZE);
+                valid++;
+                break;
+        }
+    }
+
+    uint8_t in[256];
+    size_t inLen = 0;
+    size_t fed = 0;
+    int next = 0;
+    int lost = 0;
+    int spurious = 0;
+    for (;;)
+    {
+        const BinaryFrame *found;
+        size_t used;
+        int result = binaryDecode(in, inLen, &used, &found);
+        CHECK(used <= inLen);
+        if (result == BINARY_FRAME)
+        {
+            CHECK(found >= reinterpret_cast<const BinaryFrame *>(in) && used >= BINARY_FRAME_SIZE);
+            CHECK(binaryCrc(&found->type, 4) == (found->crc[0] | found->crc[1] << 8));
+            int number = found->seq | found->arg[0] << 8 | found->arg[1] << 16;
+            if (found->type == (FRAME_STATUS | FRAME_REPLY) && number >= next && number < valid)
+            {
+                lost += number - next;
+                next = number + 1;
+            }
+            else
+                spurious++;
+        }
+        else
+            CHECK(result == BINARY_CORRUPT ? used >= 1 : found == nullptr);
+        inLen -= used;
+        memmove(in, in + used, inLen);
+        if (result != BINARY_NEED_MORE)
+            continue;
+        // Waiting for more always leaves room for it, a full buffer would stall the link
+        CHECK(inLen < BINARY_FRAME_SIZE && (inLen == 0 || in[0] == BINARY_SYNC));
+        if (fed == stream.size())
+            break;
+        size_t n = std::min({ (size_t)1 + random() % 64, sizeof(in) - inLen, stream.size() - fed });
+        memcpy(in + inLen, stream.data() + fed, n);
+        inLen += n;
+        fed += n;
+    }
+    lost += valid - next;
+    if (lost > spurious || spurious > segments / 1000)
+        fprintf(stderr, "seed %u: %d of %d frames lost, %d spurious\n", seed, lost, valid, spurious);
+    CHECK(valid > segments / 5);
+    CHECK(lost <= spurious);
+    CHECK(spurious <= segments / 1000);
+}
+
+// Optional arguments: a seed and a segment count for longer runs
+int main(int argc, char **argv)
+{
+    unsigned seed = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1;
+    int segments = argc > 2 ? atoi(argv[2]) : 200000;
+
+    testKnownValues();
+    testRandomStream(seed, segments);
+    return checkFailures;
+}
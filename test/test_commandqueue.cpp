@@ -0,0 +1,84 @@
+/*
+ Roof request queue, merging and holding motion requests
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "commandqueue.h"
+
+// The roof opens, a close arrives that cannot reverse it, and the open times out
+static void testCloseWhileOpening()
+{
+    CommandQueue commands;
+    CommandQueue::Kind kind;
+    int value;
+
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_NONE, false) == CommandQueue::RUN);
+    CHECK(!commands.pending(CommandQueue::MOTION));
+
+    // Held rather than acted on, the open carries on
+    CHECK(commands.motion(CommandQueue::MOVE_CLOSE, CommandQueue::MOVE_OPEN, false) == CommandQueue::HOLD);
+    CHECK(commands.pending(CommandQueue::MOTION));
+    CHECK(commands.motion(CommandQueue::MOVE_CLOSE, CommandQueue::MOVE_OPEN, false) == CommandQueue::MERGE);
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_OPEN, false) == CommandQueue::MERGE);
+    CHECK(commands.post(CommandQueue::LOCK, 1));
+
+    // The open timed out, the close is the first request run
+    CHECK(commands.take(&kind, &value));
+    CHECK(kind == CommandQueue::MOTION && value == CommandQueue::MOVE_CLOSE);
+    CHECK(commands.take(&kind, &value));
+    CHECK(kind == CommandQueue::LOCK && value == 1);
+    CHECK(!commands.take(&kind, &value));
+}
+
+static void testReverse()
+{
+    CommandQueue commands;
+
+    // A roof that can be stopped is reversed at once, whatever was waiting
+    CHECK(commands.motion(CommandQueue::MOVE_CLOSE, CommandQueue::MOVE_OPEN, true) == CommandQueue::RUN);
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_CLOSE, false) == CommandQueue::HOLD);
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_CLOSE, true) == CommandQueue::RUN);
+    CHECK(!commands.pending(CommandQueue::MOTION));
+}
+
+static void testAtRest()
+{
+    CommandQueue commands;
+    CommandQueue::Kind kind;
+    int value;
+
+    // A waiting close is kept over a later open, and a close at rest replaces a waiting open
+    CHECK(commands.post(CommandQueue::MOTION, CommandQueue::MOVE_CLOSE));
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_NONE, false) == CommandQueue::MERGE);
+    CHECK(commands.take(&kind, &value) && value == CommandQueue::MOVE_CLOSE);
+    CHECK(commands.post(CommandQueue::MOTION, CommandQueue::MOVE_OPEN));
+    CHECK(commands.motion(CommandQueue::MOVE_OPEN, CommandQueue::MOVE_NONE, false) == CommandQueue::MERGE);
+    CHECK(commands.motion(CommandQueue::MOVE_CLOSE, CommandQueue::MOVE_NONE, false) == CommandQueue::RUN);
+    CHECK(!commands.pending(CommandQueue::MOTION));
+
+    commands.post(CommandQueue::AUX, 0);
+    commands.clear();
+    CHECK(!commands.take(&kind, &value));
+}
+
+int main()
+{
+    testCloseWhileOpening();
+    testReverse();
+    testAtRest();
+    return checkFailures;
+}
@@ -0,0 +1,116 @@
+/*
+ Controller link against an emulated Arduino on a pty
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "controlleremulator.h"
+#include "controllerlink.h"
+
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <vector>
+
+static std::vector<std::string> reports;
+static bool reportedError = false;
+
+static void report(bool error, const char *message)
+{
+    reports.push_back(message);
+    reportedError |= error;
+}
+
+static bool reported(const char *text)
+{
+    for (const std::string &message : reports)
+        if (message.find(text) != std::string::npos)
+            return true;
+    return false;
+}
+
+// Run the emulator and the link the way the driver does, input handled as it arrives and poll() from a timer
+template <typename Cond>
+static bool run(ControllerLink &link, ControllerEmulator &emulator, Cond cond, int ms)
+{
+    return waitFor([&]()
+    {
+        emulator.serve();
+        link.receive();
+        link.poll();
+        return cond();
+    }, ms);
+}
+
+int main()
+{
+    int master;
+    int slave;
+    char name[64];
+
+    // The slave stays open here as well so the master does not see a hangup while the link reopens
+    if (openpty(&master, &slave, name, nullptr, nullptr) != 0)
+    {
+        perror("openpty");
+        return 1;
+    }
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    ControllerEmulator emulator;
+    emulator.attach(master);
+    ControllerLink link(std::unique_ptr<LinkTransport>(new SerialTransport(name, 38400)), report);
+    bool on = false;
+
+    // Handshake, the connect request is repeated until the controller answers
+    CHECK(link.open());
+    CHECK(run(link, emulator, [&]() { return link.ready(); }, 3000));
+    CHECK(reported("Controller connected, version V1.0"));
+    CHECK(!reportedError);
+
+    // A status round is pipelined, every GET is outstanding before the first reply
+    emulator.switches = ControllerEmulator::SW_OPENED | ControllerEmulator::SW_LOCKED;
+    link.requestStatus();
+    CHECK(run(link, emulator, [&]() { return link.switchState(ControllerLink::SW_AUX, &on); }, 1000));
+    CHECK(link.switchState(ControllerLink::SW_OPENED, &on) && on);
+    CHECK(link.switchState(ControllerLink::SW_CLOSED, &on) && !on);
+    CHECK(link.switchState(ControllerLink::SW_LOCKED, &on) && on);
+    CHECK(link.takeErrors() == 0);
+
+    // A NAK is reported and retires its request
+    CHECK(link.request("SET", "ABORT", "ON"));
+    CHECK(link.request("SET", "OPEN", "ON"));
+    CHECK(run(link, emulator, [&]() { return reported("Controller refused ABORT: not moving"); }, 1000));
+    CHECK(reportedError);
+    CHECK(link.up() && link.takeErrors() == 0);
+
+    // A controller that stops answering has the link dropped after MAX_TIMEOUTS unanswered rounds
+    emulator.mute = true;
+    CHECK(run(link, emulator, [&]() { link.requestStatus(); return !link.up(); },
+              (ControllerLink::MAX_TIMEOUTS + 1) * 2500));
+    CHECK(reported("Controller link down, no replies"));
+    CHECK(link.takeErrors() >= ControllerLink::MAX_TIMEOUTS);
+    CHECK(link.reconnects() == 0);
+
+    // Reopened in the background once the controller answers again
+    emulator.mute = false;
+    CHECK(run(link, emulator, [&]() { return link.ready(); }, 5000));
+    CHECK(link.reconnects() == 1);
+    CHECK(reported("Controller link restored, version V1.0"));
+
+    link.close();
+    close(slave);
+    close(master);
+    return checkFailures;
+}
@@ -0,0 +1,209 @@
+/*
+ Current sensor trip thresholds against a scripted SPI ADC
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "currentsensor.h"
+
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <poll.h>
+#include <unistd.h>
+
+#define AMPS_PER_COUNT 0.1
+#define ZERO_COUNTS 512
+
+/*
+ * Stands in for an MCP3008. Each transfer answers with the next current in the script, the last one is
+ * repeated once the script runs out.
+ */
+class MockSpiBus : public SpiBus
+{
+  public:
+    bool open(unsigned channel, unsigned baud) override { return true; }
+    void close() override {}
+    bool transfer(uint8_t *tx, uint8_t *rx, unsigned count) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!script.empty())
+        {
+            amps = script.front();
+            script.pop_front();
+        }
+        int counts = (int)std::lround(ZERO_COUNTS + amps / AMPS_PER_COUNT);
+        rx[0] = 0;
+        rx[1] = (counts >> 8) & 0x03;
+        rx[2] = counts & 0xff;
+        return count == 3;
+    }
+
+    // Queue n samples of amps
+    void play(double value, int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < n; i++)
+            script.push_back(value);
+    }
+    bool finished()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return script.empty();
+    }
+
+  private:
+    std::mutex mutex;
+    std::deque<double> script;
+    double amps = 0;
+};
+
+struct Bench
+{
+    MockSpiBus *bus = new MockSpiBus;
+    CurrentSensor sensor { std::unique_ptr<SpiBus>(bus) };
+
+    Bench()
+    {
+        CurrentSensor::Options options;
+        options.rateHz = 1000;
+        options.ampsPerCount = AMPS_PER_COUNT;
+        options.zeroCounts = ZERO_COUNTS;
+        options.overcurrentAmps = 15;
+        options.stallAmps = 8;
+        options.stallMs = 100;
+        options.inrushMs = 50;
+        CHECK(sensor.start(options));
+    }
+
+    // Run a script with the sensor armed and wait for the sampler to play it out
+    int run()
+    {
+        CHECK(waitFor([&] { return bus->finished(); }, 5000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return sensor.trip();
+    }
+
+    bool signalled()
+    {
+        struct pollfd pfd = { sensor.eventFd(), POLLIN, 0 };
+        return poll(&pfd, 1, 0) == 1;
+    }
+};
+
+// Three samples in a row over the limit trip, the eventfd wakes the driver
+static void testOvercurrent()
+{
+    Bench b;
+    b.sensor.arm(true);
+    b.bus->play(2, 10);
+    b.bus->play(20, 3);
+    b.bus->play(2, 10);
+    CHECK(b.run() == CurrentSensor::TRIP_OVERCURRENT);
+    CHECK(b.signalled());
+    CHECK(std::fabs(b.sensor.peak() - 20) < 0.2);
+}
+
+// Spikes shorter than three samples are not a trip
+static void testSpikeIgnored()
+{
+    Bench b;
+    b.sensor.arm(true);
+    for (int i = 0; i < 5; i++)
+    {
+        b.bus->play(2, 5);
+        b.bus->play(20, 2);
+    }
+    b.bus->play(2, 5);
+    CHECK(b.run() == CurrentSensor::TRIP_NONE);
+    CHECK(!b.signalled());
+}
+
+// Current held over the stall level after the inrush period trips a stall
+static void testStall()
+{
+    Bench b;
+    b.sensor.arm(true);
+    b.bus->play(10, 200);
+    CHECK(b.run() == CurrentSensor::TRIP_STALL);
+    CHECK(b.signalled());
+}
+
+// High starting current within the inrush period, or a stall level shorter than stallMs, is normal running
+static void testInrushAndShortLoad()
+{
+    Bench b;
+    b.sensor.arm(true);
+    b.bus->play(10, 45);
+    b.bus->play(3, 100);
+    b.bus->play(10, 80);
+    b.bus->play(3, 20);
+    CHECK(b.run() == CurrentSensor::TRIP_NONE);
+    CHECK(b.sensor.mean() > 3 && b.sensor.mean() < 10);
+}
+
+// Nothing trips while disarmed, and arming again clears a trip
+static void testDisarmed()
+{
+    Bench b;
+    b.bus->play(20, 50);
+    CHECK(b.run() == CurrentSensor::TRIP_NONE);
+    b.sensor.arm(true);
+    b.bus->play(20, 5);
+    CHECK(b.run() == CurrentSensor::TRIP_OVERCURRENT);
+    b.sensor.arm(false);
+    b.sensor.arm(true);
+    CHECK(b.sensor.trip() == CurrentSensor::TRIP_NONE);
+    b.bus->play(2, 20);
+    CHECK(b.run() == CurrentSensor::TRIP_NONE);
+}
+
+// The trace can be written while the sampler is adding to it
+static void testTraceWhileSampling()
+{
+    Bench b;
+    char path[] = "/tmp/currentsensor_testXXXXXX";
+    int fd = mkstemp(path);
+    int lines = 0;
+    char line[64];
+
+    CHECK(fd >= 0);
+    close(fd);
+    b.bus->play(5, 3000);
+    for (int i = 0; i < 20; i++)
+        CHECK(b.sensor.writeTrace(path));
+    b.run();
+    CHECK(b.sensor.writeTrace(path));
+    FILE *fp = fopen(path, "r");
+    CHECK(fp != nullptr);
+    while (fp != nullptr && fgets(line, sizeof(line), fp) != nullptr)
+        lines++;
+    if (fp != nullptr)
+        fclose(fp);
+    unlink(path);
+    CHECK(lines == CurrentSensor::TRACE_SIZE + 1);
+}
+
+int main()
+{
+    testOvercurrent();
+    testSpikeIgnored();
+    testStall();
+    testInrushAndShortLoad();
+    testDisarmed();
+    testTraceWhileSampling();
+    return checkFailures;
+}
@@ -0,0 +1,158 @@
+/*
+ Position sensor against a scripted I2C bus
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "positionsensor.h"
+
+#include <cmath>
+#include <mutex>
+
+/*
+ * Stands in for a distance sensor. Each read returns the current raw value in the byte order the sensor is
+ * configured for, or fails while failing is set.
+ */
+class MockI2cBus : public I2cBus
+{
+  public:
+    bool open(unsigned bus, unsigned address) override
+    {
+        opened = openOk;
+        openedBus = bus;
+        openedAddress = address;
+        return opened;
+    }
+    void close() override { opened = false; }
+    int readRegister(uint8_t reg, uint8_t *buf, unsigned count) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reads++;
+        if (failing || count != 2)
+            return -1;
+        lastReg = reg;
+        buf[0] = lsbFirst ? raw & 0xff : raw >> 8;
+        buf[1] = lsbFirst ? raw >> 8 : raw & 0xff;
+        return 2;
+    }
+
+    void set(unsigned value, bool fail = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        raw = value;
+        failing = fail;
+    }
+    unsigned readCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return reads;
+    }
+
+    bool openOk = true;
+    bool opened = false;
+    bool lsbFirst = false;
+    unsigned openedBus = 0;
+    unsigned openedAddress = 0;
+    uint8_t lastReg = 0xff;
+
+  private:
+    std::mutex mutex;
+    unsigned raw = 0;
+    bool failing = false;
+    unsigned reads = 0;
+};
+
+// The median window removes a single outlier before it reaches the Kalman filter
+static void testFilterRejectsOutlier()
+{
+    PositionSensor sensor(std::unique_ptr<I2cBus>(new MockI2cBus));
+    double mm = 0;
+
+    for (int i = 0; i < 10; i++)
+        mm = sensor.filter(1000, 0.05);
+    CHECK(std::fabs(mm - 1000) < 1);
+    mm = sensor.filter(9000, 0.05);
+    CHECK(std::fabs(mm - 1000) < 1);
+    mm = sensor.filter(1000, 0.05);
+    CHECK(std::fabs(mm - 1000) < 1);
+}
+
+// A step in distance is followed within a few samples, as a roof moving at speed would be
+static void testFilterTracksStep()
+{
+    PositionSensor sensor(std::unique_ptr<I2cBus>(new MockI2cBus));
+    double mm = 0;
+
+    for (int i = 0; i < 10; i++)
+        sensor.filter(1000, 0.05);
+    for (int i = 0; i < 10; i++)
+        mm = sensor.filter(1500, 0.05);
+    CHECK(std::fabs(mm - 1500) < 10);
+}
+
+static void testSampling(bool lsbFirst)
+{
+    MockI2cBus *bus = new MockI2cBus;
+    PositionSensor sensor { std::unique_ptr<I2cBus>(bus) };
+    PositionSensor::Options options;
+
+    bus->lsbFirst = lsbFirst;
+    bus->set(1234);
+    options.bus = 3;
+    options.address = 0x29;
+    options.reg = 0x14;
+    options.rateHz = 500;
+    options.mmPerCount = 10;
+    options.lsbFirst = lsbFirst;
+    CHECK(sensor.start(options));
+    CHECK(bus->opened && bus->openedBus == 3 && bus->openedAddress == 0x29);
+    CHECK(waitFor([&] { return sensor.samples() >= 20; }, 2000));
+    CHECK(bus->lastReg == 0x14);
+    CHECK(std::fabs(sensor.distance() - 12340) < 1);
+
+    // Failed reads are counted and leave the last distance in place
+    bus->set(0, true);
+    uint32_t errors = sensor.errors();
+    CHECK(waitFor([&] { return sensor.errors() >= errors + 10; }, 2000));
+    CHECK(std::fabs(sensor.distance() - 12340) < 1);
+
+    sensor.stop();
+    CHECK(!sensor.running());
+    CHECK(!bus->opened);
+    unsigned reads = bus->readCount();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(bus->readCount() == reads);
+}
+
+static void testOpenFailure()
+{
+    MockI2cBus *bus = new MockI2cBus;
+    PositionSensor sensor { std::unique_ptr<I2cBus>(bus) };
+
+    bus->openOk = false;
+    CHECK(!sensor.start(PositionSensor::Options()));
+    CHECK(!sensor.running());
+}
+
+int main()
+{
+    testFilterRejectsOutlier();
+    testFilterTracksStep();
+    testSampling(false);
+    testSampling(true);
+    testOpenFailure();
+    return checkFailures;
+}
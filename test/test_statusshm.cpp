@@ -0,0 +1,117 @@
+/*
+ Status shared memory segment reuse and reader compatibility
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "statusshm.h"
+
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Map the segment the way a consumer would
+static RoofStatusShm *mapSegment(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(RoofStatusShm)) != 0)
+        return nullptr;
+    void *map = mmap(nullptr, sizeof(RoofStatusShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? nullptr : static_cast<RoofStatusShm *>(map);
+}
+
+static RoofStatusData sample()
+{
+    RoofStatusData data;
+    memset(&data, 0, sizeof(data));
+    data.switches = RoofStatusData::SW_OPENED;
+    data.motion = RoofStatusData::MOTION_NONE;
+    data.connected = 1;
+    data.openFraction = 1;
+    data.etaSeconds = 12.5;
+    return data;
+}
+
+// A segment left mid-update by a driver that died is made readable again on open
+static void testReuseAfterCrash(const std::string &name)
+{
+    RoofStatusShm *view = mapSegment(name);
+    RoofStatusData out;
+
+    CHECK(view != nullptr);
+    if (view == nullptr)
+        return;
+    view->seq.store(41);
+    view->magic = ROOF_SHM_MAGIC;
+    view->version = ROOF_SHM_VERSION;
+    view->size = sizeof(RoofStatusData);
+
+    StatusShm writer;
+    CHECK(writer.open(name));
+    CHECK((view->seq.load() & 1) == 0);
+    CHECK(view->seq.load() > 41);
+    CHECK(readRoofStatus(view, &out));
+    CHECK(out.etaSeconds == -1 && out.updates == 0);
+
+    writer.publish(sample());
+    CHECK((view->seq.load() & 1) == 0);
+    CHECK(readRoofStatus(view, &out));
+    CHECK(out.switches == RoofStatusData::SW_OPENED && out.connected == 1 && out.updates == 1);
+
+    // A writer stuck mid-update is reported rather than read
+    uint32_t seq = view->seq.load();
+    view->seq.store(seq + 1);
+    CHECK(!readRoofStatus(view, &out, 10));
+    view->seq.store(seq);
+
+    writer.close();
+    CHECK(readRoofStatus(view, &out));
+    CHECK(out.connected == 0 && out.switches == RoofStatusData::SW_OPENED);
+    munmap(view, sizeof(RoofStatusShm));
+}
+
+// A reader newer than the writer gets the fields the writer had and zero in the rest
+static void testShorterWriter(const std::string &name)
+{
+    RoofStatusShm *view = mapSegment(name);
+    RoofStatusData out;
+
+    CHECK(view != nullptr);
+    if (view == nullptr)
+        return;
+    StatusShm writer;
+    CHECK(writer.open(name));
+    writer.publish(sample());
+    view->size = offsetof(RoofStatusData, etaSeconds);
+    CHECK(readRoofStatus(view, &out));
+    CHECK(out.openFraction == 1 && out.connected == 1);
+    CHECK(out.etaSeconds == 0 && out.updates == 0);
+
+    view->magic = 0;
+    CHECK(!readRoofStatus(view, &out));
+    munmap(view, sizeof(RoofStatusShm));
+}
+
+int main()
+{
+    std::string name = "/rolloffrpi_test_" + std::to_string(getpid());
+    testReuseAfterCrash(name);
+    testShorterWriter(name);
+    shm_unlink(name.c_str());
+    return checkFailures;
+}
@@ -0,0 +1,111 @@
+/*
+ Controller link against a TCP stand-in controller
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "check.h"
+#include "controlleremulator.h"
+#include "controllerlink.h"
+
+#include <csignal>
+#include <vector>
+
+static std::vector<std::string> reports;
+
+static void report(bool error, const char *message)
+{
+    reports.push_back(message);
+}
+
+static bool reported(const char *text)
+{
+    for (const std::string &message : reports)
+        if (message.find(text) != std::string::npos)
+            return true;
+    return false;
+}
+
+template <typename Cond>
+static bool run(ControllerLink &link, ControllerEmulator &emulator, Cond cond, int ms)
+{
+    return waitFor([&]()
+    {
+        emulator.serve();
+        link.receive();
+        link.poll();
+        return cond();
+    }, ms);
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    TcpControllerEmulator emulator;
+    emulator.version = "V2.1";
+    int port = emulator.listen();
+    CHECK(port > 0);
+
+    TcpTransport *transport = new TcpTransport();
+    CHECK(transport->resolve("127.0.0.1", port));
+    ControllerLink link(std::unique_ptr<LinkTransport>(transport), report);
+    bool on = false;
+
+    // The connect completes in the background, then the handshake
+    CHECK(link.open());
+    CHECK(run(link, emulator, [&]() { return link.ready(); }, 3000));
+    CHECK(emulator.connections == 1);
+    CHECK(reported("Controller connected, version V2.1"));
+
+    // Commands and status queries share one pipeline, up to MAX_PENDING outstanding
+    int sent = 0;
+    while (link.request("SET", "AUXSET", "ON"))
+        sent++;
+    CHECK(sent == ControllerLink::MAX_PENDING);
+    CHECK(run(link, emulator, [&]() { return emulator.requests == 1 + sent; }, 1000));
+    // Queued behind the commands from the timer, as the driver does
+    CHECK(run(link, emulator, [&]() { link.requestStatus(); return link.switchState(ControllerLink::SW_AUX, &on); },
+              1000));
+    CHECK(link.switchState(ControllerLink::SW_OPENED, &on) && on);
+    CHECK(link.takeErrors() == 0);
+
+    // A NAK leaves the link up
+    CHECK(link.request("SET", "ABORT", "ON"));
+    CHECK(run(link, emulator, [&]() { return reported("Controller refused ABORT: not moving"); }, 1000));
+    CHECK(link.up());
+
+    // A controller that resets is reconnected to without the driver doing anything
+    emulator.hangup();
+    CHECK(run(link, emulator, [&]() { return !link.up(); }, 1000));
+    CHECK(reported("Controller link down, closed by the controller"));
+    CHECK(run(link, emulator, [&]() { return link.ready(); }, 3000));
+    CHECK(emulator.connections == 2);
+    CHECK(link.reconnects() == 1);
+
+    // One that is switched off is retried, with the loss reported once, until it is back
+    size_t before = reports.size();
+    emulator.stop();
+    CHECK(run(link, emulator, [&]() { return !link.up(); }, 1000));
+    run(link, emulator, []() { return false; }, 1500);
+    CHECK(!link.ready());
+    CHECK(reports.size() == before + 1);
+    CHECK(emulator.listen(port) == port);
+    CHECK(run(link, emulator, [&]() { return link.ready(); }, 5000));
+    CHECK(link.reconnects() == 2);
+    CHECK(reported("Controller link restored, version V2.1"));
+
+    link.close();
+    return checkFailures;
+}
@@ -0,0 +1,122 @@
+/*
+ Chrome trace-event recording of driver activity
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "tracerecorder.h"
+
+#include <cstdio>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int64_t micros(const struct timespec &ts)
+{
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The kernel thread id, the track a span is drawn on
+static int32_t threadId()
+{
+    static thread_local int32_t tid = (int32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+void TraceRecorder::enable(bool enabling)
+{
+    if (enabling && !events)
+        events.reset(new Event[CAPACITY]);
+    if (enabling)
+    {
+        next.store(0, std::memory_order_relaxed);
+        driverTid = threadId();
+    }
+    on.store(enabling, std::memory_order_release);
+}
+
+uint32_t TraceRecorder::recorded() const
+{
+    uint32_t count = next.load(std::memory_order_relaxed);
+    return count < CAPACITY ? count : CAPACITY;
+}
+
+void TraceRecorder::span(const char *name, const char *detail, const struct timespec &start,
+                         const struct timespec &end)
+{
+    if (!enabled())
+        return;
+    uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+    Event &event = events[index % CAPACITY];
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.detail.store(detail, std::memory_order_relaxed);
+    event.startUs.store(micros(start), std::memory_order_relaxed);
+    event.durationUs.store(micros(end) - micros(start), std::memory_order_relaxed);
+    event.tid.store(threadId(), std::memory_order_relaxed);
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+// Complete ("X") events only, so a span whose start was overwritten cannot leave an unmatched end
+bool TraceRecorder::writeJson(const char *path) const
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr)
+        return false;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"indi_rolloffrpi\"}}",
+            driverTid);
+    uint32_t last = next.load(std::memory_order_acquire);
+    uint32_t count = last < CAPACITY ? last : CAPACITY;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t index = last - count + i;
+        const Event &event = events[index % CAPACITY];
+        if (event.seq.load(std::memory_order_acquire) != index + 1)
+            continue;
+        const char *name = event.name.load(std::memory_order_relaxed);
+        const char *detail = event.detail.load(std::memory_order_relaxed);
+        long long startUs = event.startUs.load(std::memory_order_relaxed);
+        long long durationUs = event.durationUs.load(std::memory_order_relaxed);
+        int tid = event.tid.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.seq.load(std::memory_order_relaxed) != index + 1)
+            continue;
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"driver\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                name, tid, startUs, durationUs);
+        if (detail != nullptr)
+            fprintf(fp, ",\"args\":{\"target\":\"%s\"}", detail);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+TraceSpan::TraceSpan(TraceRecorder &recorder, const char *name, const char *detail)
+    : trace(recorder), label(name), extra(detail)
+{
+    if (trace.enabled())
+        clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!trace.enabled() || start.tv_sec == 0)
+        return;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace.span(label, extra, start, end);
+}
@@ -0,0 +1,80 @@
+/*
+ Chrome trace-event recording of driver activity
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+
+/*
+ * Spans of driver activity in a ring buffer, exported as Chrome trace-event JSON for Perfetto or
+ * chrome://tracing. The buffer is allocated when tracing is first turned on, recording then only fills in
+ * an entry, and when off a span costs one test of a flag. Spans may be recorded from any thread without a
+ * lock, such as the pulse thread or the pigpiod_if2 callback thread, and each thread gets its own track.
+ * enable() and writeJson() are called from the driver thread.
+ */
+class TraceRecorder
+{
+  public:
+    static constexpr uint32_t CAPACITY = 32768;     // Oldest spans are overwritten
+
+    // Turning on starts a fresh trace, turning off keeps it for export
+    void enable(bool on);
+    bool enabled() const { return on.load(std::memory_order_acquire); }
+    uint32_t recorded() const;
+
+    // name and detail must be string literals, only the pointers are kept
+    void span(const char *name, const char *detail, const struct timespec &start, const struct timespec &end);
+    bool writeJson(const char *path) const;
+
+  private:
+    // Complete when seq holds its index plus one. A recording thread clears seq while it fills the entry in,
+    // and an export leaves out entries that change under it.
+    struct Event
+    {
+        std::atomic<uint32_t> seq { 0 };
+        std::atomic<const char *> name { nullptr };
+        std::atomic<const char *> detail { nullptr };
+        std::atomic<int64_t> startUs { 0 };
+        std::atomic<int64_t> durationUs { 0 };
+        std::atomic<int32_t> tid { 0 };
+    };
+
+    std::unique_ptr<Event[]> events;
+    std::atomic<uint32_t> next { 0 };
+    std::atomic<bool> on { false };
+    int32_t driverTid = 0;
+};
+
+/*
+ * Records the enclosing scope as one span
+ */
+class TraceSpan
+{
+  public:
+    TraceSpan(TraceRecorder &recorder, const char *name, const char *detail = nullptr);
+    ~TraceSpan();
+
+  private:
+    TraceRecorder &trace;
+    const char *label;
+    const char *extra;
+    struct timespec start {};
+};